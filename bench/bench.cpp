@@ -0,0 +1,228 @@
+// Host benchmarks for the control loop and web hot paths.
+//
+//   pio run -e native -t exec
+//   .pio/build/native/program --check
+//
+// Runs the firmware's setup() against the stand-ins in host/, then times
+// each function with a steady clock and reports ns/op and heap
+// allocations/op. Absolute times are host times; compare them between
+// builds on the same machine, not with the ESP8266. Allocation counts carry
+// over: the host String moves to the heap past the core's inline length,
+// and the web server stand-in returns arguments and headers by reference as
+// the core's does.
+//
+// The handlers run through host::request(), i.e. with the route lookup and
+// the /metrics timing wrapper around them, as on the device.
+//
+// --check skips the timing and asserts instead: /state, with and without
+// status, and its 304 answer must not allocate. Exit status: 0 when they
+// do not, 1 when one does, 2 on usage errors.
+
+// pio test builds src/ and this directory into every test, which brings
+// its own main()
+#ifndef PIO_UNIT_TESTING
+
+#include <Arduino.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "crossfade.h"
+#include "daylight_curve.h"
+#include "dither.h"
+#include "host.h"
+#include "json_writer.h"
+#include "weather.h"
+
+// Firmware functions under test (src/main.cpp)
+void setup();
+void loop();
+PwmLevel evaluateSchedule(int32_t msOfDay);
+void applyOutputs(const RGBLevel &rgb);
+void writeChannelSummary(JsonWriter &json);
+
+namespace {
+
+constexpr time_t BENCH_EPOCH = 1717243200;  // 2024-06-01 12:00 UTC, mid-ramp on the default schedule
+constexpr double MIN_RUN_SECONDS = 0.2;
+constexpr uint32_t WARMUP_OPS = 1000;
+constexpr uint32_t CHECK_OPS = 100;
+constexpr uint16_t PWM_MAX_COUNT = 1023 << DITHER_BITS;  // PWM_MAX in src/main.cpp
+
+volatile uint32_t sink;  // keeps results alive
+
+typedef std::chrono::steady_clock BenchClock;
+
+template <typename Op>
+double timeOps(Op &op, uint32_t count) {
+  BenchClock::time_point start = BenchClock::now();
+  for (uint32_t i = 0; i < count; ++i) op();
+  return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// Doubles the op count until a run takes MIN_RUN_SECONDS, then reports
+// that run
+template <typename Op>
+void bench(const char *name, Op op) {
+  timeOps(op, WARMUP_OPS);
+
+  uint32_t count = WARMUP_OPS;
+  for (;;) {
+    uint64_t allocationsBefore = host::allocations();
+    double seconds = timeOps(op, count);
+    uint64_t allocations = host::allocations() - allocationsBefore;
+    if (seconds >= MIN_RUN_SECONDS || count >= (1u << 30)) {
+      printf("%-36s %10.1f %12.2f %12u\n", name, seconds * 1e9 / count, static_cast<double>(allocations) / count,
+             count);
+      return;
+    }
+    count *= 2;
+  }
+}
+
+// Runs a request CHECK_OPS times after a warmup (first-call setup is not
+// counted) and reports whether any of them allocated or answered other
+// than status
+template <typename Request>
+bool expectNoAllocations(const char *name, int status, Request request) {
+  for (uint32_t i = 0; i < CHECK_OPS; ++i) request();
+  uint64_t allocationsBefore = host::allocations();
+  bool answered = true;
+  for (uint32_t i = 0; i < CHECK_OPS; ++i) answered &= request() == status;
+  uint64_t allocations = host::allocations() - allocationsBefore;
+  bool ok = answered && allocations == 0;
+  printf("%-36s %-4s %llu allocations in %u ops%s\n", name, ok ? "ok" : "FAIL",
+         static_cast<unsigned long long>(allocations), CHECK_OPS, answered ? "" : ", wrong status");
+  return ok;
+}
+
+void usage(FILE *out) {
+  fprintf(out,
+          "usage: program [--check]\n"
+          "  --check   assert that /state and its 304 do not allocate, instead of timing\n");
+}
+
+// /state and its ETag, fetched fresh
+void fetchStateEtag(char *etag, size_t size) {
+  host::request(HTTP_GET, "/state");
+  snprintf(etag, size, "%s", host::responseHeader("ETag"));
+}
+
+int check() {
+  char stateEtag[24];
+  fetchStateEtag(stateEtag, sizeof(stateEtag));
+  bool ok = true;
+  ok &= expectNoAllocations("handleState", 200, []() { return host::request(HTTP_GET, "/state"); });
+  ok &= expectNoAllocations("handleState?status=1", 200,
+                            []() { return host::request(HTTP_GET, "/state", "status=1"); });
+  fetchStateEtag(stateEtag, sizeof(stateEtag));
+  ok &= expectNoAllocations("handleState (304)", 304,
+                            [&]() { return host::request(HTTP_GET, "/state", nullptr, nullptr, stateEtag); });
+  return ok ? 0 : 1;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  bool checkOnly = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--check") == 0) {
+      checkOnly = true;
+    } else if (strcmp(argv[i], "--help") == 0) {
+      usage(stdout);
+      return 0;
+    } else {
+      fprintf(stderr, "unknown option: %s\n", argv[i]);
+      usage(stderr);
+      return 2;
+    }
+  }
+
+  setup();
+  host::syncTime(BENCH_EPOCH);
+  host::request(HTTP_POST, "/assign", "channel=0&color=red");
+  host::request(HTTP_POST, "/assign", "channel=1&color=green");
+  host::request(HTTP_POST, "/assign", "channel=2&color=blue");
+  for (int i = 0; i < 100; ++i) loop();  // connect, start tasks, settle the fade
+  if (checkOnly) return check();
+
+  printf("%-36s %10s %12s %12s\n", "benchmark", "ns/op", "allocs/op", "ops");
+
+  // 10 ms steps: the fade tick path, where the cursor only advances
+  int32_t msOfDay = 12 * 3600000;
+  bench("evaluateSchedule/tick", [&]() {
+    msOfDay = (msOfDay + 10) % MS_PER_DAY;
+    sink = sink + evaluateSchedule(msOfDay).red;
+  });
+
+  // Large jumps: every call seeks (clock set, schedule swapped)
+  uint32_t jump = 0;
+  bench("evaluateSchedule/seek", [&]() {
+    jump = (jump + 7919321) % MS_PER_DAY;
+    sink = sink + evaluateSchedule(jump).red;
+  });
+
+  // Weather on top of a tick, at full detail and fully degraded
+  WeatherEngine sky(60, 1);
+  sky.configure(WEATHER_STORM, 60, 1);
+  const PwmLevel noon = {12000, 12000, 13000};
+  uint32_t weatherMs = 12 * 3600000;
+  bench("weather.apply/tick", [&]() {
+    weatherMs = (weatherMs + 10) % MS_PER_DAY;
+    sink = sink + sky.apply(noon, 19875, weatherMs, PWM_MAX_COUNT).red;
+  });
+  for (uint8_t i = 0; i < WEATHER_QUALITY_LEVELS; ++i) sky.frameTime(1, 0);
+  bench("weather.apply/degraded", [&]() {
+    weatherMs = (weatherMs + 10) % MS_PER_DAY;
+    sink = sink + sky.apply(noon, 19875, weatherMs, PWM_MAX_COUNT).red;
+  });
+
+  // A crossfade in progress (restarted before it ends) and an idle one
+  LevelCrossfade fade;
+  const PwmLevel dark = {0, 0, 0};
+  uint32_t fadeMs = 0;
+  bench("crossfade.apply/running", [&]() {
+    fadeMs += 10;
+    if (fadeMs % 60000 == 0) fade.start(dark, 60000, fadeMs);
+    sink = sink + fade.apply(noon, fadeMs).red;
+  });
+  fade.cancel();
+  bench("crossfade.apply/idle", [&]() {
+    sink = sink + fade.apply(noon, ++fadeMs).red;
+  });
+
+  // Alternate two levels so every call re-targets all channels
+  uint32_t step = 0;
+  bench("applyOutputs", [&]() {
+    float level = (++step & 1) ? 0.25f : 0.75f;
+    applyOutputs({level, level * 0.5f, level * 0.25f});
+  });
+
+  char summary[256];
+  bench("writeChannelSummary", [&]() {
+    JsonWriter json(summary, sizeof(summary));
+    writeChannelSummary(json);
+    sink = sink + json.length();
+  });
+
+  bench("handleState", [&]() { sink = sink + host::request(HTTP_GET, "/state"); });
+
+  bench("handleState?status=1", [&]() { sink = sink + host::request(HTTP_GET, "/state", "status=1"); });
+
+  char stateEtag[24];
+  fetchStateEtag(stateEtag, sizeof(stateEtag));
+  bench("handleState (304)", [&]() { sink = sink + host::request(HTTP_GET, "/state", nullptr, nullptr, stateEtag); });
+
+  bench("handleRoot", [&]() { sink = sink + host::request(HTTP_GET, "/"); });
+
+  host::request(HTTP_GET, "/");
+  char rootEtag[48];
+  snprintf(rootEtag, sizeof(rootEtag), "%s", host::responseHeader("ETag"));
+  bench("handleRoot (304)", [&]() { sink = sink + host::request(HTTP_GET, "/", nullptr, nullptr, rootEtag); });
+
+  return 0;
+}
+
+#endif  // PIO_UNIT_TESTING
@@ -0,0 +1,229 @@
+#pragma once
+
+// Host stand-in for the parts of the ESP8266 Arduino core used by the
+// firmware. Flash (PROGMEM) is ordinary memory here.
+
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+using std::max;
+using std::min;
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+
+class __FlashStringHelper;
+#define FPSTR(p) (reinterpret_cast<const __FlashStringHelper *>(p))
+#define F(s) FPSTR(s)
+
+inline uint8_t pgm_read_byte(const void *p) { return *static_cast<const uint8_t *>(p); }
+inline uint16_t pgm_read_word(const void *p) { return *static_cast<const uint16_t *>(p); }
+inline uint32_t pgm_read_dword(const void *p) { return *static_cast<const uint32_t *>(p); }
+inline char *strncpy_P(char *dest, PGM_P src, size_t size) { return strncpy(dest, src, size); }
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+
+#define INPUT 0
+#define OUTPUT 1
+
+typedef bool boolean;
+
+// ------------------------------------------------------------
+// String (backed by std::string)
+// ------------------------------------------------------------
+// The ESP8266 core keeps up to SSO_LENGTH characters inside the String
+// (SSOSIZE in WString.h, 11 bytes with the terminator); std::string keeps
+// up to 15. A longer String is moved to the heap here as well, so
+// host::allocations() counts the Strings that allocate on the device.
+class String {
+ public:
+  static constexpr unsigned SSO_LENGTH = 10;
+
+  String() {}
+  String(const char *s) : s_(s ? s : "") { fit(); }
+  String(const __FlashStringHelper *s) : s_(reinterpret_cast<const char *>(s)) { fit(); }
+  String(const std::string &s) : s_(s) { fit(); }
+  String(const String &other) : s_(other.s_) { fit(); }
+  String(String &&other) = default;
+  explicit String(char c) : s_(1, c) {}
+  String(int v) : s_(std::to_string(v)) { fit(); }
+  String(unsigned v) : s_(std::to_string(v)) { fit(); }
+  String(long v) : s_(std::to_string(v)) { fit(); }
+  String(unsigned long v) : s_(std::to_string(v)) { fit(); }
+  String(float v, unsigned char decimals = 2) { format(v, decimals); }
+  String(double v, unsigned char decimals = 2) { format(v, decimals); }
+
+  String &operator=(const String &other) {
+    s_ = other.s_;
+    fit();
+    return *this;
+  }
+  String &operator=(String &&other) = default;
+  String &operator=(const char *other) {
+    s_ = other ? other : "";
+    fit();
+    return *this;
+  }
+
+  unsigned length() const { return s_.size(); }
+  const char *c_str() const { return s_.c_str(); }
+  bool reserve(unsigned size) {
+    s_.reserve(size > SSO_LENGTH ? max<size_t>(size, STD_INLINE_LENGTH + 1) : size);
+    return true;
+  }
+
+  String &operator+=(const String &other) {
+    s_ += other.s_;
+    fit();
+    return *this;
+  }
+  String &operator+=(const char *other) {
+    s_ += other;
+    fit();
+    return *this;
+  }
+  String &operator+=(char c) {
+    s_ += c;
+    fit();
+    return *this;
+  }
+  bool concat(const char *data, unsigned length) {
+    s_.append(data, length);
+    fit();
+    return true;
+  }
+  bool operator==(const char *other) const { return s_ == other; }
+  bool operator==(const String &other) const { return s_ == other.s_; }
+  bool operator!=(const char *other) const { return s_ != other; }
+  char operator[](unsigned index) const { return s_[index]; }
+
+  bool equalsIgnoreCase(const String &other) const {
+    if (s_.size() != other.s_.size()) return false;
+    for (size_t i = 0; i < s_.size(); ++i) {
+      if (tolower(s_[i]) != tolower(other.s_[i])) return false;
+    }
+    return true;
+  }
+  bool startsWith(const String &prefix) const { return s_.compare(0, prefix.s_.size(), prefix.s_) == 0; }
+  int indexOf(char c, unsigned from = 0) const {
+    size_t pos = s_.find(c, from);
+    return pos == std::string::npos ? -1 : static_cast<int>(pos);
+  }
+  String substring(unsigned from) const { return String(s_.substr(from)); }
+  String substring(unsigned from, unsigned to) const { return String(s_.substr(from, to - from)); }
+  void toLowerCase() {
+    for (char &c : s_) c = static_cast<char>(tolower(c));
+  }
+  long toInt() const { return atol(s_.c_str()); }
+  float toFloat() const { return static_cast<float>(atof(s_.c_str())); }
+
+  const std::string &str() const { return s_; }
+  std::string &str() { return s_; }  // storage the host stand-ins reserve themselves
+
+ private:
+  static constexpr size_t STD_INLINE_LENGTH = 15;  // libstdc++
+
+  void fit() {
+    if (s_.size() > SSO_LENGTH && s_.capacity() <= STD_INLINE_LENGTH) s_.reserve(STD_INLINE_LENGTH + 1);
+  }
+
+  void format(double v, unsigned char decimals) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, v);
+    s_ = buffer;
+    fit();
+  }
+
+  std::string s_;
+};
+
+inline String operator+(const String &a, const String &b) { return String(a.str() + b.str()); }
+inline String operator+(const String &a, const char *b) { return String(a.str() + b); }
+inline String operator+(const char *a, const String &b) { return String(a + b.str()); }
+
+extern const String emptyString;
+
+// ------------------------------------------------------------
+// Print / Stream / Serial
+// ------------------------------------------------------------
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    size_t written = 0;
+    while (size--) written += write(*buffer++);
+    return written;
+  }
+  size_t write(const char *s) { return write(reinterpret_cast<const uint8_t *>(s), strlen(s)); }
+  size_t print(const char *s) { return write(s); }
+  size_t print(const String &s) { return write(s.c_str()); }
+  size_t println(const char *s = "") { return print(s) + print("\n"); }
+  size_t println(const String &s) { return println(s.c_str()); }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+};
+
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t c) override { return fputc(c, stderr) == EOF ? 0 : 1; }
+  using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+// ------------------------------------------------------------
+// Core functions (virtual clock, see host.h)
+// ------------------------------------------------------------
+unsigned long millis();
+unsigned long micros();
+uint64_t micros64();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+void analogWrite(uint8_t pin, int value);
+void analogWriteRange(uint32_t range);
+void analogWriteFreq(uint32_t freq);
+
+class EspClass {
+ public:
+  void restart();
+  String getResetReason();
+  uint32_t getChipId();
+  uint32_t getCycleCount();
+  uint32_t random();  // the same sequence on every run
+  uint32_t getFreeSketchSpace();
+  uint32_t getFreeHeap();
+  uint32_t getMaxFreeBlockSize();
+  uint8_t getHeapFragmentation();
+
+  bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size);
+  bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size);
+
+  // 64 kB of emulated flash starting at address 0, erased (0xFF) at start
+  bool flashEraseSector(uint32_t sector);
+  bool flashWrite(uint32_t address, const uint32_t *data, size_t size);
+  bool flashRead(uint32_t address, uint32_t *data, size_t size);
+};
+
+extern EspClass ESP;
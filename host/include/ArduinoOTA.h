@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <functional>
+
+// Host stand-in: OTA never starts
+typedef enum {
+  OTA_AUTH_ERROR,
+  OTA_BEGIN_ERROR,
+  OTA_CONNECT_ERROR,
+  OTA_RECEIVE_ERROR,
+  OTA_END_ERROR
+} ota_error_t;
+
+class ArduinoOTAClass {
+ public:
+  void setHostname(const char *) {}
+  void onStart(std::function<void()>) {}
+  void onEnd(std::function<void()>) {}
+  void onProgress(std::function<void(unsigned int, unsigned int)>) {}
+  void onError(std::function<void(ota_error_t)>) {}
+  void begin(bool = true) {}
+  void handle() {}
+};
+
+extern ArduinoOTAClass ArduinoOTA;
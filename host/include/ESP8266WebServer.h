@@ -0,0 +1,134 @@
+#pragma once
+
+#include <ESP8266WiFi.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Host stand-in for ESP8266WebServer. Requests are injected with
+// host::request() and the response is kept for inspection; it is also
+// written to the request's client, so a slow host::Connection makes send()
+// block as on the device.
+// Argument, header and body storage is reserved up front so the server
+// itself does not allocate while a request is handled; what shows up in
+// host::allocations() comes from the handlers. arg() and header() return
+// the stored String, as the core's do.
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#define HTTP_UPLOAD_BUFLEN 2048
+
+struct HTTPUpload {
+  HTTPUploadStatus status;
+  String filename;
+  String name;
+  String type;
+  size_t totalSize;
+  size_t currentSize;
+  size_t contentLength;
+  uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
+
+class ESP8266WebServer {
+ public:
+  typedef std::function<void(void)> THandlerFunction;
+
+  explicit ESP8266WebServer(int port = 80);
+
+  void begin() {}
+  void close() {}
+  void handleClient() {}
+
+  void on(const char *uri, HTTPMethod method, THandlerFunction handler);
+  void on(const char *uri, HTTPMethod method, THandlerFunction handler, THandlerFunction upload);
+  void on(const char *uri, THandlerFunction handler) { on(uri, HTTP_ANY, handler); }
+  void onNotFound(THandlerFunction handler) { notFound_ = handler; }
+  void collectHeaders(const char *[], size_t) {}
+
+  bool hasArg(const String &name) const;
+  const String &arg(const String &name) const;
+  bool hasHeader(const String &name) const {
+    return find(requestHeaders_, requestHeaderCount_, name.c_str()) != nullptr;
+  }
+  const String &header(const String &name) const;
+  String uri() const { return String(uri_); }
+  HTTPMethod method() const { return method_; }
+  HTTPUpload &upload() { return upload_; }
+  WiFiClient &client() { return client_; }
+
+  void sendHeader(const String &name, const String &value, bool first = false);
+  void setContentLength(size_t length) { contentLength_ = length; }
+  void send(int code, const char *contentType = nullptr, const String &content = String());
+  void send(int code, const char *contentType, const char *content, size_t length);
+  void send_P(int code, PGM_P contentType, PGM_P content);
+  void send_P(int code, PGM_P contentType, PGM_P content, size_t length);
+  void sendContent(const String &content) { sendContent(content.c_str(), content.length()); }
+  void sendContent(const char *content, size_t length);
+  void sendContent_P(PGM_P content) { sendContent(content, strlen(content)); }
+  void sendContent_P(PGM_P content, size_t length) { sendContent(content, length); }
+
+  // ---- Host side (see host::request()) ----
+  void beginRequest(HTTPMethod method, const char *uri, const WiFiClient &client);
+  bool addArg(const char *name, size_t nameLength, const char *value, size_t valueLength);
+  void setBody(const char *body, size_t length);
+  bool addHeader(const char *name, const char *value);
+  bool dispatch();  // false when no route matched
+  // Multipart file upload to the route's upload handler; the connection
+  // drops after abortAt bytes
+  bool dispatchUpload(const uint8_t *data, size_t length, size_t abortAt);
+
+  int responseCode() const { return code_; }
+  const std::string &responseBody() const { return body_; }
+  const char *responseHeader(const char *name) const;
+
+ private:
+  static constexpr size_t MAX_ARGS = 16;
+  static constexpr size_t MAX_HEADERS = 8;
+  static constexpr size_t FIELD_RESERVE = 64;
+  static constexpr size_t BODY_RESERVE = 64 * 1024;
+
+  struct Field {
+    String name;
+    String value;
+  };
+
+  struct Route {
+    const char *uri;
+    HTTPMethod method;
+    THandlerFunction handler;
+    THandlerFunction upload;
+  };
+
+  static void reserve(Field *fields, size_t count);
+  const Route *findRoute() const;
+  static const Field *find(const Field *fields, size_t count, const char *name);
+  const Field *findArg(const String &name) const;
+  static bool set(Field *fields, size_t &count, size_t capacity, const char *name, size_t nameLength,
+                  const char *value, size_t valueLength);
+  void respond(int code, const char *contentType);
+  void transmit(const char *data, size_t length);
+
+  std::vector<Route> routes_;
+  THandlerFunction notFound_;
+
+  std::string uri_;
+  HTTPMethod method_ = HTTP_GET;
+  Field args_[MAX_ARGS];
+  size_t argCount_ = 0;
+  Field plain_;
+  bool hasPlain_ = false;
+  Field requestHeaders_[MAX_HEADERS];
+  size_t requestHeaderCount_ = 0;
+
+  int code_ = 0;
+  size_t contentLength_ = CONTENT_LENGTH_UNKNOWN;
+  Field responseHeaders_[MAX_HEADERS];
+  size_t responseHeaderCount_ = 0;
+  std::string body_;
+
+  HTTPUpload upload_ = {};
+  WiFiClient client_;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+#include <memory>
+
+// Host stand-in for the WiFi station API. The link state is set from the
+// host side (host::setWifiConnected). Clients share a host::Connection when
+// copied, as the core's share their socket; a default-constructed one is
+// not connected.
+
+enum WiFiMode_t { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA };
+enum wl_status_t {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_DISCONNECTED = 6
+};
+
+namespace host {
+struct Connection;
+}
+
+class WiFiClient : public Stream {
+ public:
+  WiFiClient() = default;
+  explicit WiFiClient(std::shared_ptr<host::Connection> connection) : connection_(std::move(connection)) {}
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *data, size_t size) override;
+  using Print::write;
+
+  IPAddress remoteIP() { return IPAddress(127, 0, 0, 1); }
+  uint8_t connected();
+  void stop();
+  void setNoDelay(bool) {}
+  size_t availableForWrite();
+
+ private:
+  std::shared_ptr<host::Connection> connection_;
+};
+
+class ESP8266WiFiClass {
+ public:
+  bool mode(WiFiMode_t) { return true; }
+  bool persistent(bool) { return true; }
+  bool setAutoReconnect(bool) { return true; }
+  bool config(IPAddress, IPAddress, IPAddress, IPAddress = IPAddress()) { return true; }
+  wl_status_t begin(const char *, const char *, int32_t = 0, const uint8_t * = nullptr, bool = true);
+  bool disconnect(bool = false) { return true; }
+  bool reconnect() { return true; }
+
+  wl_status_t status();
+  bool isConnected() { return status() == WL_CONNECTED; }
+  IPAddress localIP() { return IPAddress(192, 168, 1, 169); }
+  IPAddress gatewayIP() { return IPAddress(192, 168, 1, 1); }
+  IPAddress subnetMask() { return IPAddress(255, 255, 255, 0); }
+  IPAddress dnsIP(uint8_t = 0) { return IPAddress(192, 168, 1, 1); }
+  uint8_t *BSSID() {
+    static uint8_t bssid[6] = {0x02, 0, 0, 0, 0, 1};
+    return bssid;
+  }
+  int32_t channel() { return 6; }
+  int32_t RSSI() { return -60; }
+};
+
+extern ESP8266WiFiClass WiFi;
+
+// SDK RTC timer (see rtc_state.h)
+uint32_t system_get_rtc_time();
+uint32_t system_rtc_clock_cali_proc();
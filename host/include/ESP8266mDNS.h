@@ -0,0 +1,13 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Host stand-in: mDNS is not announced
+class MDNSResponder {
+ public:
+  bool begin(const char *) { return true; }
+  void addService(const char *, const char *, uint16_t) {}
+  void update() {}
+};
+
+extern MDNSResponder MDNS;
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Host stand-in for IPAddress (IPv4 only)
+class IPAddress {
+ public:
+  IPAddress() {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes_{a, b, c, d} {}
+  IPAddress(uint32_t address) { memcpy(bytes_, &address, sizeof(bytes_)); }
+
+  operator uint32_t() const {
+    uint32_t address;
+    memcpy(&address, bytes_, sizeof(address));
+    return address;
+  }
+  uint8_t operator[](int index) const { return bytes_[index]; }
+  bool isSet() const { return static_cast<uint32_t>(*this) != 0; }
+
+  String toString() const {
+    char text[16];
+    snprintf(text, sizeof(text), "%u.%u.%u.%u", bytes_[0], bytes_[1], bytes_[2], bytes_[3]);
+    return String(text);
+  }
+
+ private:
+  uint8_t bytes_[4] = {0, 0, 0, 0};
+};
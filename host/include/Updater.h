@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Host stand-in: accepts and discards firmware images. The MD5 is not
+// computed; an all-zero MD5 fails the check.
+#define UPDATE_ERROR_OK 0
+#define UPDATE_ERROR_WRITE 1
+#define UPDATE_ERROR_ERASE 2
+#define UPDATE_ERROR_READ 3
+#define UPDATE_ERROR_SPACE 4
+#define UPDATE_ERROR_SIZE 5
+#define UPDATE_ERROR_STREAM 6
+#define UPDATE_ERROR_MD5 7
+#define UPDATE_ERROR_FLASH_CONFIG 8
+#define UPDATE_ERROR_NEW_FLASH_CONFIG 9
+#define UPDATE_ERROR_MAGIC_BYTE 10
+#define UPDATE_ERROR_BOOTSTRAP 11
+#define UPDATE_ERROR_SIGN 12
+
+#define U_FLASH 0
+
+class UpdaterClass {
+ public:
+  bool begin(size_t size, int = U_FLASH) {
+    if (running_ || size == 0) return false;
+    size_ = size;
+    progress_ = 0;
+    error_ = UPDATE_ERROR_OK;
+    running_ = true;
+    return true;
+  }
+  size_t write(uint8_t *, size_t length) {
+    if (!running_ || error_ != UPDATE_ERROR_OK) return 0;
+    if (progress_ + length > size_) {
+      error_ = UPDATE_ERROR_SPACE;
+      return 0;
+    }
+    progress_ += length;
+    return length;
+  }
+  // Like the core: an unfinished image is dropped unless evenIfRemaining
+  bool end(bool evenIfRemaining = false) {
+    bool complete = running_ && error_ == UPDATE_ERROR_OK && (progress_ == size_ || evenIfRemaining);
+    if (complete && md5Mismatch_) {
+      error_ = UPDATE_ERROR_MD5;
+      complete = false;
+    }
+    running_ = false;
+    md5Mismatch_ = false;
+    return complete;
+  }
+  bool setMD5(const char *md5) {
+    if (strlen(md5) != 32) return false;
+    md5Mismatch_ = strcmp(md5, "00000000000000000000000000000000") == 0;  // lets tests provoke a failure
+    return true;
+  }
+
+  uint8_t getError() { return error_; }
+  bool hasError() { return error_ != UPDATE_ERROR_OK; }
+  bool isRunning() { return running_; }
+  size_t size() { return size_; }
+  size_t progress() { return progress_; }
+
+ private:
+  size_t size_ = 0;
+  size_t progress_ = 0;
+  uint8_t error_ = UPDATE_ERROR_OK;
+  bool running_ = false;
+  bool md5Mismatch_ = false;
+};
+
+extern UpdaterClass Update;
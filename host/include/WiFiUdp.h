@@ -0,0 +1,23 @@
+#pragma once
+
+#include <ESP8266WiFi.h>
+
+// Host stand-in: packets are dropped and nothing is ever received
+class WiFiUDP : public Stream {
+ public:
+  static void stopAll() {}
+  uint8_t begin(uint16_t) { return 1; }
+  uint8_t beginMulticast(IPAddress, IPAddress, uint16_t) { return 1; }
+  int beginPacket(IPAddress, uint16_t) { return 1; }
+  int beginPacketMulticast(IPAddress, uint16_t, IPAddress, int = 1) { return 1; }
+  int endPacket() { return 1; }
+  size_t write(uint8_t) override { return 1; }
+  size_t write(const uint8_t *, size_t size) override { return size; }
+  using Print::write;
+  int parsePacket() { return 0; }
+  int read(uint8_t *, size_t) { return 0; }
+  int read() override { return -1; }
+  IPAddress remoteIP() { return IPAddress(); }
+  uint16_t remotePort() { return 0; }
+  void stop() {}
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Host stand-in for the core's Wire. Every address holds a mock device with
+// 256 byte registers: the first byte of a transmission selects the register,
+// the following bytes fill it and the next ones (auto-increment, as on the
+// PCA9685), and requestFrom() reads on from the register last selected.
+// See host.h to inspect or change them or to take a device off the bus.
+class TwoWire {
+ public:
+  static constexpr size_t BUFFER_LENGTH = 128;  // as the ESP8266 core
+
+  void begin() {}
+  void begin(int, int) {}
+  void setClock(uint32_t) {}
+  void beginTransmission(uint8_t address);
+  size_t write(uint8_t data);
+  // 0 = sent, 2 = no device at the address
+  uint8_t endTransmission(bool sendStop = true);
+  // Bytes received, 0 when no device answers
+  uint8_t requestFrom(uint8_t address, uint8_t quantity);
+  int available();
+  int read();
+
+ private:
+  uint8_t address_ = 0;
+  uint8_t buffer_[BUFFER_LENGTH];
+  size_t length_ = 0;
+  uint8_t received_[BUFFER_LENGTH];
+  size_t receivedLength_ = 0;
+  size_t receivedAt_ = 0;
+};
+
+extern TwoWire Wire;
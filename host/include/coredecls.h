@@ -0,0 +1,7 @@
+#pragma once
+
+#include <functional>
+
+// Called after every settimeofday(); true when the time came from SNTP
+// (on the host: host::syncTime())
+void settimeofday_cb(const std::function<void(bool)> &callback);
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <memory>
+#include <string>
+
+#include <ESP8266WebServer.h>
+
+// ------------------------------------------------------------
+// Host-side controls for the native build ([env:native] in platformio.ini)
+//
+// The stand-ins in host/include replace the ESP8266 core so src/main.cpp
+// runs on a PC. Time is virtual: micros()/millis() and the wall clock only
+// move when a driver (benchmark, simulator) advances them, or when the
+// firmware calls delay(). millis()/micros() keep their 32-bit wraparound.
+// ------------------------------------------------------------
+
+namespace host {
+
+// Virtual clock
+uint64_t nowMicros();
+void advanceMicros(uint64_t us);
+
+// Wall clock seen by gettimeofday()/time(): epoch at the current virtual time
+void setEpoch(time_t seconds, uint32_t micros = 0);
+// Like setEpoch(), then report an SNTP sync (settimeofday_cb)
+void syncTime(time_t seconds);
+
+void setWifiConnected(bool connected);
+
+// Last value written to a pin with analogWrite(); -1 before the first write
+int pwmValue(uint8_t pin);
+uint32_t pwmWrites();
+// Called on every analogWrite() (trace recording); nullptr to stop
+void onAnalogWrite(void (*listener)(uint8_t pin, int value));
+
+// Mock I2C devices behind Wire: register contents (set one to play a chip
+// that reset itself), completed transmissions and reads, and whether a
+// device answers at the address (all do by default)
+uint8_t i2cRegister(uint8_t address, uint8_t reg);
+void setI2cRegister(uint8_t address, uint8_t reg, uint8_t value);
+uint32_t i2cTransactions();
+void setI2cPresent(uint8_t address, bool present);
+
+// Mock TCP connections behind WiFiClient. Every request gets its own; it
+// takes bytesPerSecond (0: no limit) through a send buffer of
+// CLIENT_SEND_BUFFER bytes, and a write that does not fit waits (advances
+// the virtual clock) until enough has drained, like the core's write().
+constexpr size_t CLIENT_SEND_BUFFER = 1460;
+
+struct Connection {
+  uint32_t bytesPerSecond;
+  bool open;
+  size_t inFlight;      // written, not yet drained
+  uint64_t drainedUs;   // virtual time inFlight was last brought up to date
+  uint64_t bytes;       // written in total
+  uint64_t blockedUs;   // write() waiting for room
+  std::string received; // what was written, when recordClientData() is on
+};
+
+// Rate of the connections opened from now on
+void setClientRate(uint32_t bytesPerSecond);
+// Keep a copy of everything written (off: only counted)
+void recordClientData(bool record);
+// The connection of the last request; close it (open = false) to make the
+// client go away
+std::shared_ptr<Connection> lastConnection();
+WiFiClient openConnection();
+
+// Operator new calls since start (the stand-in String allocates like
+// std::string, so counts are close to, not identical with, the device)
+uint64_t allocations();
+
+// Run a request through the firmware's routes and return the status code.
+// query is "a=1&b=2" (not URL-decoded); body becomes the "plain" argument.
+int request(HTTPMethod method, const char *uri, const char *query = nullptr, const char *body = nullptr,
+            const char *ifNoneMatch = nullptr);
+// POST a multipart file upload (the route's upload handler sees it in
+// HTTP_UPLOAD_BUFLEN pieces); abortAt drops the connection after that many
+// bytes, in which case no response is sent and 0 is returned
+int upload(const char *uri, const char *query, const uint8_t *data, size_t length, size_t abortAt = SIZE_MAX);
+// Last response
+const std::string &responseBody();
+const char *responseHeader(const char *name);
+
+}  // namespace host
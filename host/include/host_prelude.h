@@ -0,0 +1,30 @@
+#pragma once
+
+// Force-included into every native translation unit (see [env:native] in
+// platformio.ini). Routes the firmware's clock calls to the virtual clock
+// in host.h; the system headers are included first so the macros below
+// only affect code that follows. C sources (the Unity test framework)
+// get none of it.
+
+#ifdef __cplusplus
+
+#include <sys/time.h>
+#include <time.h>
+
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <string>
+
+int host_gettimeofday(struct timeval *tv, void *tz);
+int host_settimeofday(const struct timeval *tv, const void *tz);
+time_t host_time(time_t *out);
+
+#define gettimeofday host_gettimeofday
+#define settimeofday host_settimeofday
+#define time(out) host_time(out)
+
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char *server1, const char *server2 = nullptr,
+                const char *server3 = nullptr);
+
+#endif  // __cplusplus
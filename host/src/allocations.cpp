@@ -0,0 +1,63 @@
+// Counts heap allocations for host::allocations() by replacing the global
+// operator new. Only the count is tracked, not sizes or lifetimes.
+
+#include <stdlib.h>
+
+#include <new>
+
+#include "host.h"
+
+namespace {
+
+uint64_t allocationCount = 0;
+
+void *allocate(size_t size) {
+  ++allocationCount;
+  void *block = malloc(size > 0 ? size : 1);
+  if (!block) throw std::bad_alloc();
+  return block;
+}
+
+}  // namespace
+
+namespace host {
+
+uint64_t allocations() {
+  return allocationCount;
+}
+
+}  // namespace host
+
+void *operator new(size_t size) {
+  return allocate(size);
+}
+
+void *operator new[](size_t size) {
+  return allocate(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  ++allocationCount;
+  return malloc(size > 0 ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  ++allocationCount;
+  return malloc(size > 0 ? size : 1);
+}
+
+void operator delete(void *block) noexcept {
+  free(block);
+}
+
+void operator delete[](void *block) noexcept {
+  free(block);
+}
+
+void operator delete(void *block, size_t) noexcept {
+  free(block);
+}
+
+void operator delete[](void *block, size_t) noexcept {
+  free(block);
+}
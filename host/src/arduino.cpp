@@ -0,0 +1,279 @@
+// Host stand-ins for the ESP8266 core: virtual clock, PWM, flash, RTC
+// memory and the SDK time hooks (see host.h)
+
+#include <Arduino.h>
+#include <ArduinoOTA.h>
+#include <ESP8266WiFi.h>
+#include <ESP8266mDNS.h>
+#include <Updater.h>
+#include <coredecls.h>
+
+#include <stdlib.h>
+
+#include "host.h"
+
+HardwareSerial Serial;
+const String emptyString;
+EspClass ESP;
+ESP8266WiFiClass WiFi;
+MDNSResponder MDNS;
+ArduinoOTAClass ArduinoOTA;
+UpdaterClass Update;
+
+namespace {
+
+constexpr uint8_t MAX_PINS = 17;
+constexpr size_t FLASH_SIZE = 64 * 1024;
+constexpr size_t FLASH_SECTOR_SIZE = 4096;
+constexpr size_t RTC_USER_MEMORY_SIZE = 512;
+constexpr uint32_t RTC_PERIOD_US = 6;  // reported with 12 fraction bits, like the SDK
+
+uint64_t clockUs = 0;
+int64_t epochOffsetUs = 0;  // wall clock minus the virtual clock
+bool epochSet = false;
+std::function<void(bool)> timeSetCallback;
+
+bool wifiConnected = true;
+
+int pwmValues[MAX_PINS];
+uint32_t pwmWriteCount = 0;
+void (*pwmListener)(uint8_t, int) = nullptr;
+
+uint32_t rtcMemory[RTC_USER_MEMORY_SIZE / 4];
+
+uint8_t *flashMemory() {
+  static uint8_t *memory = [] {
+    static uint8_t erased[FLASH_SIZE];
+    memset(erased, 0xFF, sizeof(erased));
+    return erased;
+  }();
+  return memory;
+}
+
+bool flashRange(uint32_t address, size_t size) {
+  return address <= FLASH_SIZE && size <= FLASH_SIZE - address;
+}
+
+struct PwmReset {
+  PwmReset() {
+    for (int &value : pwmValues) value = -1;
+  }
+} pwmReset;
+
+}  // namespace
+
+// ------------------------------------------------------------
+// Host controls
+// ------------------------------------------------------------
+namespace host {
+
+uint64_t nowMicros() {
+  return clockUs;
+}
+
+void advanceMicros(uint64_t us) {
+  clockUs += us;
+}
+
+void setEpoch(time_t seconds, uint32_t micros) {
+  epochOffsetUs = static_cast<int64_t>(seconds) * 1000000 + micros - static_cast<int64_t>(clockUs);
+  epochSet = true;
+}
+
+void syncTime(time_t seconds) {
+  setEpoch(seconds);
+  if (timeSetCallback) timeSetCallback(true);
+}
+
+void setWifiConnected(bool connected) {
+  wifiConnected = connected;
+}
+
+int pwmValue(uint8_t pin) {
+  return pin < MAX_PINS ? pwmValues[pin] : -1;
+}
+
+uint32_t pwmWrites() {
+  return pwmWriteCount;
+}
+
+void onAnalogWrite(void (*listener)(uint8_t pin, int value)) {
+  pwmListener = listener;
+}
+
+}  // namespace host
+
+// ------------------------------------------------------------
+// Time (host_prelude.h routes gettimeofday/settimeofday/time here)
+// ------------------------------------------------------------
+int host_gettimeofday(struct timeval *tv, void *) {
+  int64_t us = epochSet ? static_cast<int64_t>(clockUs) + epochOffsetUs : static_cast<int64_t>(clockUs);
+  tv->tv_sec = static_cast<time_t>(us / 1000000);
+  tv->tv_usec = static_cast<suseconds_t>(us % 1000000);
+  return 0;
+}
+
+int host_settimeofday(const struct timeval *tv, const void *) {
+  if (tv) {
+    host::setEpoch(tv->tv_sec, tv->tv_usec);
+    if (timeSetCallback) timeSetCallback(false);
+  }
+  return 0;
+}
+
+time_t host_time(time_t *out) {
+  struct timeval tv;
+  host_gettimeofday(&tv, nullptr);
+  if (out) *out = tv.tv_sec;
+  return tv.tv_sec;
+}
+
+// Like the core, the offsets become a POSIX TZ string. SNTP is not
+// emulated; the host reports syncs with host::syncTime().
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char *, const char *, const char *) {
+  long offset = -(gmtOffsetSec + daylightOffsetSec);  // POSIX counts west of UTC as positive
+  char tz[32];
+  snprintf(tz, sizeof(tz), "UTC%c%ld:%02ld:%02ld", offset < 0 ? '-' : '+', labs(offset) / 3600,
+           labs(offset) / 60 % 60, labs(offset) % 60);
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+void settimeofday_cb(const std::function<void(bool)> &callback) {
+  timeSetCallback = callback;
+}
+
+uint32_t system_get_rtc_time() {
+  return static_cast<uint32_t>(clockUs / RTC_PERIOD_US);
+}
+
+uint32_t system_rtc_clock_cali_proc() {
+  return RTC_PERIOD_US << 12;
+}
+
+// ------------------------------------------------------------
+// Core
+// ------------------------------------------------------------
+// Truncated to 32 bits like on the ESP8266, so rollovers happen on schedule
+unsigned long millis() {
+  return static_cast<uint32_t>(clockUs / 1000);
+}
+
+unsigned long micros() {
+  return static_cast<uint32_t>(clockUs);
+}
+
+uint64_t micros64() {
+  return clockUs;
+}
+
+void delay(unsigned long ms) {
+  clockUs += static_cast<uint64_t>(ms) * 1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+  clockUs += us;
+}
+
+void yield() {}
+
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t, uint8_t) {}
+
+void analogWrite(uint8_t pin, int value) {
+  if (pin < MAX_PINS) pwmValues[pin] = value;
+  ++pwmWriteCount;
+  if (pwmListener) pwmListener(pin, value);
+}
+
+void analogWriteRange(uint32_t) {}
+
+void analogWriteFreq(uint32_t) {}
+
+// ------------------------------------------------------------
+// ESP
+// ------------------------------------------------------------
+void EspClass::restart() {
+  fprintf(stderr, "ESP.restart() requested\n");
+}
+
+String EspClass::getResetReason() {
+  return String("External System");
+}
+
+uint32_t EspClass::getChipId() {
+  return 0x00C0FFEE;
+}
+
+uint32_t EspClass::getCycleCount() {
+  return static_cast<uint32_t>(clockUs * 80);
+}
+
+uint32_t EspClass::random() {
+  static uint32_t state = 0x2545F491;  // xorshift32
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+uint32_t EspClass::getFreeSketchSpace() {
+  return 440 * 1024;
+}
+
+uint32_t EspClass::getFreeHeap() {
+  return 40 * 1024;
+}
+
+uint32_t EspClass::getMaxFreeBlockSize() {
+  return 32 * 1024;
+}
+
+uint8_t EspClass::getHeapFragmentation() {
+  return 5;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
+  if (offset * 4 + size > sizeof(rtcMemory)) return false;
+  memcpy(data, &rtcMemory[offset], size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size) {
+  if (offset * 4 + size > sizeof(rtcMemory)) return false;
+  memcpy(&rtcMemory[offset], data, size);
+  return true;
+}
+
+bool EspClass::flashEraseSector(uint32_t sector) {
+  if (!flashRange(sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE)) return false;
+  memset(flashMemory() + sector * FLASH_SECTOR_SIZE, 0xFF, FLASH_SECTOR_SIZE);
+  return true;
+}
+
+// Programming can only clear bits, as on NOR flash
+bool EspClass::flashWrite(uint32_t address, const uint32_t *data, size_t size) {
+  if (!flashRange(address, size)) return false;
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+  uint8_t *memory = flashMemory() + address;
+  for (size_t i = 0; i < size; ++i) memory[i] &= bytes[i];
+  return true;
+}
+
+bool EspClass::flashRead(uint32_t address, uint32_t *data, size_t size) {
+  if (!flashRange(address, size)) return false;
+  memcpy(data, flashMemory() + address, size);
+  return true;
+}
+
+// ------------------------------------------------------------
+// WiFi
+// ------------------------------------------------------------
+wl_status_t ESP8266WiFiClass::begin(const char *, const char *, int32_t, const uint8_t *, bool) {
+  return status();
+}
+
+wl_status_t ESP8266WiFiClass::status() {
+  return wifiConnected ? WL_CONNECTED : WL_DISCONNECTED;
+}
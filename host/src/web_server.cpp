@@ -0,0 +1,254 @@
+// Host stand-in for ESP8266WebServer and the request injection in host.h
+
+#include <ESP8266WebServer.h>
+
+#include <strings.h>
+
+#include "host.h"
+
+// The firmware's server (src/main.cpp)
+extern ESP8266WebServer server;
+
+ESP8266WebServer::ESP8266WebServer(int) {
+  reserve(args_, MAX_ARGS);
+  reserve(requestHeaders_, MAX_HEADERS);
+  reserve(responseHeaders_, MAX_HEADERS);
+  plain_.name = "plain";
+  plain_.value.reserve(BODY_RESERVE);
+  uri_.reserve(FIELD_RESERVE);
+  body_.reserve(BODY_RESERVE);
+}
+
+void ESP8266WebServer::on(const char *uri, HTTPMethod method, THandlerFunction handler) {
+  on(uri, method, handler, nullptr);
+}
+
+void ESP8266WebServer::on(const char *uri, HTTPMethod method, THandlerFunction handler, THandlerFunction upload) {
+  routes_.push_back({uri, method, handler, upload});
+}
+
+bool ESP8266WebServer::hasArg(const String &name) const {
+  return findArg(name) != nullptr;
+}
+
+const String &ESP8266WebServer::arg(const String &name) const {
+  const Field *field = findArg(name);
+  return field ? field->value : emptyString;
+}
+
+const String &ESP8266WebServer::header(const String &name) const {
+  const Field *field = find(requestHeaders_, requestHeaderCount_, name.c_str());
+  return field ? field->value : emptyString;
+}
+
+void ESP8266WebServer::sendHeader(const String &name, const String &value, bool) {
+  set(responseHeaders_, responseHeaderCount_, MAX_HEADERS, name.c_str(), name.length(), value.c_str(),
+      value.length());
+}
+
+void ESP8266WebServer::send(int code, const char *contentType, const String &content) {
+  send(code, contentType, content.c_str(), content.length());
+}
+
+void ESP8266WebServer::send(int code, const char *contentType, const char *content, size_t length) {
+  respond(code, contentType);
+  char line[64];
+  int lineLength = snprintf(line, sizeof(line), "HTTP/1.1 %d\r\nContent-Length: %zu\r\n", code, length);
+  transmit(line, lineLength);
+  for (size_t i = 0; i < responseHeaderCount_; ++i) {
+    transmit(responseHeaders_[i].name.c_str(), responseHeaders_[i].name.length());
+    transmit(": ", 2);
+    transmit(responseHeaders_[i].value.c_str(), responseHeaders_[i].value.length());
+    transmit("\r\n", 2);
+  }
+  transmit("\r\n", 2);
+  transmit(content, length);
+  body_.append(content, length);
+}
+
+void ESP8266WebServer::sendContent(const char *content, size_t length) {
+  transmit(content, length);
+  body_.append(content, length);
+}
+
+void ESP8266WebServer::send_P(int code, PGM_P contentType, PGM_P content) {
+  send(code, contentType, content, strlen(content));
+}
+
+void ESP8266WebServer::send_P(int code, PGM_P contentType, PGM_P content, size_t length) {
+  send(code, contentType, content, length);
+}
+
+void ESP8266WebServer::beginRequest(HTTPMethod method, const char *uri, const WiFiClient &client) {
+  client_ = client;
+  method_ = method;
+  uri_ = uri;
+  argCount_ = 0;
+  hasPlain_ = false;
+  requestHeaderCount_ = 0;
+  code_ = 0;
+  contentLength_ = CONTENT_LENGTH_UNKNOWN;
+  responseHeaderCount_ = 0;
+  body_.clear();
+}
+
+bool ESP8266WebServer::addArg(const char *name, size_t nameLength, const char *value, size_t valueLength) {
+  return set(args_, argCount_, MAX_ARGS, name, nameLength, value, valueLength);
+}
+
+void ESP8266WebServer::setBody(const char *body, size_t length) {
+  plain_.value.str().assign(body, length);
+  hasPlain_ = true;
+}
+
+bool ESP8266WebServer::addHeader(const char *name, const char *value) {
+  return set(requestHeaders_, requestHeaderCount_, MAX_HEADERS, name, strlen(name), value, strlen(value));
+}
+
+bool ESP8266WebServer::dispatch() {
+  const Route *route = findRoute();
+  if (route) {
+    route->handler();
+  } else if (notFound_) {
+    notFound_();
+  }
+  return route != nullptr;
+}
+
+bool ESP8266WebServer::dispatchUpload(const uint8_t *data, size_t length, size_t abortAt) {
+  const Route *route = findRoute();
+  if (!route || !route->upload) return dispatch();
+
+  upload_.status = UPLOAD_FILE_START;
+  upload_.filename = "firmware.bin";
+  upload_.name = "update";
+  upload_.totalSize = 0;
+  upload_.currentSize = 0;
+  route->upload();
+
+  size_t end = min(length, abortAt);
+  for (size_t offset = 0; offset < end; offset += upload_.currentSize) {
+    upload_.status = UPLOAD_FILE_WRITE;
+    upload_.currentSize = min(end - offset, sizeof(upload_.buf));
+    memcpy(upload_.buf, data + offset, upload_.currentSize);
+    upload_.totalSize += upload_.currentSize;
+    route->upload();
+  }
+
+  upload_.currentSize = 0;
+  if (abortAt < length) {
+    upload_.status = UPLOAD_FILE_ABORTED;
+    route->upload();
+    return true;  // no response, the client is gone
+  }
+  upload_.status = UPLOAD_FILE_END;
+  route->upload();
+  route->handler();
+  return true;
+}
+
+const ESP8266WebServer::Route *ESP8266WebServer::findRoute() const {
+  for (const Route &route : routes_) {
+    if (uri_ == route.uri && (route.method == HTTP_ANY || route.method == method_)) return &route;
+  }
+  return nullptr;
+}
+
+const char *ESP8266WebServer::responseHeader(const char *name) const {
+  const Field *field = find(responseHeaders_, responseHeaderCount_, name);
+  return field ? field->value.c_str() : nullptr;
+}
+
+void ESP8266WebServer::reserve(Field *fields, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    fields[i].name.reserve(FIELD_RESERVE);
+    fields[i].value.reserve(FIELD_RESERVE);
+  }
+}
+
+// The body is the "plain" argument, as in the real server
+const ESP8266WebServer::Field *ESP8266WebServer::findArg(const String &name) const {
+  if (hasPlain_ && strcmp(name.c_str(), "plain") == 0) return &plain_;
+  return find(args_, argCount_, name.c_str());
+}
+
+const ESP8266WebServer::Field *ESP8266WebServer::find(const Field *fields, size_t count, const char *name) {
+  for (size_t i = 0; i < count; ++i) {
+    if (strcasecmp(fields[i].name.c_str(), name) == 0) return &fields[i];
+  }
+  return nullptr;
+}
+
+// Replaces an existing field of the same name
+bool ESP8266WebServer::set(Field *fields, size_t &count, size_t capacity, const char *name, size_t nameLength,
+                           const char *value, size_t valueLength) {
+  size_t index = 0;
+  while (index < count && fields[index].name.str().compare(0, std::string::npos, name, nameLength) != 0) ++index;
+  if (index == count) {
+    if (count >= capacity) return false;
+    ++count;
+  }
+  fields[index].name.str().assign(name, nameLength);
+  fields[index].value.str().assign(value, valueLength);
+  return true;
+}
+
+// Through the client, which blocks while a slow connection's buffer is full
+void ESP8266WebServer::transmit(const char *data, size_t length) {
+  client_.write(reinterpret_cast<const uint8_t *>(data), length);
+}
+
+void ESP8266WebServer::respond(int code, const char *contentType) {
+  code_ = code;
+  if (contentType) {
+    set(responseHeaders_, responseHeaderCount_, MAX_HEADERS, "Content-Type", 12, contentType, strlen(contentType));
+  }
+}
+
+// ------------------------------------------------------------
+// Request injection
+// ------------------------------------------------------------
+namespace host {
+
+namespace {
+
+void beginRequest(HTTPMethod method, const char *uri, const char *query, const char *ifNoneMatch) {
+  server.beginRequest(method, uri, openConnection());
+  for (const char *p = query; p && *p;) {
+    const char *end = strchr(p, '&');
+    if (!end) end = p + strlen(p);
+    const char *equals = static_cast<const char *>(memchr(p, '=', end - p));
+    if (equals) {
+      server.addArg(p, equals - p, equals + 1, end - equals - 1);
+    } else {
+      server.addArg(p, end - p, "", 0);
+    }
+    p = *end ? end + 1 : end;
+  }
+  if (ifNoneMatch) server.addHeader("If-None-Match", ifNoneMatch);
+}
+
+}  // namespace
+
+int request(HTTPMethod method, const char *uri, const char *query, const char *body, const char *ifNoneMatch) {
+  beginRequest(method, uri, query, ifNoneMatch);
+  if (body) server.setBody(body, strlen(body));
+  server.dispatch();
+  return server.responseCode();
+}
+
+int upload(const char *uri, const char *query, const uint8_t *data, size_t length, size_t abortAt) {
+  beginRequest(HTTP_POST, uri, query, nullptr);
+  server.dispatchUpload(data, length, abortAt);
+  return server.responseCode();
+}
+
+const std::string &responseBody() {
+  return server.responseBody();
+}
+
+const char *responseHeader(const char *name) {
+  return server.responseHeader(name);
+}
+
+}  // namespace host
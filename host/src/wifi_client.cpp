@@ -0,0 +1,100 @@
+// Host stand-in for WiFiClient: connections with a send buffer and a rate
+
+#include <ESP8266WiFi.h>
+
+#include "host.h"
+
+namespace host {
+
+namespace {
+
+uint32_t nextRate = 0;
+bool recording = false;
+std::shared_ptr<Connection> current;
+
+// Bring inFlight up to the virtual clock
+void drain(Connection &connection) {
+  uint64_t now = nowMicros();
+  if (connection.bytesPerSecond == 0 || connection.inFlight == 0) {
+    connection.inFlight = 0;
+    connection.drainedUs = now;
+    return;
+  }
+  uint64_t drained = (now - connection.drainedUs) * connection.bytesPerSecond / 1000000;
+  if (drained >= connection.inFlight) {
+    connection.inFlight = 0;
+    connection.drainedUs = now;
+  } else {
+    connection.inFlight -= drained;
+    connection.drainedUs += drained * 1000000 / connection.bytesPerSecond;  // keep the remainder
+  }
+}
+
+}  // namespace
+
+void setClientRate(uint32_t bytesPerSecond) {
+  nextRate = bytesPerSecond;
+}
+
+void recordClientData(bool record) {
+  recording = record;
+}
+
+std::shared_ptr<Connection> lastConnection() {
+  return current;
+}
+
+// Reuses the last connection when only the server's client still holds
+// it, so a request costs no allocation here (see bench/)
+WiFiClient openConnection() {
+  if (!current || current.use_count() > 2) current = std::make_shared<Connection>();
+  Connection &connection = *current;
+  connection.bytesPerSecond = nextRate;
+  connection.open = true;
+  connection.inFlight = 0;
+  connection.drainedUs = nowMicros();
+  connection.bytes = 0;
+  connection.blockedUs = 0;
+  connection.received.clear();
+  return WiFiClient(current);
+}
+
+}  // namespace host
+
+size_t WiFiClient::write(const uint8_t *data, size_t size) {
+  if (!connection_ || !connection_->open) return 0;
+  host::Connection &connection = *connection_;
+  if (host::recording) connection.received.append(reinterpret_cast<const char *>(data), size);
+  connection.bytes += size;
+  if (connection.bytesPerSecond == 0) return size;
+
+  size_t left = size;
+  for (;;) {
+    host::drain(connection);
+    size_t room = host::CLIENT_SEND_BUFFER - connection.inFlight;
+    size_t take = left < room ? left : room;
+    connection.inFlight += take;
+    left -= take;
+    if (left == 0) return size;
+    // Wait for the next piece to fit
+    size_t need = (left < host::CLIENT_SEND_BUFFER ? left : host::CLIENT_SEND_BUFFER) -
+                  (host::CLIENT_SEND_BUFFER - connection.inFlight);
+    uint64_t waitUs = (static_cast<uint64_t>(need) * 1000000 + connection.bytesPerSecond - 1) / connection.bytesPerSecond;
+    host::advanceMicros(waitUs);
+    connection.blockedUs += waitUs;
+  }
+}
+
+uint8_t WiFiClient::connected() {
+  return connection_ && connection_->open;
+}
+
+void WiFiClient::stop() {
+  if (connection_) connection_->open = false;
+}
+
+size_t WiFiClient::availableForWrite() {
+  if (!connection_ || !connection_->open) return 0;
+  host::drain(*connection_);
+  return host::CLIENT_SEND_BUFFER - connection_->inFlight;
+}
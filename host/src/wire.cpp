@@ -0,0 +1,78 @@
+// Host stand-in for Wire: a bus of mock register devices (see Wire.h)
+
+#include <Wire.h>
+
+#include "host.h"
+
+TwoWire Wire;
+
+namespace {
+
+constexpr uint8_t ADDRESSES = 128;
+
+uint8_t registers[ADDRESSES][256];
+uint8_t selected[ADDRESSES];  // register the next read starts at
+bool absent[ADDRESSES];
+uint32_t transactionCount = 0;
+
+}  // namespace
+
+void TwoWire::beginTransmission(uint8_t address) {
+  address_ = address;
+  length_ = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+  if (length_ >= BUFFER_LENGTH) return 0;
+  buffer_[length_++] = data;
+  return 1;
+}
+
+uint8_t TwoWire::endTransmission(bool) {
+  if (address_ >= ADDRESSES || absent[address_]) return 2;
+  ++transactionCount;
+  if (length_ > 0) {
+    uint8_t reg = buffer_[0];
+    for (size_t i = 1; i < length_; ++i) registers[address_][reg++] = buffer_[i];
+    selected[address_] = reg;
+  }
+  return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity) {
+  receivedLength_ = 0;
+  receivedAt_ = 0;
+  if (address >= ADDRESSES || absent[address]) return 0;
+  ++transactionCount;
+  if (quantity > BUFFER_LENGTH) quantity = BUFFER_LENGTH;
+  for (uint8_t i = 0; i < quantity; ++i) received_[receivedLength_++] = registers[address][selected[address]++];
+  return quantity;
+}
+
+int TwoWire::available() {
+  return static_cast<int>(receivedLength_ - receivedAt_);
+}
+
+int TwoWire::read() {
+  return receivedAt_ < receivedLength_ ? received_[receivedAt_++] : -1;
+}
+
+namespace host {
+
+uint8_t i2cRegister(uint8_t address, uint8_t reg) {
+  return address < ADDRESSES ? registers[address][reg] : 0;
+}
+
+uint32_t i2cTransactions() {
+  return transactionCount;
+}
+
+void setI2cRegister(uint8_t address, uint8_t reg, uint8_t value) {
+  if (address < ADDRESSES) registers[address][reg] = value;
+}
+
+void setI2cPresent(uint8_t address, bool present) {
+  if (address < ADDRESSES) absent[address] = !present;
+}
+
+}  // namespace host
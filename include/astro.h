@@ -0,0 +1,164 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "daylight_curve.h"
+
+// ------------------------------------------------------------
+// Astronomical daylight schedule
+//
+// Sunrise and sunset follow the sunrise equation (solar transit, declination
+// and hour angle for the -0.833 degree apparent horizon; good to a minute or
+// two away from the poles), the moon phase the mean synodic month from a
+// known new moon. Both are computed once per day into an ordinary point list
+// which the fade engine then evaluates like an uploaded schedule, so the
+// double-precision math never runs per tick.
+//
+// The day's shape is fixed, only its times move with the sun:
+//
+//   sunset + twilight .. sunrise - twilight   moonlight (scaled by phase)
+//   sunrise - twilight                        moonlight
+//   sunrise                                   sunrise level
+//   sunrise + ramp                            morning level
+//   solar noon                                noon level
+//   sunset - ramp                             afternoon level
+//   sunset                                    sunset level
+//   sunset + twilight                         moonlight
+//
+// Ramps shrink on short days so the points stay in order. Without a sunrise
+// (polar night) the day is moonlight only; without a sunset the noon level
+// is kept all day.
+// ------------------------------------------------------------
+
+constexpr size_t ASTRO_MAX_POINTS = 7;
+constexpr uint16_t ASTRO_TWILIGHT_MINUTES = 30;
+constexpr uint16_t ASTRO_RAMP_MINUTES = 90;
+
+// Levels per phase of the day (SCHEDULE_LEVEL_MAX = 100 %)
+struct AstroLevels {
+  uint16_t sunrise[3];
+  uint16_t morning[3];
+  uint16_t noon[3];
+  uint16_t afternoon[3];
+  uint16_t sunset[3];
+  uint16_t fullMoon[3];  // scaled by the illuminated fraction
+};
+
+// One day's sun and moon, in local minutes since midnight
+struct AstroDay {
+  int16_t sunrise;       // -1: polar night (sunset is -1 too)
+  int16_t sunset;        // -1 after a sunrise: midnight sun (sunrise is then noon)
+  int16_t noon;          // solar transit
+  uint16_t moonPermille; // illuminated fraction of the moon, 0 - 1000
+};
+
+constexpr double ASTRO_J2000 = 2451545.0;           // Julian date of 2000-01-01 12:00 UTC
+constexpr double ASTRO_UNIX_EPOCH_JD = 2440587.5;   // Julian date of 1970-01-01 00:00 UTC
+constexpr double ASTRO_SYNODIC_MONTH = 29.530588853;
+constexpr double ASTRO_NEW_MOON_JD = 2451550.1;     // 2000-01-06 14:24 UTC
+
+inline double astroRadians(double degrees) { return degrees * (M_PI / 180.0); }
+inline double astroDegrees(double radians) { return radians * (180.0 / M_PI); }
+
+// Local minute of day for a Julian date, given the UTC offset in minutes
+inline int16_t astroLocalMinute(double julian, int32_t utcOffsetMinutes) {
+  double minutes = (julian - ASTRO_UNIX_EPOCH_JD) * MINUTES_PER_DAY + utcOffsetMinutes;
+  int32_t minute = static_cast<int32_t>(floor(minutes + 0.5)) % MINUTES_PER_DAY;
+  return static_cast<int16_t>(minute < 0 ? minute + MINUTES_PER_DAY : minute);
+}
+
+// Sun and moon for the day containing unixNoon (local noon, in seconds);
+// latitude/longitude in degrees, east and north positive
+inline AstroDay computeAstroDay(int64_t unixNoon, double latitude, double longitude, int32_t utcOffsetMinutes) {
+  double julian = ASTRO_UNIX_EPOCH_JD + unixNoon / 86400.0;
+  double n = floor(julian - ASTRO_J2000 + 0.0008 + 0.5);
+  double meanSolarTime = n - longitude / 360.0;
+
+  double anomaly = fmod(357.5291 + 0.98560028 * meanSolarTime, 360.0);
+  double m = astroRadians(anomaly);
+  double center = 1.9148 * sin(m) + 0.0200 * sin(2 * m) + 0.0003 * sin(3 * m);
+  double eclipticLongitude = astroRadians(fmod(anomaly + center + 180.0 + 102.9372, 360.0));
+  double transit = ASTRO_J2000 + meanSolarTime + 0.0053 * sin(m) - 0.0069 * sin(2 * eclipticLongitude);
+
+  double sinDeclination = sin(eclipticLongitude) * sin(astroRadians(23.4397));
+  double cosDeclination = cos(asin(sinDeclination));
+  double phi = astroRadians(latitude);
+  double cosHourAngle = (sin(astroRadians(-0.833)) - sin(phi) * sinDeclination) / (cos(phi) * cosDeclination);
+
+  AstroDay day;
+  day.noon = astroLocalMinute(transit, utcOffsetMinutes);
+  if (cosHourAngle > 1.0) {
+    day.sunrise = day.sunset = -1;
+  } else if (cosHourAngle < -1.0) {
+    day.sunrise = day.noon;
+    day.sunset = -1;
+  } else {
+    double halfDay = astroDegrees(acos(cosHourAngle)) / 360.0;
+    day.sunrise = astroLocalMinute(transit - halfDay, utcOffsetMinutes);
+    day.sunset = astroLocalMinute(transit + halfDay, utcOffsetMinutes);
+  }
+
+  double age = fmod(julian - ASTRO_NEW_MOON_JD, ASTRO_SYNODIC_MONTH) / ASTRO_SYNODIC_MONTH;
+  if (age < 0) age += 1.0;
+  day.moonPermille = static_cast<uint16_t>((1.0 - cos(2 * M_PI * age)) / 2 * 1000 + 0.5);
+  return day;
+}
+
+inline void setAstroPoint(SchedulePoint &point, int32_t minute, const uint16_t (&level)[3], uint16_t permille = 1000) {
+  minute %= MINUTES_PER_DAY;
+  point.minutes = static_cast<uint16_t>(minute < 0 ? minute + MINUTES_PER_DAY : minute);
+  for (uint8_t c = 0; c < 3; ++c) {
+    point.level[c] = static_cast<uint16_t>(static_cast<uint32_t>(level[c]) * permille / 1000);
+  }
+}
+
+// Turn one day into at most ASTRO_MAX_POINTS schedule points (valid for
+// schedulePointsValid()); returns the count
+inline size_t buildAstroSchedule(const AstroDay &day, const AstroLevels &levels, SchedulePoint *out) {
+  if (day.sunrise < 0) {
+    setAstroPoint(out[0], 0, levels.fullMoon, day.moonPermille);
+    return 1;
+  }
+  if (day.sunset < 0) {
+    setAstroPoint(out[0], 0, levels.noon);
+    return 1;
+  }
+
+  // Times relative to sunrise, so a day that crosses local midnight (far
+  // from the time zone's meridian) still counts upwards
+  int32_t rise = day.sunrise;
+  int32_t noon = day.noon < rise ? day.noon + MINUTES_PER_DAY : day.noon;
+  int32_t set = day.sunset < rise ? day.sunset + MINUTES_PER_DAY : day.sunset;
+  if (noon > set) noon = (rise + set) / 2;
+  int32_t ramp = ASTRO_RAMP_MINUTES;
+  if (ramp > (noon - rise) / 2) ramp = (noon - rise) / 2;
+  if (ramp > (set - noon) / 2) ramp = (set - noon) / 2;
+  int32_t twilight = ASTRO_TWILIGHT_MINUTES;
+  int32_t night = MINUTES_PER_DAY - (set - rise);
+  if (twilight > night / 3) twilight = night / 3;
+
+  SchedulePoint points[ASTRO_MAX_POINTS];
+  setAstroPoint(points[0], rise - twilight, levels.fullMoon, day.moonPermille);
+  setAstroPoint(points[1], rise, levels.sunrise);
+  setAstroPoint(points[2], rise + ramp, levels.morning);
+  setAstroPoint(points[3], noon, levels.noon);
+  setAstroPoint(points[4], set - ramp, levels.afternoon);
+  setAstroPoint(points[5], set, levels.sunset);
+  setAstroPoint(points[6], set + twilight, levels.fullMoon, day.moonPermille);
+
+  // Rotate so the list starts after midnight, dropping points that
+  // collapsed onto their predecessor (ramps of zero on the shortest days)
+  size_t first = 0;
+  for (size_t i = 1; i < ASTRO_MAX_POINTS; ++i) {
+    if (points[i].minutes < points[first].minutes) first = i;
+  }
+  size_t count = 0;
+  for (size_t i = 0; i < ASTRO_MAX_POINTS; ++i) {
+    const SchedulePoint &point = points[(first + i) % ASTRO_MAX_POINTS];
+    if (count > 0 && point.minutes <= out[count - 1].minutes) continue;
+    out[count++] = point;
+  }
+  return count;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ------------------------------------------------------------
+// Command log
+//
+// The last Capacity state changes (a request, or an internal event such as
+// a test pulse ending), each with a sequence number, its millis() time, the
+// client's IPv4 address (0 for internal events) and the raw outputs it led
+// to. Entries live in a fixed ring and the command is a flash string, so
+// recording costs no heap and never fails: the oldest entry is overwritten.
+//
+// Sequence numbers start at 1 and only grow, so a reader keeps the newest
+// one it has seen as a cursor and asks for what follows; entries that were
+// overwritten in between are reported as missed rather than silently
+// skipped.
+// ------------------------------------------------------------
+
+template <uint8_t Capacity, uint8_t Channels>
+class CommandLog {
+ public:
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+  struct Entry {
+    uint32_t sequence;
+    uint32_t ms;
+    uint32_t ip;
+    const __FlashStringHelper *command;
+    uint16_t raw[Channels];
+  };
+
+  // A new entry, stamped; the caller fills raw
+  Entry &append(const __FlashStringHelper *command, uint32_t ms, uint32_t ip) {
+    Entry &entry = entries_[next_ & (Capacity - 1)];
+    entry.sequence = next_++;
+    entry.ms = ms;
+    entry.ip = ip;
+    entry.command = command;
+    return entry;
+  }
+
+  // Sequence numbers still stored; newest() is 0 before the first entry
+  uint32_t newest() const { return next_ - 1; }
+  uint32_t oldest() const { return next_ > Capacity ? next_ - Capacity : 1; }
+
+  // Overwritten entries between cursor (the newest one a reader has) and
+  // the oldest one still stored
+  uint32_t missedAfter(uint32_t cursor) const {
+    return oldest() > cursor + 1 && cursor < newest() ? oldest() - cursor - 1 : 0;
+  }
+
+  // The first sequence number to read after cursor
+  uint32_t firstAfter(uint32_t cursor) const { return cursor + 1 > oldest() ? cursor + 1 : oldest(); }
+
+  // Only valid for oldest() <= sequence <= newest()
+  const Entry &at(uint32_t sequence) const { return entries_[sequence & (Capacity - 1)]; }
+
+ private:
+  Entry entries_[Capacity] = {};
+  uint32_t next_ = 1;
+};
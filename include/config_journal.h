@@ -0,0 +1,226 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc32.h"
+
+// ------------------------------------------------------------
+// Persistent settings journal
+//
+// Settings are appended as fixed-size, CRC-protected records to raw flash,
+// alternating between two sectors. Loading scans both for the newest valid
+// record (two sectors at most, so boot time is bounded); appending writes
+// into the next erased slot of the sector holding it. A full sector is never
+// erased while it holds the newest record: the next one starts the other
+// sector, and the full one is only erased once that record reads back
+// intact, so a 4 KB sector takes about eighty saves per erase cycle and
+// losing power at any point leaves the last good settings in place.
+//
+// Flash is any type with static read/write/erase(sectorAddress) working on
+// 4-byte aligned addresses and sizes (ESP.flashRead & co. on the device).
+// ------------------------------------------------------------
+
+constexpr uint16_t CONFIG_RECORD_MAGIC = 0xC0F2;
+constexpr uint32_t CONFIG_SECTOR_SIZE = 4096;
+constexpr uint8_t CONFIG_MAX_CHANNELS = 16;
+
+struct ConfigRecord {
+  uint16_t magic;
+  uint8_t autoMode;
+  uint8_t ditherEnabled;
+  uint32_t sequence;       // increases with every append
+  uint8_t curves[3];       // PerceptualCurve per color
+  uint8_t weather;         // WeatherMode
+  uint16_t manual[3];      // manual level per color, 0 - 1000
+  uint8_t weatherCover;    // percent
+  uint8_t astroMode;       // 1 = schedule follows sun & moon
+  int32_t latitude;        // 1/10000 degree, north positive
+  int32_t longitude;       // 1/10000 degree, east positive
+  uint32_t weatherSeed;
+  uint8_t mapping[CONFIG_MAX_CHANNELS];  // ChannelColor per output channel
+  uint32_t crc;            // over everything before this field
+};
+
+static_assert(sizeof(ConfigRecord) == 52, "ConfigRecord layout changed");
+static_assert(sizeof(ConfigRecord) % 4 == 0, "flash is written in 32-bit words");
+
+// The layout before the channel count became configurable (three mapping
+// bytes), found in the first sector only. It is read once and upgraded; the
+// next save goes to the second sector and then erases the old layout.
+constexpr uint16_t CONFIG_RECORD_MAGIC_V1 = 0xC0F1;
+
+struct ConfigRecordV1 {
+  uint16_t magic;
+  uint8_t autoMode;
+  uint8_t ditherEnabled;
+  uint32_t sequence;
+  uint8_t mapping[3];
+  uint8_t curves[3];
+  uint8_t weather;         // 0xFF in records from before it existed
+  uint8_t weatherCover;
+  uint16_t manual[3];
+  uint8_t astroMode;       // 0xFF in records from before it existed
+  uint8_t reserved2;
+  int32_t latitude;
+  int32_t longitude;
+  uint32_t weatherSeed;
+  uint32_t crc;
+};
+
+static_assert(sizeof(ConfigRecordV1) == 40, "ConfigRecordV1 is the layout on flash");
+
+template <typename Record>
+uint32_t configRecordCrc(const Record &record) {
+  return crc32(reinterpret_cast<const uint8_t *>(&record), sizeof(record) - sizeof(record.crc));
+}
+
+// Fields the old layout did not have come out as 0xFF, like erased flash
+inline ConfigRecord upgradeConfigRecord(const ConfigRecordV1 &old) {
+  ConfigRecord record;
+  memset(&record, 0xFF, sizeof(record));
+  record.magic = CONFIG_RECORD_MAGIC;
+  record.autoMode = old.autoMode;
+  record.ditherEnabled = old.ditherEnabled;
+  record.sequence = old.sequence;
+  for (uint8_t i = 0; i < 3; ++i) {
+    record.mapping[i] = old.mapping[i];
+    record.curves[i] = old.curves[i];
+    record.manual[i] = old.manual[i];
+  }
+  record.weather = old.weather;
+  record.weatherCover = old.weatherCover;
+  record.astroMode = old.astroMode;
+  record.latitude = old.latitude;
+  record.longitude = old.longitude;
+  record.weatherSeed = old.weatherSeed;
+  return record;
+}
+
+// Same settings, ignoring sequence and CRC
+inline bool configRecordSame(const ConfigRecord &a, const ConfigRecord &b) {
+  for (uint8_t i = 0; i < CONFIG_MAX_CHANNELS; ++i) {
+    if (a.mapping[i] != b.mapping[i]) return false;
+  }
+  return a.autoMode == b.autoMode && a.ditherEnabled == b.ditherEnabled &&
+         a.curves[0] == b.curves[0] && a.curves[1] == b.curves[1] && a.curves[2] == b.curves[2] &&
+         a.manual[0] == b.manual[0] && a.manual[1] == b.manual[1] && a.manual[2] == b.manual[2] &&
+         a.astroMode == b.astroMode && a.latitude == b.latitude && a.longitude == b.longitude &&
+         a.weather == b.weather && a.weatherCover == b.weatherCover && a.weatherSeed == b.weatherSeed;
+}
+
+template <typename Flash>
+class ConfigJournal {
+ public:
+  static constexpr uint16_t SLOTS = CONFIG_SECTOR_SIZE / sizeof(ConfigRecord);
+
+  // The two sectors need not be adjacent
+  ConfigJournal(uint32_t firstSector, uint32_t secondSector) : sectors_{firstSector, secondSector} {}
+
+  // Find the newest valid record; returns false when there is none
+  bool load(ConfigRecord &out) {
+    bool found = false;
+    uint16_t used[2] = {0, 0};
+    current_ = 0;
+    for (uint8_t sector = 0; sector < 2; ++sector) {
+      for (uint16_t slot = 0; slot < SLOTS; ++slot) {
+        ConfigRecord record;
+        if (!readSlot(sector, slot, record)) break;
+        if (erased(record)) break;  // end of this sector's journal
+        used[sector] = slot + 1;
+        if (record.magic != CONFIG_RECORD_MAGIC || record.crc != configRecordCrc(record)) continue;  // torn write
+        if (!found || record.sequence > out.sequence) {
+          out = record;
+          found = true;
+          current_ = sector;
+        }
+      }
+    }
+    nextSlot_ = used[current_];
+    if (!found && loadV1(out)) {
+      found = true;
+      current_ = 0;
+      nextSlot_ = SLOTS;  // the next append moves to the second sector
+    }
+    sequence_ = found ? out.sequence : 0;
+    return found;
+  }
+
+  // Append a record (sets magic, sequence and CRC); moves to the other
+  // sector when the current one is full
+  bool append(ConfigRecord &record) {
+    record.magic = CONFIG_RECORD_MAGIC;
+    record.sequence = ++sequence_;
+    record.crc = configRecordCrc(record);
+
+    if (nextSlot_ < SLOTS) {
+      if (!Flash::write(slotAddress(current_, nextSlot_), reinterpret_cast<uint32_t *>(&record), sizeof(record))) {
+        return false;
+      }
+      ++nextSlot_;
+      return true;
+    }
+
+    // The other sector only holds older records (or what is left of an
+    // interrupted move), so it can be erased first if it is not already
+    uint8_t fresh = 1 - current_;
+    ConfigRecord check;
+    if (!readSlot(fresh, 0, check)) return false;
+    if (!erased(check)) {
+      if (!Flash::erase(sectors_[fresh])) return false;
+      ++erases_;
+    }
+    if (!Flash::write(slotAddress(fresh, 0), reinterpret_cast<uint32_t *>(&record), sizeof(record)) ||
+        !readSlot(fresh, 0, check) || memcmp(&check, &record, sizeof(record)) != 0) {
+      return false;
+    }
+
+    // Only now the full sector can go; if erasing it fails, the next move
+    // erases it before writing
+    uint8_t full = current_;
+    current_ = fresh;
+    nextSlot_ = 1;
+    if (Flash::erase(sectors_[full])) ++erases_;
+    return true;
+  }
+
+  uint16_t usedSlots() const { return nextSlot_; }
+  uint32_t erases() const { return erases_; }
+
+ private:
+  uint32_t slotAddress(uint8_t sector, uint16_t slot) const { return sectors_[sector] + slot * sizeof(ConfigRecord); }
+
+  bool readSlot(uint8_t sector, uint16_t slot, ConfigRecord &record) {
+    return Flash::read(slotAddress(sector, slot), reinterpret_cast<uint32_t *>(&record), sizeof(record));
+  }
+
+  static bool erased(const ConfigRecord &record) { return record.magic == 0xFFFF && record.sequence == 0xFFFFFFFF; }
+
+  // Newest record of the old layout, upgraded
+  bool loadV1(ConfigRecord &out) {
+    constexpr uint16_t slots = CONFIG_SECTOR_SIZE / sizeof(ConfigRecordV1);
+    bool found = false;
+    ConfigRecordV1 newest = {};
+    for (uint16_t slot = 0; slot < slots; ++slot) {
+      ConfigRecordV1 record;
+      if (!Flash::read(sectors_[0] + slot * sizeof(record), reinterpret_cast<uint32_t *>(&record), sizeof(record))) {
+        break;
+      }
+      if (record.magic == 0xFFFF && record.sequence == 0xFFFFFFFF) break;
+      if (record.magic != CONFIG_RECORD_MAGIC_V1 || record.crc != configRecordCrc(record)) continue;
+      if (!found || record.sequence > newest.sequence) {
+        newest = record;
+        found = true;
+      }
+    }
+    if (found) out = upgradeConfigRecord(newest);
+    return found;
+  }
+
+  uint32_t sectors_[2];
+  uint32_t sequence_ = 0;
+  uint32_t erases_ = 0;
+  uint16_t nextSlot_ = 0;
+  uint8_t current_ = 0;
+};
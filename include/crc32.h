@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3), bitwise - the blocks it protects are small. Pass the
+// previous result to continue over a second block.
+inline uint32_t crc32(const uint8_t *data, size_t length, uint32_t previous = 0) {
+  uint32_t crc = ~previous;
+  while (length--) {
+    crc ^= *data++;
+    for (uint8_t bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0u - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
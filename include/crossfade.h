@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "daylight_curve.h"
+
+// ------------------------------------------------------------
+// Crossfade between two output levels
+//
+// start() freezes the level shown at that moment; until durationMs has
+// passed, apply() returns a linear mix of that level and whatever the
+// caller now wants to show (a schedule that keeps moving, a manual level),
+// so the end of the fade lands exactly on the live value. Starting again
+// mid-fade simply freezes the mix shown so far, without a step.
+//
+// Integer only: the progress is elapsed * (2^32 / duration) >> 16, a Q16
+// weight from one 32x32 bit multiply per call; the reciprocal is computed
+// once in start(). Idle, apply() is a single flag test.
+// ------------------------------------------------------------
+
+constexpr uint32_t CROSSFADE_MAX_MS = 3600000;  // an hour; slower changes are a schedule's job
+
+class LevelCrossfade {
+ public:
+  // durationMs of 0 cancels a running fade
+  void start(const PwmLevel &from, uint32_t durationMs, uint32_t nowMs) {
+    if (durationMs == 0) {
+      active_ = false;
+      return;
+    }
+    if (durationMs > CROSSFADE_MAX_MS) durationMs = CROSSFADE_MAX_MS;
+    from_ = from;
+    startMs_ = nowMs;
+    durationMs_ = durationMs;
+    rate_ = static_cast<uint32_t>((static_cast<uint64_t>(1) << 32) / durationMs - 1);
+    active_ = true;
+  }
+
+  void cancel() { active_ = false; }
+  bool active() const { return active_; }
+  uint32_t durationMs() const { return durationMs_; }
+
+  uint32_t remainingMs(uint32_t nowMs) const {
+    uint32_t elapsed = nowMs - startMs_;
+    return active_ && elapsed < durationMs_ ? durationMs_ - elapsed : 0;
+  }
+
+  // to, mixed with the frozen level while the fade runs; the fade ends at
+  // the first call after its duration
+  PwmLevel apply(const PwmLevel &to, uint32_t nowMs) {
+    if (!active_) return to;
+    uint32_t elapsed = nowMs - startMs_;
+    if (elapsed >= durationMs_) {
+      active_ = false;
+      return to;
+    }
+    uint32_t weight = static_cast<uint32_t>((static_cast<uint64_t>(elapsed) * rate_) >> 16);  // Q16
+    return {mix(from_.red, to.red, weight), mix(from_.green, to.green, weight), mix(from_.blue, to.blue, weight)};
+  }
+
+ private:
+  // Levels stay below 2^15 (PWM_MAX << DITHER_BITS), so the product fits
+  static uint16_t mix(uint16_t from, uint16_t to, uint32_t weight) {
+    return static_cast<uint16_t>(from + ((static_cast<int32_t>(to) - from) * static_cast<int32_t>(weight) >> 16));
+  }
+
+  PwmLevel from_ = {0, 0, 0};
+  uint32_t startMs_ = 0;
+  uint32_t durationMs_ = 0;
+  uint32_t rate_ = 0;  // 2^32 / durationMs, minus one so weight stays below 2^16
+  bool active_ = false;
+};
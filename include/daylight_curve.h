@@ -0,0 +1,292 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------
+// Fixed-point daylight curve
+//
+// A schedule is a list of compact points (minute of day + three levels in
+// 0.01 % steps, 8 bytes each). Between two points the level is a straight
+// line; the segment is turned into integer start/slope values only when the
+// clock enters it, so evaluating the curve costs a 32x32->64 multiply and a
+// shift per channel - no soft-float on the ESP8266.
+// ------------------------------------------------------------
+
+struct RGBLevel {
+  float red;    // 0.0 - 1.0
+  float green;  // 0.0 - 1.0
+  float blue;   // 0.0 - 1.0
+};
+
+// Daylight simulation phase (time in minutes since midnight)
+struct DayPhase {
+  uint16_t minutes;
+  RGBLevel level;
+};
+
+// PWM counts per color. Inside the output path these carry DITHER_BITS of
+// fraction (see dither.h); evaluatePoints() returns whole counts by default.
+struct PwmLevel {
+  uint16_t red;
+  uint16_t green;
+  uint16_t blue;
+};
+
+constexpr uint16_t MINUTES_PER_DAY = 1440;
+constexpr uint32_t MS_PER_MINUTE = 60000UL;
+constexpr uint32_t MS_PER_DAY = MINUTES_PER_DAY * MS_PER_MINUTE;
+
+// Schedule point as stored in flash and uploaded over HTTP
+constexpr uint16_t SCHEDULE_LEVEL_MAX = 10000;  // 100.00 %
+
+struct SchedulePoint {
+  uint16_t minutes;   // since midnight, strictly increasing
+  uint16_t level[3];  // red, green, blue in 0 - SCHEDULE_LEVEL_MAX
+};
+
+static_assert(sizeof(SchedulePoint) == 8, "SchedulePoint is stored in flash");
+
+template <size_t N>
+struct SchedulePoints {
+  SchedulePoint points[N];
+};
+
+// One linear piece of the curve, running from startMs for lengthMs (the last
+// one wraps around midnight). Levels are PWM counts in Q16; slopes are Q16
+// counts per millisecond, scaled by a further 2^16.
+struct CurveSegment {
+  uint32_t startMs;
+  uint32_t lengthMs;
+  int32_t start[3];  // red, green, blue
+  int32_t slope[3];
+};
+
+// ------------------------------------------------------------
+// Validation & conversion
+// ------------------------------------------------------------
+template <size_t N>
+constexpr bool scheduleIsSorted(const DayPhase (&schedule)[N]) {
+  for (size_t i = 0; i < N; ++i) {
+    if (schedule[i].minutes >= MINUTES_PER_DAY) return false;
+    if (i > 0 && schedule[i].minutes <= schedule[i - 1].minutes) return false;
+  }
+  return true;
+}
+
+constexpr bool levelInRange(float value) {
+  return value >= 0.0f && value <= 1.0f;
+}
+
+template <size_t N>
+constexpr bool scheduleLevelsInRange(const DayPhase (&schedule)[N]) {
+  for (size_t i = 0; i < N; ++i) {
+    const RGBLevel &l = schedule[i].level;
+    if (!levelInRange(l.red) || !levelInRange(l.green) || !levelInRange(l.blue)) return false;
+  }
+  return true;
+}
+
+// Runtime check for uploaded/stored schedules
+constexpr bool schedulePointsValid(const SchedulePoint *points, size_t count) {
+  if (count == 0) return false;
+  for (size_t i = 0; i < count; ++i) {
+    if (points[i].minutes >= MINUTES_PER_DAY) return false;
+    if (i > 0 && points[i].minutes <= points[i - 1].minutes) return false;
+    for (uint8_t c = 0; c < 3; ++c) {
+      if (points[i].level[c] > SCHEDULE_LEVEL_MAX) return false;
+    }
+  }
+  return true;
+}
+
+constexpr uint16_t levelToPoint(float level) {
+  return static_cast<uint16_t>(static_cast<double>(level) * SCHEDULE_LEVEL_MAX + 0.5);
+}
+
+template <size_t N>
+constexpr SchedulePoints<N> toSchedulePoints(const DayPhase (&schedule)[N]) {
+  SchedulePoints<N> out{};
+  for (size_t i = 0; i < N; ++i) {
+    out.points[i].minutes = schedule[i].minutes;
+    out.points[i].level[0] = levelToPoint(schedule[i].level.red);
+    out.points[i].level[1] = levelToPoint(schedule[i].level.green);
+    out.points[i].level[2] = levelToPoint(schedule[i].level.blue);
+  }
+  return out;
+}
+
+constexpr int32_t levelToQ16(uint16_t level, uint16_t pwmMax) {
+  return static_cast<int32_t>((static_cast<int64_t>(level) * pwmMax * 65536 + SCHEDULE_LEVEL_MAX / 2) /
+                              SCHEDULE_LEVEL_MAX);
+}
+
+constexpr int32_t slopeQ32(int32_t fromQ16, int32_t toQ16, uint32_t durationMs) {
+  // Round to nearest so long, shallow ramps do not drift
+  return static_cast<int32_t>(
+      (static_cast<int64_t>(toQ16 - fromQ16) * 65536 +
+       (toQ16 >= fromQ16 ? 1 : -1) * static_cast<int64_t>(durationMs / 2)) /
+      static_cast<int64_t>(durationMs));
+}
+
+// Segment from point index to the next one (the last wraps to the first)
+constexpr CurveSegment buildSegment(const SchedulePoint *points, size_t count, size_t index, uint16_t pwmMax) {
+  const SchedulePoint &from = points[index];
+  const SchedulePoint &to = points[(index + 1) % count];
+  uint32_t minutes = index + 1 < count ? to.minutes - from.minutes
+                                       : (MINUTES_PER_DAY - from.minutes) + to.minutes;
+  CurveSegment segment{};
+  segment.startMs = from.minutes * MS_PER_MINUTE;
+  segment.lengthMs = minutes * MS_PER_MINUTE;
+  for (uint8_t c = 0; c < 3; ++c) {
+    segment.start[c] = levelToQ16(from.level[c], pwmMax);
+    segment.slope[c] = slopeQ32(segment.start[c], levelToQ16(to.level[c], pwmMax), segment.lengthMs);
+  }
+  return segment;
+}
+
+// ------------------------------------------------------------
+// Runtime evaluation
+// ------------------------------------------------------------
+// Level of one channel, rounded to fractionBits below a whole count
+constexpr uint16_t segmentCount(const CurveSegment &segment, uint8_t channel, uint32_t elapsedMs,
+                                uint8_t fractionBits) {
+  int32_t value = segment.start[channel] +
+                  static_cast<int32_t>((static_cast<int64_t>(segment.slope[channel]) * elapsedMs) >> 16);
+  uint8_t shift = 16 - fractionBits;
+  return value <= 0 ? 0 : static_cast<uint16_t>((value + (1L << (shift - 1))) >> shift);
+}
+
+constexpr uint32_t segmentElapsed(const CurveSegment &segment, uint32_t msOfDay) {
+  return msOfDay >= segment.startMs ? msOfDay - segment.startMs : msOfDay + MS_PER_DAY - segment.startMs;
+}
+
+constexpr bool segmentCovers(const CurveSegment &segment, uint32_t msOfDay) {
+  return segmentElapsed(segment, msOfDay) < segment.lengthMs;
+}
+
+constexpr PwmLevel segmentLevel(const CurveSegment &segment, uint32_t msOfDay, uint8_t fractionBits) {
+  uint32_t elapsed = segmentElapsed(segment, msOfDay);
+  return {segmentCount(segment, 0, elapsed, fractionBits), segmentCount(segment, 1, elapsed, fractionBits),
+          segmentCount(segment, 2, elapsed, fractionBits)};
+}
+
+// Index of the point starting the segment that covers msOfDay, by binary
+// search (times before the first point belong to the last segment, which
+// wraps around midnight)
+constexpr size_t findPoint(const SchedulePoint *points, size_t count, uint32_t msOfDay) {
+  uint32_t minute = msOfDay / MS_PER_MINUTE;
+  size_t low = 0;
+  size_t high = count;  // first point after minute lies in [low, high]
+  while (low < high) {
+    size_t mid = (low + high) / 2;
+    if (points[mid].minutes <= minute) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low == 0 ? count - 1 : low - 1;
+}
+
+// Stateless evaluation (compile-time checks, one-off lookups)
+constexpr PwmLevel evaluatePoints(const SchedulePoint *points, size_t count, uint32_t msOfDay, uint16_t pwmMax,
+                                  uint8_t fractionBits = 0) {
+  return count == 0 ? PwmLevel{0, 0, 0}
+                    : segmentLevel(buildSegment(points, count, findPoint(points, count, msOfDay), pwmMax),
+                                   msOfDay, fractionBits);
+}
+
+// Remembers the current segment, so evaluating the curve as the clock moves
+// forward touches the point list only when a segment ends. Moving on to the
+// next point is O(1); a clock jump falls back to findPoint().
+class ScheduleCursor {
+ public:
+  // Forget the cached segment (after the point list changed)
+  void reset() { valid_ = false; }
+
+  PwmLevel evaluate(const SchedulePoint *points, size_t count, uint32_t msOfDay, uint16_t pwmMax,
+                    uint8_t fractionBits) {
+    if (count == 0) return {0, 0, 0};
+    if (!valid_ || !segmentCovers(segment_, msOfDay)) {
+      if (valid_ && segmentCovers(buildAt(points, count, (index_ + 1) % count, pwmMax), msOfDay)) {
+        ++advances_;
+      } else {
+        buildAt(points, count, findPoint(points, count, msOfDay), pwmMax);
+        ++seeks_;
+      }
+      valid_ = true;
+    }
+    return segmentLevel(segment_, msOfDay, fractionBits);
+  }
+
+  uint32_t advances() const { return advances_; }
+  uint32_t seeks() const { return seeks_; }
+
+ private:
+  const CurveSegment &buildAt(const SchedulePoint *points, size_t count, size_t index, uint16_t pwmMax) {
+    index_ = index;
+    segment_ = buildSegment(points, count, index, pwmMax);
+    return segment_;
+  }
+
+  CurveSegment segment_{};
+  size_t index_ = 0;
+  bool valid_ = false;
+  uint32_t advances_ = 0;
+  uint32_t seeks_ = 0;
+};
+
+// ------------------------------------------------------------
+// Equivalence with the original float evaluation (used in static_assert)
+// ------------------------------------------------------------
+constexpr float referenceChannel(const RGBLevel &level, uint8_t channel) {
+  return channel == 0 ? level.red : channel == 1 ? level.green : level.blue;
+}
+
+template <size_t N>
+constexpr uint16_t referenceCount(const DayPhase (&schedule)[N], int minutes, uint8_t channel,
+                                  uint16_t pwmMax) {
+  const DayPhase *prev = &schedule[0];
+  const DayPhase *next = nullptr;
+  for (size_t i = 0; i < N; ++i) {
+    if (schedule[i].minutes <= minutes) {
+      prev = &schedule[i];
+    } else {
+      next = &schedule[i];
+      break;
+    }
+  }
+
+  float duration = 0.0f;
+  float elapsed = minutes - prev->minutes;
+  if (next == nullptr) {
+    next = &schedule[0];
+    duration = (MINUTES_PER_DAY - prev->minutes) + next->minutes;
+    if (elapsed < 0) elapsed += MINUTES_PER_DAY;
+  } else {
+    duration = next->minutes - prev->minutes;
+  }
+  float fraction = duration > 0 ? elapsed / duration : 0.0f;
+  float a = referenceChannel(prev->level, channel);
+  float b = referenceChannel(next->level, channel);
+  float value = a + (b - a) * fraction;
+  if (value < 0.0f) value = 0.0f;
+  if (value > 1.0f) value = 1.0f;
+  float scaled = value * pwmMax;
+  uint16_t count = static_cast<uint16_t>(scaled);
+  return (scaled - count >= 0.5f) ? count + 1 : count;
+}
+
+template <uint16_t PwmMax, size_t N>
+constexpr bool curveMatchesFloatPath(const DayPhase (&schedule)[N], const SchedulePoints<N> &points) {
+  for (int minute = 0; minute < MINUTES_PER_DAY; ++minute) {
+    PwmLevel fixed = evaluatePoints(points.points, N, minute * MS_PER_MINUTE, PwmMax);
+    const uint16_t counts[3] = {fixed.red, fixed.green, fixed.blue};
+    for (uint8_t c = 0; c < 3; ++c) {
+      int diff = static_cast<int>(counts[c]) - referenceCount(schedule, minute, c, PwmMax);
+      if (diff > 1 || diff < -1) return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+// ------------------------------------------------------------
+// Temporal dithering
+//
+// Output targets carry DITHER_BITS of fraction below one PWM count. A
+// first-order sigma-delta modulator spreads that fraction over consecutive
+// frames, toggling between two adjacent counts so the time-averaged duty
+// cycle matches the target (10 + 4 = 14 effective bits).
+// ------------------------------------------------------------
+
+constexpr uint8_t DITHER_BITS = 4;
+constexpr uint16_t DITHER_ONE = 1 << DITHER_BITS;
+constexpr uint16_t DITHER_MASK = DITHER_ONE - 1;
+
+// One modulator frame: returns the whole PWM count to write
+constexpr uint16_t ditherStep(uint16_t target, uint8_t &accumulator) {
+  uint16_t count = target >> DITHER_BITS;
+  accumulator += target & DITHER_MASK;
+  if (accumulator >= DITHER_ONE) {
+    accumulator -= DITHER_ONE;
+    ++count;
+  }
+  return count;
+}
+
+// Nearest whole count, used when dithering is off
+constexpr uint16_t ditherRound(uint16_t target) {
+  return (target + DITHER_ONE / 2) >> DITHER_BITS;
+}
+
+// Every DITHER_ONE frames the written counts must sum to exactly the target,
+// whatever the starting accumulator. The whole-count part passes straight
+// through, so checking two counts' worth of fractions covers every target.
+constexpr bool ditherAverageIsExact() {
+  for (uint32_t target = 0; target < 2u * DITHER_ONE; ++target) {
+    for (uint8_t start = 0; start < DITHER_ONE; ++start) {
+      uint8_t accumulator = start;
+      uint32_t sum = 0;
+      for (uint16_t frame = 0; frame < DITHER_ONE; ++frame) {
+        sum += ditherStep(static_cast<uint16_t>(target), accumulator);
+      }
+      if (sum != target || accumulator != start) return false;
+    }
+  }
+  return true;
+}
+
+static_assert(ditherAverageIsExact(), "dither modulator does not average to its target");
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "daylight_curve.h"
+
+// ------------------------------------------------------------
+// Fade synchronization between controllers (UDP multicast)
+//
+// Controllers in one room phase-lock their schedule clock, so tanks side by
+// side fade as one instead of drifting apart by the difference between
+// their NTP syncs. The node with the lowest id leads and announces its
+// schedule time (ms since local midnight) once per SYNC_ANNOUNCE_MS; the
+// others only listen and keep an offset that is added to their own
+// schedule time before evaluateSchedule().
+//
+// Traffic: one 16-byte datagram per second from the leader. While a leader
+// is being elected (boot, leader gone) each candidate sends at most one per
+// second until it hears a lower id.
+//
+// Followers correct 1/2^SYNC_SLEW_SHIFT of the error per announcement, so
+// a few ms of jitter never shows; errors beyond SYNC_STEP_MS (a leader
+// without NTP) are taken at once, as is every error during a node's first
+// SYNC_LEADER_TIMEOUT_MS. Network latency on a LAN is a few ms and is not
+// compensated. The leader announces its own adjusted time, so a takeover
+// does not move the group: not after the leader drops out, and not when a
+// node with a lower id joins, locks to the running leader and only then
+// takes over.
+//
+// Only nodes with the same group id lock to each other.
+//
+// Datagram, little-endian:
+//   "AQS", u8 version, u8 group, u8 flags (0), u16 sequence,
+//   u32 node id, u32 schedule time in ms
+// ------------------------------------------------------------
+
+constexpr size_t SYNC_PACKET_SIZE = 16;
+constexpr uint8_t SYNC_VERSION = 1;
+constexpr uint32_t SYNC_ANNOUNCE_MS = 1000;
+constexpr uint32_t SYNC_LEADER_TIMEOUT_MS = 3500;  // three missed announcements
+constexpr int32_t SYNC_STEP_MS = 10000;
+constexpr uint8_t SYNC_SLEW_SHIFT = 2;
+
+struct SyncStats {
+  uint32_t sent;
+  uint32_t received;     // announcements locked to
+  uint32_t ignored;      // malformed, other group, or not from the leader
+  uint16_t steps;        // corrections taken at once
+  uint16_t leaderChanges;
+  int32_t lastErrorMs;   // leader minus own schedule time at the last announcement
+};
+
+// Wrap a difference of two times of day into (-12 h, 12 h]
+inline int32_t wrapDayDelta(int32_t delta) {
+  const int32_t half = static_cast<int32_t>(MS_PER_DAY / 2);
+  delta %= static_cast<int32_t>(MS_PER_DAY);
+  if (delta > half) delta -= static_cast<int32_t>(MS_PER_DAY);
+  if (delta <= -half) delta += static_cast<int32_t>(MS_PER_DAY);
+  return delta;
+}
+
+class FadeSync {
+ public:
+  explicit FadeSync(uint8_t group) : group_(group) {}
+
+  // Start listening as nodeId (unique in the group, e.g. the chip id). A
+  // node waits one leader timeout before it may lead and locks to any
+  // leader it hears meanwhile, whatever its id, so it joins a running group
+  // on the group's time instead of announcing over it.
+  void begin(uint32_t nodeId, uint32_t nowMs) {
+    nodeId_ = nodeId;
+    leaderId_ = nodeId;
+    startMs_ = nowMs;
+    lastAnnounceMs_ = nowMs - SYNC_ANNOUNCE_MS;
+    started_ = true;
+  }
+
+  bool started() const { return started_; }
+
+  // Locked to another node's announcements. Once its startup window is
+  // over, a node locked to a higher id takes over instead.
+  bool following(uint32_t nowMs) const {
+    return started_ && leaderId_ != nodeId_ && elapsed(nowMs, leaderSeenMs_) < SYNC_LEADER_TIMEOUT_MS &&
+           !(settled(nowMs) && leaderId_ > nodeId_);
+  }
+
+  bool leading(uint32_t nowMs) const { return started_ && !following(nowMs) && settled(nowMs); }
+
+  // Current leader, or this node while it leads or nobody is heard
+  uint32_t leaderId(uint32_t nowMs) const { return following(nowMs) ? leaderId_ : nodeId_; }
+
+  int32_t offsetMs() const { return offsetMs_; }
+  const SyncStats &stats() const { return stats_; }
+
+  // Own schedule time (ms since local midnight, -1 = clock not set) moved
+  // onto the group's
+  int32_t scheduleTime(int32_t localMs) const {
+    if (localMs < 0) return -1;
+    int32_t adjusted = (localMs + offsetMs_) % static_cast<int32_t>(MS_PER_DAY);
+    return adjusted < 0 ? adjusted + static_cast<int32_t>(MS_PER_DAY) : adjusted;
+  }
+
+  // Writes an announcement into out when one is due; returns its length or 0
+  size_t announce(uint32_t nowMs, int32_t localMs, uint8_t *out, size_t size) {
+    if (size < SYNC_PACKET_SIZE || localMs < 0 || !leading(nowMs)) return 0;
+    if (elapsed(nowMs, lastAnnounceMs_) < SYNC_ANNOUNCE_MS) return 0;
+    if (leaderId_ != nodeId_) {
+      leaderId_ = nodeId_;  // the old leader went quiet
+      ++stats_.leaderChanges;
+    }
+    lastAnnounceMs_ = nowMs;
+
+    out[0] = 'A';
+    out[1] = 'Q';
+    out[2] = 'S';
+    out[3] = SYNC_VERSION;
+    out[4] = group_;
+    out[5] = 0;
+    put(out + 6, ++sequence_, 2);
+    put(out + 8, nodeId_, 4);
+    put(out + 12, static_cast<uint32_t>(scheduleTime(localMs)), 4);
+    ++stats_.sent;
+    return SYNC_PACKET_SIZE;
+  }
+
+  // A datagram from the group; returns true when it was locked to
+  bool receive(const uint8_t *data, size_t length, uint32_t nowMs, int32_t localMs) {
+    if (!started_ || length != SYNC_PACKET_SIZE || data[0] != 'A' || data[1] != 'Q' || data[2] != 'S' ||
+        data[3] != SYNC_VERSION || data[4] != group_) {
+      ++stats_.ignored;
+      return false;
+    }
+    uint32_t sender = get(data + 8, 4);
+    uint32_t leaderTime = get(data + 12, 4);
+
+    // Lowest id wins; a higher one only takes over once the leader is quiet.
+    // In its startup window a node takes any leader until it follows one.
+    uint32_t bound = following(nowMs) ? leaderId_ : settled(nowMs) ? nodeId_ : UINT32_MAX;
+    if (sender == nodeId_ || sender > bound || leaderTime >= MS_PER_DAY) {
+      ++stats_.ignored;
+      return false;
+    }
+    if (sender != leaderId_) ++stats_.leaderChanges;
+    leaderId_ = sender;
+    leaderSeenMs_ = nowMs;
+
+    if (localMs >= 0) {
+      int32_t error = wrapDayDelta(static_cast<int32_t>(leaderTime) - scheduleTime(localMs));
+      stats_.lastErrorMs = error;
+      if (error > SYNC_STEP_MS || error < -SYNC_STEP_MS || !settled(nowMs)) {
+        offsetMs_ = wrapDayDelta(offsetMs_ + error);
+        ++stats_.steps;
+      } else {
+        offsetMs_ = wrapDayDelta(offsetMs_ + error / (1 << SYNC_SLEW_SHIFT));
+      }
+    }
+    ++stats_.received;
+    return true;
+  }
+
+ private:
+  static uint32_t elapsed(uint32_t now, uint32_t since) { return now - since; }
+
+  // Past the startup window, in which the node only listens
+  bool settled(uint32_t nowMs) const { return elapsed(nowMs, startMs_) >= SYNC_LEADER_TIMEOUT_MS; }
+
+  static void put(uint8_t *out, uint32_t value, uint8_t bytes) {
+    for (uint8_t i = 0; i < bytes; ++i) out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+
+  static uint32_t get(const uint8_t *in, uint8_t bytes) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < bytes; ++i) value |= static_cast<uint32_t>(in[i]) << (8 * i);
+    return value;
+  }
+
+  uint8_t group_;
+  uint32_t nodeId_ = 0;
+  bool started_ = false;
+  uint32_t startMs_ = 0;
+  uint32_t leaderId_ = 0;
+  uint32_t leaderSeenMs_ = 0;  // last announcement from the leader
+  uint32_t lastAnnounceMs_ = 0;
+  uint16_t sequence_ = 0;
+  int32_t offsetMs_ = 0;
+  SyncStats stats_ = {};
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <type_traits>
+
+// ------------------------------------------------------------
+// Allocation-free JSON writer
+//
+// Appends into a caller-owned buffer (usually static) instead of growing a
+// String. Keys and constant strings are passed with F() and read from flash.
+// Commas are inserted automatically; nesting is tracked in a bitmask, so up
+// to 16 levels are supported. If the buffer fills up, further output is
+// dropped and overflowed() reports it.
+// ------------------------------------------------------------
+class JsonWriter {
+ public:
+  JsonWriter(char *buffer, size_t capacity) : buffer_(buffer), capacity_(capacity) {
+    if (capacity_ > 0) buffer_[0] = '\0';
+  }
+
+  void beginObject() { open('{'); }
+  void endObject() { close('}'); }
+  void beginArray() { open('['); }
+  void endArray() { close(']'); }
+
+  void key(const __FlashStringHelper *name) {
+    separator();
+    put('"');
+    putFlash(name);
+    put('"');
+    put(':');
+    afterKey_ = true;
+  }
+
+  void value(bool v) {
+    separator();
+    putFlash(v ? F("true") : F("false"));
+  }
+
+  template <typename T>
+  void value(T v) {
+    static_assert(std::is_integral<T>::value, "JsonWriter::value() takes integers; pass decimals for floats");
+    separator();
+    if (std::is_signed<T>::value) {
+      int32_t s = static_cast<int32_t>(v);
+      if (s < 0) {
+        put('-');
+        putUnsigned(0u - static_cast<uint32_t>(s));
+        return;
+      }
+    }
+    putUnsigned(static_cast<uint32_t>(v));
+  }
+
+  // Fixed-point number, e.g. value(0.125f, 3) -> 0.125 (no printf/float formatting)
+  void value(float v, uint8_t decimals) {
+    separator();
+    uint32_t scale = 1;
+    for (uint8_t i = 0; i < decimals; ++i) scale *= 10;
+    if (v < 0) {
+      put('-');
+      v = -v;
+    }
+    uint32_t scaled = static_cast<uint32_t>(v * scale + 0.5f);
+    putUnsigned(scaled / scale);
+    if (decimals == 0) return;
+    put('.');
+    uint32_t fraction = scaled % scale;
+    for (uint32_t digit = scale / 10; digit > 0; digit /= 10) {
+      put('0' + (fraction / digit) % 10);
+    }
+  }
+
+  void string(const char *s) {
+    separator();
+    put('"');
+    while (*s) putEscaped(*s++);
+    put('"');
+  }
+
+  void string(const __FlashStringHelper *s) {
+    separator();
+    put('"');
+    PGM_P p = reinterpret_cast<PGM_P>(s);
+    for (char c = pgm_read_byte(p); c; c = pgm_read_byte(++p)) putEscaped(c);
+    put('"');
+  }
+
+  // Pre-formatted JSON (number, nested document) written as one value
+  void raw(const char *json) {
+    separator();
+    while (*json) put(*json++);
+  }
+
+  const char *c_str() const { return buffer_; }
+  size_t length() const { return length_; }
+  bool overflowed() const { return overflowed_; }
+
+ private:
+  void open(char c) {
+    separator();
+    put(c);
+    if (depth_ < 16) ++depth_;
+    hasItems_ &= ~(1u << depth_);
+  }
+
+  void close(char c) {
+    put(c);
+    if (depth_ > 0) --depth_;
+  }
+
+  void separator() {
+    if (afterKey_) {
+      afterKey_ = false;
+      return;
+    }
+    if (hasItems_ & (1u << depth_)) put(',');
+    hasItems_ |= 1u << depth_;
+  }
+
+  void putEscaped(char c) {
+    if (c == '"' || c == '\\') {
+      put('\\');
+      put(c);
+    } else if (static_cast<uint8_t>(c) < 0x20) {
+      static const char hex[] = "0123456789abcdef";
+      put('\\');
+      put('u');
+      put('0');
+      put('0');
+      put(hex[(c >> 4) & 0x0F]);
+      put(hex[c & 0x0F]);
+    } else {
+      put(c);
+    }
+  }
+
+  void putFlash(const __FlashStringHelper *s) {
+    PGM_P p = reinterpret_cast<PGM_P>(s);
+    for (char c = pgm_read_byte(p); c; c = pgm_read_byte(++p)) put(c);
+  }
+
+  void putUnsigned(uint32_t v) {
+    char digits[10];
+    uint8_t count = 0;
+    do {
+      digits[count++] = '0' + v % 10;
+      v /= 10;
+    } while (v > 0);
+    while (count > 0) put(digits[--count]);
+  }
+
+  void put(char c) {
+    if (length_ + 1 >= capacity_) {
+      overflowed_ = true;
+      return;
+    }
+    buffer_[length_++] = c;
+    buffer_[length_] = '\0';
+  }
+
+  char *buffer_;
+  size_t capacity_;
+  size_t length_ = 0;
+  uint32_t hasItems_ = 0;  // bit per nesting level: a value was already written
+  uint8_t depth_ = 0;
+  bool afterKey_ = false;
+  bool overflowed_ = false;
+};
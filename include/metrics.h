@@ -0,0 +1,165 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ------------------------------------------------------------
+// Latency histograms & Prometheus text output
+//
+// Recording is one compare loop over a dozen bounds and two additions, so it
+// can sit on every loop() iteration. Buckets are stored non-cumulative and
+// only summed when /metrics is rendered.
+// ------------------------------------------------------------
+
+// Upper bucket bounds in microseconds (the last bucket is +Inf)
+constexpr uint32_t LATENCY_BOUNDS_US[] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000};
+constexpr uint8_t LATENCY_BUCKETS = sizeof(LATENCY_BOUNDS_US) / sizeof(LATENCY_BOUNDS_US[0]) + 1;
+
+struct LatencyHistogram {
+  uint32_t counts[LATENCY_BUCKETS];
+  uint64_t sumUs;
+
+  void record(uint32_t us) {
+    uint8_t bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && us > LATENCY_BOUNDS_US[bucket]) ++bucket;
+    ++counts[bucket];
+    sumUs += us;
+  }
+
+  uint32_t total() const {
+    uint32_t sum = 0;
+    for (uint32_t count : counts) sum += count;
+    return sum;
+  }
+};
+
+// Writes the text exposition format into a small buffer and hands it to
+// Flush (a function taking const char *, size_t) whenever it fills up, so a
+// large page never exists in RAM as a whole.
+template <typename Flush>
+class PrometheusWriter {
+ public:
+  PrometheusWriter(char *buffer, size_t capacity, Flush flush)
+      : buffer_(buffer), capacity_(capacity), flush_(flush) {}
+
+  // "# HELP" and "# TYPE" lines, once per metric name
+  void describe(const __FlashStringHelper *name, const __FlashStringHelper *type, const __FlashStringHelper *help) {
+    putFlash(F("# HELP "));
+    putFlash(name);
+    put(' ');
+    putFlash(help);
+    putFlash(F("\n# TYPE "));
+    putFlash(name);
+    put(' ');
+    putFlash(type);
+    put('\n');
+  }
+
+  // name{labels} value; labels is preformatted (key="value",...) or nullptr
+  void sample(const __FlashStringHelper *name, const char *labels, int64_t value) {
+    putFlash(name);
+    putLabelSet(labels);
+    put(' ');
+    putSigned(value);
+    put('\n');
+  }
+
+  // Microseconds written as seconds
+  void sampleSeconds(const __FlashStringHelper *name, const char *labels, uint64_t us) {
+    putFlash(name);
+    putLabelSet(labels);
+    put(' ');
+    putSeconds(us);
+    put('\n');
+  }
+
+  void histogram(const __FlashStringHelper *name, const char *labels, const LatencyHistogram &histogram) {
+    uint32_t cumulative = 0;
+    for (uint8_t i = 0; i < LATENCY_BUCKETS; ++i) {
+      cumulative += histogram.counts[i];
+      putFlash(name);
+      putFlash(F("_bucket{"));
+      if (labels) {
+        putString(labels);
+        put(',');
+      }
+      putFlash(F("le=\""));
+      if (i < LATENCY_BUCKETS - 1) {
+        putSeconds(LATENCY_BOUNDS_US[i]);
+      } else {
+        putFlash(F("+Inf"));
+      }
+      putFlash(F("\"} "));
+      putSigned(cumulative);
+      put('\n');
+    }
+    putFlash(name);
+    putFlash(F("_sum"));
+    putLabelSet(labels);
+    put(' ');
+    putSeconds(histogram.sumUs);
+    put('\n');
+    putFlash(name);
+    putFlash(F("_count"));
+    putLabelSet(labels);
+    put(' ');
+    putSigned(cumulative);
+    put('\n');
+  }
+
+  void finish() {
+    if (length_ > 0) flush_(buffer_, length_);
+    length_ = 0;
+  }
+
+ private:
+  void putLabelSet(const char *labels) {
+    if (!labels) return;
+    put('{');
+    putString(labels);
+    put('}');
+  }
+
+  void putString(const char *s) {
+    while (*s) put(*s++);
+  }
+
+  void putSeconds(uint64_t us) {
+    putSigned(static_cast<int64_t>(us / 1000000));
+    put('.');
+    uint32_t fraction = us % 1000000;
+    for (uint32_t digit = 100000; digit > 0; digit /= 10) put('0' + (fraction / digit) % 10);
+  }
+
+  void putSigned(int64_t value) {
+    if (value < 0) {
+      put('-');
+      value = -value;
+    }
+    char digits[20];
+    uint8_t count = 0;
+    uint64_t v = static_cast<uint64_t>(value);
+    do {
+      digits[count++] = '0' + v % 10;
+      v /= 10;
+    } while (v > 0);
+    while (count > 0) put(digits[--count]);
+  }
+
+  void putFlash(const __FlashStringHelper *s) {
+    PGM_P p = reinterpret_cast<PGM_P>(s);
+    for (char c = pgm_read_byte(p); c; c = pgm_read_byte(++p)) put(c);
+  }
+
+  void put(char c) {
+    if (length_ == capacity_) {
+      flush_(buffer_, length_);
+      length_ = 0;
+    }
+    buffer_[length_++] = c;
+  }
+
+  char *buffer_;
+  size_t capacity_;
+  Flush flush_;
+  size_t length_ = 0;
+};
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------
+// PWM output drivers
+//
+// OutputDriver<N, Backend> keeps the count last set on each of N channels
+// and which of them changed. set() only records; flush() hands the changed
+// channels to the backend, so an unchanged frame costs no pin or bus
+// access at all.
+//
+// A backend provides
+//   static constexpr uint8_t MAX_CHANNELS;  // channels it can drive
+//   static constexpr uint16_t MAX_COUNT;    // full on
+//   static constexpr bool MERGE_GAPS;       // true: one write from the first
+//                                           // to the last changed channel
+//   bool write(uint8_t first, const uint16_t *counts, uint8_t count);
+//   bool verify();  // false: the hardware had lost its setup and outputs
+//                   // (it is set up again; every channel must be rewritten)
+// and is set up by its owner before the first flush(). Pins are cheap to
+// write one by one; on a bus each transaction costs an address byte and a
+// start/stop, so a bus backend takes the whole span (the unchanged channels
+// in between are rewritten with their old value) in one transfer.
+// ------------------------------------------------------------
+
+struct OutputStats {
+  uint32_t channelWrites;  // channel values sent to the backend
+  uint32_t transactions;   // backend write() calls
+  uint32_t errors;         // failed writes (retried at the next flush)
+};
+
+template <uint8_t N, typename Backend>
+class OutputDriver {
+ public:
+  static_assert(N > 0 && N <= Backend::MAX_CHANNELS, "more channels than the backend drives");
+  static_assert(N <= 32, "dirty flags are one 32-bit word");
+
+  static constexpr uint8_t CHANNELS = N;
+  static constexpr uint16_t MAX_COUNT = Backend::MAX_COUNT;
+
+  explicit OutputDriver(Backend &backend) : backend_(backend) {}
+
+  // Every channel off and written at the next flush()
+  void reset() {
+    for (uint8_t i = 0; i < N; ++i) counts_[i] = 0;
+    dirty_ = allChannels();
+  }
+
+  void set(uint8_t channel, uint16_t count) {
+    if (channel >= N) return;
+    if (count > MAX_COUNT) count = MAX_COUNT;
+    if (count == counts_[channel]) return;
+    counts_[channel] = count;
+    dirty_ |= 1UL << channel;
+  }
+
+  // Ask the backend whether the hardware still holds its setup; when it
+  // had lost it, every channel is written at the next flush()
+  bool verify() {
+    if (backend_.verify()) return true;
+    dirty_ = allChannels();
+    return false;
+  }
+
+  uint16_t get(uint8_t channel) const { return channel < N ? counts_[channel] : 0; }
+  bool dirty() const { return dirty_ != 0; }
+  const OutputStats &stats() const { return stats_; }
+
+  // Write what changed; false when the backend failed (those channels stay
+  // dirty)
+  bool flush() {
+    if (dirty_ == 0) return true;
+    uint32_t failed = 0;
+    uint8_t channel = 0;
+    while (channel < N) {
+      if (!(dirty_ & (1UL << channel))) {
+        ++channel;
+        continue;
+      }
+      uint8_t end = channel + 1;  // one past the run
+      if (Backend::MERGE_GAPS) {
+        end = N;
+        while (!(dirty_ & (1UL << (end - 1)))) --end;
+      } else {
+        while (end < N && (dirty_ & (1UL << end))) ++end;
+      }
+      uint8_t length = end - channel;
+      ++stats_.transactions;
+      if (backend_.write(channel, counts_ + channel, length)) {
+        stats_.channelWrites += length;
+      } else {
+        ++stats_.errors;
+        failed |= runMask(channel, length);
+      }
+      channel = end;
+    }
+    dirty_ = failed;
+    return failed == 0;
+  }
+
+ private:
+  static constexpr uint32_t allChannels() { return N == 32 ? 0xFFFFFFFFUL : (1UL << N) - 1; }
+  static uint32_t runMask(uint8_t first, uint8_t length) {
+    return (length == 32 ? 0xFFFFFFFFUL : (1UL << length) - 1) << first;
+  }
+
+  Backend &backend_;
+  uint16_t counts_[N] = {};
+  uint32_t dirty_ = allChannels();
+  OutputStats stats_ = {};
+};
+
+// ------------------------------------------------------------
+// PCA9685: 16-channel, 12-bit PWM expander on I2C
+//
+// Bus is anything with Wire's beginTransmission()/write()/endTransmission()
+// and requestFrom()/read().
+// The chip runs in auto-increment mode, so a span of channels is one
+// transaction: the first LEDn_ON_L register, then ON_L, ON_H, OFF_L, OFF_H
+// per channel (at most 1 + 16 * 4 = 65 bytes; the ESP8266 core buffers 128).
+// Every channel turns on at 0 and off at its count; 0 and 4095 use the
+// full-off and full-on bits, so neither leaves a glitch of one step.
+// Outputs are push-pull (OUTDRV) to drive MOSFET gates directly. After a
+// failed transfer the chip is set up again before the next one. A chip that
+// browns out without the bus noticing comes back from its power-on reset
+// asleep, with auto-increment off and every channel full off, and still
+// acknowledges writes; only verify(), which reads MODE1 back, finds that.
+// Its owner calls it now and then (see OutputDriver::verify()).
+// ------------------------------------------------------------
+
+constexpr uint8_t PCA9685_MODE1 = 0x00;
+constexpr uint8_t PCA9685_MODE2 = 0x01;
+constexpr uint8_t PCA9685_LED0_ON_L = 0x06;
+constexpr uint8_t PCA9685_PRESCALE = 0xFE;
+constexpr uint8_t PCA9685_MODE1_SLEEP = 0x10;
+constexpr uint8_t PCA9685_MODE1_AUTO_INCREMENT = 0x20;
+constexpr uint8_t PCA9685_MODE2_OUTDRV = 0x04;
+constexpr uint8_t PCA9685_FULL = 0x10;  // bit 4 of LEDn_ON_H / LEDn_OFF_H
+constexpr uint32_t PCA9685_OSCILLATOR_HZ = 25000000;
+
+// Prescaler for an output frequency (datasheet 7.3.5), clamped to 3 - 255
+constexpr uint8_t pca9685Prescale(uint32_t frequencyHz) {
+  uint32_t prescale = (PCA9685_OSCILLATOR_HZ + 2048 * frequencyHz) / (4096 * frequencyHz) - 1;
+  return prescale < 3 ? 3 : prescale > 255 ? 255 : static_cast<uint8_t>(prescale);
+}
+
+template <typename Bus>
+class Pca9685 {
+ public:
+  static constexpr uint8_t MAX_CHANNELS = 16;
+  static constexpr uint16_t MAX_COUNT = 4095;
+  static constexpr bool MERGE_GAPS = true;
+
+  Pca9685(Bus &bus, uint8_t address) : bus_(bus), address_(address) {}
+
+  // The prescaler can only be written while the oscillator sleeps
+  bool begin(uint32_t frequencyHz) {
+    frequencyHz_ = frequencyHz;
+    ready_ = writeRegister(PCA9685_MODE1, PCA9685_MODE1_SLEEP) &&
+             writeRegister(PCA9685_PRESCALE, pca9685Prescale(frequencyHz)) &&
+             writeRegister(PCA9685_MODE2, PCA9685_MODE2_OUTDRV) &&
+             writeRegister(PCA9685_MODE1, PCA9685_MODE1_AUTO_INCREMENT);
+    return ready_;
+  }
+
+  // Set up again when MODE1 no longer holds what begin() wrote (the
+  // RESTART and ALLCALL bits aside); false when it did not, or the chip
+  // does not answer (then begin() is left to the next write)
+  bool verify() {
+    bus_.beginTransmission(address_);
+    bus_.write(PCA9685_MODE1);
+    if (bus_.endTransmission(false) != 0 || bus_.requestFrom(address_, static_cast<uint8_t>(1)) != 1) {
+      ready_ = false;
+      return false;
+    }
+    uint8_t mode1 = static_cast<uint8_t>(bus_.read());
+    if ((mode1 & (PCA9685_MODE1_SLEEP | PCA9685_MODE1_AUTO_INCREMENT)) == PCA9685_MODE1_AUTO_INCREMENT) return true;
+    begin(frequencyHz_);
+    return false;
+  }
+
+  bool write(uint8_t first, const uint16_t *counts, uint8_t count) {
+    if (first + count > MAX_CHANNELS) return false;
+    if (!ready_ && !begin(frequencyHz_)) return false;
+    bus_.beginTransmission(address_);
+    bus_.write(static_cast<uint8_t>(PCA9685_LED0_ON_L + 4 * first));
+    for (uint8_t i = 0; i < count; ++i) {
+      uint16_t value = counts[i] > MAX_COUNT ? MAX_COUNT : counts[i];
+      uint16_t on = value == MAX_COUNT ? PCA9685_FULL << 8 : 0;
+      uint16_t off = value == 0 ? PCA9685_FULL << 8 : value == MAX_COUNT ? 0 : value;
+      bus_.write(static_cast<uint8_t>(on));
+      bus_.write(static_cast<uint8_t>(on >> 8));
+      bus_.write(static_cast<uint8_t>(off));
+      bus_.write(static_cast<uint8_t>(off >> 8));
+    }
+    ready_ = bus_.endTransmission() == 0;
+    return ready_;
+  }
+
+ private:
+  bool writeRegister(uint8_t reg, uint8_t value) {
+    bus_.beginTransmission(address_);
+    bus_.write(reg);
+    bus_.write(value);
+    return bus_.endTransmission() == 0;
+  }
+
+  Bus &bus_;
+  uint8_t address_;
+  uint32_t frequencyHz_ = 0;
+  bool ready_ = false;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------
+// Perceptual brightness correction
+//
+// Schedule and manual levels are treated as perceived brightness. Before a
+// count reaches analogWrite() it is mapped through a lookup table so equal
+// steps in the schedule look like equal steps on the tank. The tables are
+// generated at compile time and live in flash; nothing here calls powf().
+// ------------------------------------------------------------
+
+enum PerceptualCurve : uint8_t {
+  CURVE_LINEAR = 0,
+  CURVE_CIE1931,
+  CURVE_GAMMA22,
+  CURVE_GAMMA28,
+  CURVE_COUNT
+};
+
+// Maps an input count (0 - Max) onto the PWM count to write. Outputs carry
+// the table's fraction bits (see buildCieTable/buildGammaTable).
+template <uint16_t Max>
+struct CurveTable {
+  uint16_t counts[Max + 1];
+};
+
+// ------------------------------------------------------------
+// constexpr math helpers (compile time only)
+// ------------------------------------------------------------
+constexpr double LN2 = 0.69314718055994530942;
+
+constexpr double constLn(double x) {
+  int exponent = 0;
+  while (x >= 2.0) { x /= 2.0; ++exponent; }
+  while (x < 1.0) { x *= 2.0; --exponent; }
+  // ln(x) = 2 * atanh((x - 1) / (x + 1)), converges quickly for x in [1, 2)
+  double z = (x - 1.0) / (x + 1.0);
+  double z2 = z * z;
+  double term = z;
+  double sum = 0.0;
+  for (int k = 1; k < 41; k += 2) {
+    sum += term / k;
+    term *= z2;
+  }
+  return 2.0 * sum + exponent * LN2;
+}
+
+constexpr double constExp(double x) {
+  // Scale down, run the Taylor series, then square back up
+  double scaled = x / 256.0;
+  double term = 1.0;
+  double sum = 1.0;
+  for (int k = 1; k < 16; ++k) {
+    term *= scaled / k;
+    sum += term;
+  }
+  for (int i = 0; i < 8; ++i) sum *= sum;
+  return sum;
+}
+
+constexpr double constPow(double base, double exponent) {
+  return base <= 0.0 ? 0.0 : constExp(exponent * constLn(base));
+}
+
+constexpr uint16_t toCount(double fraction, uint32_t max) {
+  return fraction <= 0.0 ? 0 : fraction >= 1.0 ? max : static_cast<uint16_t>(fraction * max + 0.5);
+}
+
+// ------------------------------------------------------------
+// Table builders
+// ------------------------------------------------------------
+template <uint16_t Max, uint8_t FractionBits>
+constexpr CurveTable<Max> buildGammaTable(double gamma) {
+  static_assert((static_cast<uint32_t>(Max) << FractionBits) <= 0xFFFF, "table output overflows 16 bits");
+  CurveTable<Max> table{};
+  for (uint32_t i = 0; i <= Max; ++i) {
+    table.counts[i] = toCount(constPow(static_cast<double>(i) / Max, gamma), static_cast<uint32_t>(Max) << FractionBits);
+  }
+  return table;
+}
+
+// CIE 1931 lightness (L*) to relative luminance (Y)
+template <uint16_t Max, uint8_t FractionBits>
+constexpr CurveTable<Max> buildCieTable() {
+  static_assert((static_cast<uint32_t>(Max) << FractionBits) <= 0xFFFF, "table output overflows 16 bits");
+  CurveTable<Max> table{};
+  for (uint32_t i = 0; i <= Max; ++i) {
+    double lightness = 100.0 * i / Max;
+    double luminance = lightness <= 8.0 ? lightness / 903.3
+                                        : constPow((lightness + 16.0) / 116.0, 3.0);
+    table.counts[i] = toCount(luminance, static_cast<uint32_t>(Max) << FractionBits);
+  }
+  return table;
+}
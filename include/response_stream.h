@@ -0,0 +1,153 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ------------------------------------------------------------
+// Streamed responses
+//
+// ESP8266WebServer answers one request at a time inside loop(), and send()
+// only returns once the socket has taken the whole body. A page larger than
+// the socket's send buffer, going to a phone on a weak link, holds the loop
+// (and every fade tick) until the last segment is acknowledged.
+//
+// Such responses are handed to a fixed pool of streams instead: the handler
+// formats the head into its slot and returns, and pump() (a scheduler task)
+// writes whatever each socket accepts right now, never waiting for it.
+// Heads live in one static arena, Slots * HeadBytes, and bodies are copied
+// from flash through a single ChunkBytes buffer, so streaming costs no heap.
+//
+// Backpressure: a socket that accepts nothing keeps its slot for
+// RESPONSE_STALL_MS after its last progress and is then closed; while every
+// slot is busy, acquire() fails and the caller answers 503.
+//
+// Client is anything with availableForWrite(), write(buffer, size),
+// connected() and stop() that can be copied to share a connection
+// (WiFiClient).
+// ------------------------------------------------------------
+
+constexpr uint32_t RESPONSE_STALL_MS = 10000;
+
+struct ResponseStreamStats {
+  uint32_t started;
+  uint32_t completed;
+  uint32_t rejected;  // every slot busy
+  uint32_t stalled;   // closed after RESPONSE_STALL_MS without progress
+  uint32_t dropped;   // the client went away first
+  uint32_t bytes;
+  uint8_t peak;       // most slots in use at once
+};
+
+template <typename Client, uint8_t Slots, size_t HeadBytes, size_t ChunkBytes>
+class ResponseStreams {
+ public:
+  static_assert(Slots > 0, "at least one stream");
+
+  // A free slot's head buffer (HeadBytes) for the caller to fill, or nullptr
+  // when every slot is busy; start() must follow before the next acquire()
+  char *acquire() {
+    for (uint8_t i = 0; i < Slots; ++i) {
+      if (!slots_[i].active) return arena_[i];
+    }
+    ++stats_.rejected;
+    return nullptr;
+  }
+
+  // Send headLength bytes of the acquired head, then the body from flash.
+  // As much as the socket takes goes out at once; pump() sends the rest.
+  void start(Client &client, size_t headLength, const uint8_t *body, size_t bodyLength, uint32_t nowMs) {
+    for (uint8_t i = 0; i < Slots; ++i) {
+      Slot &slot = slots_[i];
+      if (slot.active) continue;
+      slot.client = client;
+      slot.headLength = headLength < HeadBytes ? headLength : HeadBytes;
+      slot.body = body;
+      slot.bodyLength = bodyLength;
+      slot.sent = 0;
+      slot.progressMs = nowMs;
+      slot.active = true;
+      ++stats_.started;
+      uint8_t busy = active();
+      if (busy > stats_.peak) stats_.peak = busy;
+      advance(i, nowMs);
+      return;
+    }
+  }
+
+  // Write what each socket accepts; returns the streams still open
+  uint8_t pump(uint32_t nowMs) {
+    for (uint8_t i = 0; i < Slots; ++i) {
+      if (slots_[i].active) advance(i, nowMs);
+    }
+    return active();
+  }
+
+  uint8_t active() const {
+    uint8_t count = 0;
+    for (const Slot &slot : slots_) count += slot.active;
+    return count;
+  }
+
+  const ResponseStreamStats &stats() const { return stats_; }
+
+ private:
+  struct Slot {
+    Client client;
+    const uint8_t *body;
+    size_t headLength;
+    size_t bodyLength;
+    size_t sent;  // of head and body together
+    uint32_t progressMs;
+    bool active;
+  };
+
+  void advance(uint8_t index, uint32_t nowMs) {
+    Slot &slot = slots_[index];
+    if (!slot.client.connected()) {
+      ++stats_.dropped;
+      finish(slot);
+      return;
+    }
+
+    size_t total = slot.headLength + slot.bodyLength;
+    bool progress = false;
+    while (slot.sent < total) {
+      size_t room = slot.client.availableForWrite();  // grows as segments are acked
+      if (room == 0) break;
+      size_t written;
+      if (slot.sent < slot.headLength) {
+        size_t length = min(room, slot.headLength - slot.sent);
+        written = slot.client.write(reinterpret_cast<const uint8_t *>(arena_[index]) + slot.sent, length);
+      } else {
+        size_t offset = slot.sent - slot.headLength;
+        size_t length = min(min(room, slot.bodyLength - offset), ChunkBytes);
+        memcpy_P(chunk_, slot.body + offset, length);  // flash is read in aligned words
+        written = slot.client.write(chunk_, length);
+      }
+      if (written == 0) break;
+      slot.sent += written;
+      stats_.bytes += written;
+      progress = true;
+    }
+
+    if (slot.sent >= total) {
+      ++stats_.completed;
+      finish(slot);
+    } else if (progress) {
+      slot.progressMs = nowMs;
+    } else if (nowMs - slot.progressMs >= RESPONSE_STALL_MS) {
+      ++stats_.stalled;
+      finish(slot);
+    }
+  }
+
+  void finish(Slot &slot) {
+    slot.client.stop();
+    slot.client = Client();  // let go of the connection
+    slot.active = false;
+  }
+
+  Slot slots_[Slots] = {};
+  char arena_[Slots][HeadBytes];
+  uint8_t chunk_[ChunkBytes];
+  ResponseStreamStats stats_ = {};
+};
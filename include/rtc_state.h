@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crc32.h"
+
+// ------------------------------------------------------------
+// Warm-restart state kept in RTC user memory
+//
+// RTC memory survives ESP.restart(), OTA and the reset button, but not a
+// power cycle. After a warm restart this lets the controller rejoin the same
+// access point with its previous DHCP lease and resume the schedule from an
+// estimated wall clock before NTP answers. A CRC32 rejects stale or
+// uninitialised memory.
+// ------------------------------------------------------------
+
+constexpr uint16_t RTC_STATE_MAGIC = 0xA9C2;
+
+constexpr uint8_t RTC_HAS_WIFI = 1 << 0;
+constexpr uint8_t RTC_HAS_TIME = 1 << 1;
+
+struct RtcState {
+  uint32_t crc;  // over everything after this field
+  uint16_t magic;
+  uint8_t flags;
+  uint8_t wifiChannel;
+  uint8_t bssid[6];
+  uint8_t reserved[2];
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint32_t epochSec;   // wall clock when saved
+  uint32_t epochUsec;
+  uint32_t rtcTicks;   // system_get_rtc_time() when saved
+  uint32_t rtcPeriod;  // system_rtc_clock_cali_proc(): us per tick in Q12
+  int32_t gapPpm;      // correction for the estimated reset gap, learned from NTP
+};
+
+static_assert(sizeof(RtcState) % 4 == 0, "RTC memory is accessed in 32-bit words");
+
+inline uint32_t rtcStateCrc(const RtcState &state) {
+  return crc32(reinterpret_cast<const uint8_t *>(&state) + sizeof(state.crc),
+               sizeof(state) - sizeof(state.crc));
+}
+
+inline bool rtcStateValid(const RtcState &state) {
+  return state.magic == RTC_STATE_MAGIC && state.crc == rtcStateCrc(state);
+}
+
+// Microseconds elapsed between two RTC tick readings, corrected by gapPpm
+inline uint64_t rtcElapsedUs(uint32_t fromTicks, uint32_t toTicks, uint32_t periodQ12, int32_t gapPpm) {
+  uint64_t elapsed = (static_cast<uint64_t>(toTicks - fromTicks) * periodQ12) >> 12;
+  return elapsed + static_cast<int64_t>(elapsed) * gapPpm / 1000000;
+}
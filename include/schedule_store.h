@@ -0,0 +1,263 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crc32.h"
+#include "daylight_curve.h"
+
+// ------------------------------------------------------------
+// Uploaded daylight schedules
+//
+// Text format (POST /schedule, GET /schedule), one point per line:
+//
+//   06:00,5,2,1        time, red, green, blue in percent
+//   07:30;35,5;25;20   spreadsheet export with ';' and decimal commas
+//
+// Empty lines, '#' comments and a header row are skipped. Percentages take
+// up to two decimals.
+//
+// In flash the points are kept in their 8-byte binary form behind a small
+// header, alternating between two sectors: a save always goes to the sector
+// not holding the current schedule, so losing power halfway through leaves
+// the previous schedule intact.
+// ------------------------------------------------------------
+
+struct ScheduleParseResult {
+  size_t count;       // points parsed
+  size_t errorLine;   // 1-based, 0 when the text is valid
+  const char *error;  // nullptr when the text is valid
+};
+
+namespace schedule_text {
+
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline bool parseNumber(const char *&p, const char *end, uint32_t &out) {
+  if (p >= end || !isDigit(*p)) return false;
+  out = 0;
+  while (p < end && isDigit(*p)) {
+    out = out * 10 + (*p++ - '0');
+    if (out > 100000) return false;
+  }
+  return true;
+}
+
+// "12", "12.5", "12,50" -> hundredths of a percent
+inline bool parsePercent(const char *&p, const char *end, char decimal, uint16_t &out) {
+  uint32_t whole = 0;
+  if (!parseNumber(p, end, whole)) return false;
+  uint32_t value = whole * 100;
+  if (p < end && *p == decimal) {
+    ++p;
+    uint32_t scale = 10;
+    while (p < end && isDigit(*p)) {
+      if (scale == 0) return false;  // more than two decimals
+      value += (*p++ - '0') * scale;
+      scale /= 10;
+    }
+  }
+  if (value > SCHEDULE_LEVEL_MAX) return false;
+  out = static_cast<uint16_t>(value);
+  return true;
+}
+
+inline void skipSeparator(const char *&p, const char *end, char separator) {
+  while (p < end && isBlank(*p) && *p != separator) ++p;
+  if (p < end && *p == separator) ++p;
+  while (p < end && isBlank(*p)) ++p;
+}
+
+}  // namespace schedule_text
+
+// Parse one line into point; returns an error message or nullptr
+inline const char *parseScheduleLine(const char *p, const char *end, SchedulePoint &point) {
+  using namespace schedule_text;
+
+  // ';' or tab separated rows (Dutch spreadsheets) use ',' as decimal point
+  char separator = ',';
+  char decimal = '.';
+  for (const char *q = p; q < end; ++q) {
+    if (*q == ';' || *q == '\t') {
+      separator = *q;
+      decimal = ',';
+      break;
+    }
+  }
+
+  uint32_t hours = 0;
+  uint32_t minutes = 0;
+  if (!parseNumber(p, end, hours) || p >= end || *p++ != ':' || !parseNumber(p, end, minutes) ||
+      hours > 23 || minutes > 59) {
+    return "expected HH:MM";
+  }
+  point.minutes = static_cast<uint16_t>(hours * 60 + minutes);
+
+  for (uint8_t c = 0; c < 3; ++c) {
+    skipSeparator(p, end, separator);
+    if (!parsePercent(p, end, decimal, point.level[c])) return "expected a level of 0 - 100 %";
+  }
+  while (p < end && isBlank(*p)) ++p;
+  return p == end ? nullptr : "unexpected text after the blue level";
+}
+
+// Parse a whole upload into points (at most maxCount)
+inline ScheduleParseResult parseSchedule(const char *text, size_t length, SchedulePoint *points,
+                                         size_t maxCount) {
+  ScheduleParseResult result = {0, 0, nullptr};
+  const char *end = text + length;
+  size_t lineNumber = 0;
+  for (const char *line = text; line < end;) {
+    const char *lineEnd = line;
+    while (lineEnd < end && *lineEnd != '\n') ++lineEnd;
+    ++lineNumber;
+
+    const char *p = line;
+    while (p < lineEnd && schedule_text::isBlank(*p)) ++p;
+    bool skip = p == lineEnd || *p == '#' || (result.count == 0 && !schedule_text::isDigit(*p));
+    if (!skip) {
+      const char *error = nullptr;
+      if (result.count >= maxCount) {
+        error = "too many points";
+      } else {
+        SchedulePoint &point = points[result.count];
+        error = parseScheduleLine(p, lineEnd, point);
+        if (!error && result.count > 0 && point.minutes <= points[result.count - 1].minutes) {
+          error = "times must be increasing";
+        }
+      }
+      if (error) {
+        result.errorLine = lineNumber;
+        result.error = error;
+        return result;
+      }
+      ++result.count;
+    }
+    line = lineEnd + 1;
+  }
+  if (result.count == 0) result.error = "no points";
+  return result;
+}
+
+constexpr size_t SCHEDULE_LINE_MAX = 28;  // "23:59,100.00,100.00,100.00\n" + terminator
+
+// "06:00,5.00,2.00,1.00\n"; out needs SCHEDULE_LINE_MAX bytes. Returns the length.
+inline size_t formatSchedulePoint(const SchedulePoint &point, char *out) {
+  char *p = out;
+  *p++ = '0' + point.minutes / 600;
+  *p++ = '0' + point.minutes / 60 % 10;
+  *p++ = ':';
+  *p++ = '0' + point.minutes % 60 / 10;
+  *p++ = '0' + point.minutes % 10;
+  for (uint8_t c = 0; c < 3; ++c) {
+    uint16_t level = point.level[c];
+    *p++ = ',';
+    if (level >= 10000) *p++ = '1';
+    if (level >= 1000) *p++ = '0' + level / 1000 % 10;
+    *p++ = '0' + level / 100 % 10;
+    *p++ = '.';
+    *p++ = '0' + level / 10 % 10;
+    *p++ = '0' + level % 10;
+  }
+  *p++ = '\n';
+  *p = '\0';
+  return p - out;
+}
+
+// ------------------------------------------------------------
+// Flash storage (two sectors, newest valid generation wins)
+// ------------------------------------------------------------
+constexpr uint16_t SCHEDULE_STORE_MAGIC = 0x5CED;
+constexpr uint32_t SCHEDULE_SECTOR_SIZE = 4096;
+
+struct ScheduleHeader {
+  uint16_t magic;
+  uint16_t count;       // 0: use the built-in schedule
+  uint32_t generation;  // increases with every save
+  uint32_t reserved;
+  uint32_t crc;         // over the fields above and the points
+};
+
+static_assert(sizeof(ScheduleHeader) == 16, "ScheduleHeader layout changed");
+
+// Flash: static read/write/erase like ConfigJournal (see config_journal.h)
+template <typename Flash, size_t MaxPoints>
+class ScheduleStore {
+  static_assert(sizeof(ScheduleHeader) + MaxPoints * sizeof(SchedulePoint) <= SCHEDULE_SECTOR_SIZE,
+                "schedule does not fit in one sector");
+
+ public:
+  // Uses the sector at firstSector and the one after it
+  explicit ScheduleStore(uint32_t firstSector) : first_(firstSector) {}
+
+  // Newest valid schedule; false when nothing (valid) was saved yet
+  bool load(SchedulePoint *points, size_t &count) {
+    ScheduleHeader headers[2];
+    bool present[2];
+    for (uint8_t i = 0; i < 2; ++i) present[i] = readHeader(i, headers[i]);
+
+    // Newest first; it can still be damaged (the CRC covers the points too)
+    uint8_t newest = present[1] && (!present[0] || headers[1].generation > headers[0].generation) ? 1 : 0;
+    for (uint8_t attempt = 0; attempt < 2; ++attempt) {
+      uint8_t sector = attempt == 0 ? newest : 1 - newest;
+      if (!present[sector]) continue;
+      const ScheduleHeader &header = headers[sector];
+      if (header.count > 0 &&
+          !Flash::read(sectorAddress(sector) + sizeof(ScheduleHeader), reinterpret_cast<uint32_t *>(points),
+                       header.count * sizeof(SchedulePoint))) {
+        continue;
+      }
+      if (headerCrc(header, points) != header.crc ||
+          (header.count > 0 && !schedulePointsValid(points, header.count))) {
+        continue;
+      }
+      count = header.count;
+      generation_ = header.generation;
+      current_ = sector;
+      return true;
+    }
+    return false;
+  }
+
+  // Save into the sector not holding the current schedule; count 0 records
+  // a return to the built-in schedule. points must be 4-byte aligned.
+  bool save(const SchedulePoint *points, size_t count) {
+    uint8_t sector = 1 - current_;
+    ScheduleHeader header = {SCHEDULE_STORE_MAGIC, static_cast<uint16_t>(count), generation_ + 1, 0xFFFFFFFF, 0};
+    header.crc = headerCrc(header, points);
+
+    uint32_t address = sectorAddress(sector);
+    if (!Flash::erase(address)) return false;
+    // Points first, header last: a torn save never has a valid header
+    if (count > 0 && !Flash::write(address + sizeof(ScheduleHeader),
+                                   reinterpret_cast<uint32_t *>(const_cast<SchedulePoint *>(points)),
+                                   count * sizeof(SchedulePoint))) {
+      return false;
+    }
+    if (!Flash::write(address, reinterpret_cast<uint32_t *>(&header), sizeof(header))) return false;
+
+    generation_ = header.generation;
+    current_ = sector;
+    return true;
+  }
+
+  uint32_t generation() const { return generation_; }
+
+ private:
+  uint32_t sectorAddress(uint8_t sector) const { return first_ + sector * SCHEDULE_SECTOR_SIZE; }
+
+  bool readHeader(uint8_t sector, ScheduleHeader &header) {
+    return Flash::read(sectorAddress(sector), reinterpret_cast<uint32_t *>(&header), sizeof(header)) &&
+           header.magic == SCHEDULE_STORE_MAGIC && header.count <= MaxPoints;
+  }
+
+  static uint32_t headerCrc(const ScheduleHeader &header, const SchedulePoint *points) {
+    uint32_t crc = crc32(reinterpret_cast<const uint8_t *>(&header), sizeof(header) - sizeof(header.crc));
+    return crc32(reinterpret_cast<const uint8_t *>(points), header.count * sizeof(SchedulePoint), crc);
+  }
+
+  uint32_t first_;
+  uint32_t generation_ = 0;
+  uint8_t current_ = 1;  // so the first save goes to sector 0
+};
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ------------------------------------------------------------
+// Cooperative task scheduler
+//
+// A fixed table of periodic and one-shot tasks, run from loop(). Deadlines
+// are 32-bit microsecond timestamps compared with wrap-safe subtraction, so
+// the micros() rollover every 71 minutes (and millis() after 49 days) is a
+// non-event; periods and delays must stay below 2^31 us (35 minutes).
+//
+// Periodic tasks keep their cadence: the next deadline is the previous one
+// plus the period, not "now" plus the period. A task that fell more than a
+// whole period behind skips the missed runs instead of running back to back.
+//
+// Every task keeps run count, run time and lateness (start minus deadline,
+// i.e. jitter) statistics.
+// ------------------------------------------------------------
+
+typedef int8_t TaskId;
+constexpr TaskId NO_TASK = -1;
+
+struct TaskStats {
+  uint32_t runs;
+  uint64_t totalUs;  // run time
+  uint32_t maxUs;
+  uint32_t lateUs;   // lateness of the last run
+  uint32_t maxLateUs;
+};
+
+// Signed distance from b to a; positive when a is later
+inline int32_t timeAfter(uint32_t a, uint32_t b) {
+  return static_cast<int32_t>(a - b);
+}
+
+template <uint8_t Capacity>
+class TaskScheduler {
+ public:
+  typedef void (*Callback)();
+  typedef uint32_t (*Clock)();  // microseconds
+
+  struct Task {
+    const __FlashStringHelper *name;
+    Callback callback;
+    uint32_t periodUs;  // 0: one-shot
+    uint32_t deadline;
+    bool armed;
+    TaskStats stats;
+  };
+
+  explicit TaskScheduler(Clock clock) : clock_(clock) {}
+
+  // Periodic task, first run one period from now (or when setRunning() arms it)
+  TaskId every(const __FlashStringHelper *name, uint32_t periodUs, Callback callback, bool armed = true) {
+    TaskId id = add(name, callback, periodUs);
+    if (id != NO_TASK && armed) schedule(id, periodUs);
+    return id;
+  }
+
+  // One-shot task, idle until schedule() arms it
+  TaskId once(const __FlashStringHelper *name, Callback callback) {
+    return add(name, callback, 0);
+  }
+
+  // Run delayUs from now; re-arming a pending task moves its deadline
+  void schedule(TaskId id, uint32_t delayUs) {
+    if (!valid(id)) return;
+    tasks_[id].deadline = clock_() + delayUs;
+    tasks_[id].armed = true;
+  }
+
+  void cancel(TaskId id) {
+    if (valid(id)) tasks_[id].armed = false;
+  }
+
+  // Arm or disarm a periodic task, keeping its cadence while it stays armed
+  void setRunning(TaskId id, bool running) {
+    if (!valid(id) || tasks_[id].armed == running) return;
+    if (running) {
+      schedule(id, tasks_[id].periodUs);
+    } else {
+      cancel(id);
+    }
+  }
+
+  bool pending(TaskId id) const { return valid(id) && tasks_[id].armed; }
+
+  // Run every task that is due; returns the number of tasks run
+  uint8_t run() {
+    uint8_t ran = 0;
+    for (uint8_t i = 0; i < count_; ++i) {
+      if (runIfDue(i)) ++ran;
+    }
+    return ran;
+  }
+
+  // Run one task if it is due, e.g. from inside a long handler so the
+  // tasks that cannot wait still keep their cadence
+  bool runIfDue(TaskId id) {
+    if (!valid(id)) return false;
+    Task &task = tasks_[id];
+    if (!task.armed) return false;
+    uint32_t start = clock_();
+    int32_t late = timeAfter(start, task.deadline);
+    if (late < 0) return false;
+
+    if (task.periodUs > 0) {
+      task.deadline += task.periodUs;
+      if (timeAfter(start, task.deadline) >= 0) task.deadline = start + task.periodUs;  // skip missed runs
+    } else {
+      task.armed = false;  // before the callback, which may re-arm it
+    }
+    task.callback();
+
+    uint32_t elapsed = clock_() - start;
+    TaskStats &stats = task.stats;
+    ++stats.runs;
+    stats.totalUs += elapsed;
+    if (elapsed > stats.maxUs) stats.maxUs = elapsed;
+    stats.lateUs = static_cast<uint32_t>(late);
+    if (stats.lateUs > stats.maxLateUs) stats.maxLateUs = stats.lateUs;
+    return true;
+  }
+
+  // Microseconds until the earliest deadline; 0 when something is due,
+  // maxUs when nothing is due sooner
+  uint32_t idleUs(uint32_t maxUs) const {
+    uint32_t now = clock_();
+    uint32_t idle = maxUs;
+    for (uint8_t i = 0; i < count_; ++i) {
+      if (!tasks_[i].armed) continue;
+      int32_t remaining = timeAfter(tasks_[i].deadline, now);
+      if (remaining <= 0) return 0;
+      if (static_cast<uint32_t>(remaining) < idle) idle = remaining;
+    }
+    return idle;
+  }
+
+  uint8_t size() const { return count_; }
+  const Task &task(uint8_t index) const { return tasks_[index]; }
+
+ private:
+  TaskId add(const __FlashStringHelper *name, Callback callback, uint32_t periodUs) {
+    if (count_ >= Capacity) return NO_TASK;
+    tasks_[count_] = {name, callback, periodUs, 0, false, {0, 0, 0, 0, 0}};
+    return count_++;
+  }
+
+  bool valid(TaskId id) const { return id >= 0 && id < count_; }
+
+  Clock clock_;
+  Task tasks_[Capacity];
+  uint8_t count_ = 0;
+};
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "daylight_curve.h"
+
+// ------------------------------------------------------------
+// Procedural weather: passing clouds and thunderstorms
+//
+// Layered on the schedule's output before it is corrected and written: clouds
+// dim all colors together for a while, a storm darkens the sky further and
+// adds lightning flashes.
+//
+// Everything is integer math on a counter-based PRNG: hash(seed, index)
+// instead of a generator with state, so any moment can be evaluated on its
+// own. The result is a pure function of seed, day and time of day; a skipped
+// frame changes nothing, a trace is repeatable and controllers locked by
+// fade sync with the same seed show the same sky.
+//
+// Cloud cover is 1D value noise over time: random values on a lattice of
+// WEATHER_CELL_MS, smoothstep-interpolated in Q16, summed over up to
+// WEATHER_MAX_OCTAVES octaves (each half the cell and half the weight) for
+// ragged edges. Where the noise exceeds a threshold the light dims, ramping
+// over WEATHER_EDGE of noise to WEATHER_CLOUD_DEPTH (WEATHER_STORM_DEPTH in
+// a storm); a cloud takes a few seconds to pass its edge. The threshold
+// comes from the noise's measured distribution, so the cover percentage is
+// about the share of the time spent under a cloud.
+//
+// Lightning: every WEATHER_FLASH_SLOT_MS slot of a storm holds a flash with
+// probability WEATHER_FLASH_CHANCE / 256, at a random offset and length,
+// sometimes with a weaker second stroke. A flash lifts every color to at
+// least its brightness.
+//
+// Cost and budget: the caller reports each frame's time with frameTime().
+// Over budget, the engine steps down one quality level (fewer octaves, then
+// re-using the cloud value for WEATHER_HOLD_FRAMES frames); after
+// WEATHER_RECOVER_FRAMES frames under half the budget it steps back up. The
+// sky then looks a little smoother, but the loop keeps its time.
+// ------------------------------------------------------------
+
+enum WeatherMode : uint8_t { WEATHER_OFF = 0, WEATHER_CLOUDS, WEATHER_STORM, WEATHER_MODE_COUNT };
+
+constexpr uint32_t WEATHER_CELL_MS = 20000;      // lattice spacing of the coarsest octave
+constexpr uint8_t WEATHER_MAX_OCTAVES = 3;
+constexpr uint16_t WEATHER_CLOUD_DEPTH = 36045;  // Q16, 55 % dimmer at full shade
+constexpr uint16_t WEATHER_STORM_DEPTH = 52429;  // Q16, 80 %
+constexpr uint8_t WEATHER_STORM_MIN_COVER = 70;  // percent
+constexpr uint32_t WEATHER_EDGE = 8192;          // Q16 noise from a cloud's edge to full shade
+constexpr uint32_t WEATHER_FLASH_SLOT_MS = 1000;
+constexpr uint8_t WEATHER_FLASH_CHANCE = 6;      // of 256 slots, about one flash every 40 s
+constexpr uint16_t WEATHER_FLASH_MIN_MS = 40;
+constexpr uint16_t WEATHER_FLASH_GAP_MS = 80;    // between the strokes of a double flash
+constexpr uint8_t WEATHER_QUALITY_LEVELS = WEATHER_MAX_OCTAVES + 1;
+constexpr uint8_t WEATHER_HOLD_FRAMES = 4;       // lowest quality: new cloud value every 4th frame
+constexpr uint16_t WEATHER_RECOVER_FRAMES = 500;
+
+static_assert(MS_PER_DAY % (WEATHER_CELL_MS >> (WEATHER_MAX_OCTAVES - 1)) == 0,
+              "every octave's cells must tile the day");
+static_assert(WEATHER_FLASH_SLOT_MS > 3 * (WEATHER_FLASH_MIN_MS + 63) + WEATHER_FLASH_GAP_MS,
+              "a double flash must fit in its slot");
+
+// Noise level exceeded for 0, 10, .. 100 % of the time (three octaves)
+constexpr uint32_t WEATHER_COVER_THRESHOLDS[11] = {
+  65536, 46902, 42508, 39002, 35820, 32744, 29649, 26456, 22966, 18567, 0,
+};
+
+struct WeatherStats {
+  uint32_t frames;
+  uint32_t overBudget;  // frames reported over budget
+  uint16_t downgrades;  // quality steps down
+  uint16_t shade;       // last cloud attenuation, Q16 (0 = clear)
+  uint32_t flashes;     // frames lit by lightning
+};
+
+// Counter-based PRNG: a well-mixed 32-bit hash (lowbias32) of seed and index
+inline uint32_t weatherHash(uint32_t seed, uint32_t index) {
+  uint32_t x = seed ^ (index * 0x9E3779B9u);
+  x ^= x >> 16;
+  x *= 0x7FEB352Du;
+  x ^= x >> 15;
+  x *= 0x846CA68Bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// 3f^2 - 2f^3 for f in Q16
+inline uint32_t weatherSmoothstep(uint32_t f) {
+  uint64_t f2 = static_cast<uint64_t>(f) * f;
+  return static_cast<uint32_t>((f2 * (3 * 65536 - 2 * f)) >> 32);
+}
+
+// One octave of value noise at msOfDay of the given day, Q16
+inline uint32_t weatherValueNoise(uint32_t seed, uint8_t octave, uint32_t day, uint32_t msOfDay) {
+  const uint32_t cellMs = WEATHER_CELL_MS >> octave;
+  const uint32_t cellsPerDay = MS_PER_DAY / cellMs;
+  uint32_t cell = day * cellsPerDay + msOfDay / cellMs;  // wraps after ~2700 years, harmlessly
+  uint32_t fraction = (msOfDay % cellMs) * 65536 / cellMs;
+  uint32_t octaveSeed = weatherHash(seed, octave);
+  int32_t a = static_cast<int32_t>(weatherHash(octaveSeed, cell) >> 16);
+  int32_t b = static_cast<int32_t>(weatherHash(octaveSeed, cell + 1) >> 16);
+  return static_cast<uint32_t>(a + ((static_cast<int64_t>(b - a) * weatherSmoothstep(fraction)) >> 16));
+}
+
+// Octaves summed with halving weights, normalized back to Q16
+inline uint32_t weatherCloudNoise(uint32_t seed, uint8_t octaves, uint32_t day, uint32_t msOfDay) {
+  uint32_t sum = 0;
+  uint32_t weights = 0;
+  for (uint8_t octave = 0; octave < octaves; ++octave) {
+    uint32_t weight = 256u >> octave;
+    sum += weatherValueNoise(seed, octave, day, msOfDay) * weight;
+    weights += weight;
+  }
+  return weights ? sum / weights : 0;
+}
+
+class WeatherEngine {
+ public:
+  // Off until configured; cover and seed are what switching it on uses
+  WeatherEngine(uint8_t coverPercent, uint32_t seed) { configure(WEATHER_OFF, coverPercent, seed); }
+
+  // coverPercent: share of the sky that may be clouded, 0 - 100
+  void configure(WeatherMode mode, uint8_t coverPercent, uint32_t seed) {
+    mode_ = mode < WEATHER_MODE_COUNT ? mode : WEATHER_OFF;
+    cover_ = coverPercent > 100 ? 100 : coverPercent;
+    seed_ = seed;
+    holdLeft_ = 0;
+  }
+
+  WeatherMode mode() const { return mode_; }
+  uint8_t cover() const { return cover_; }
+  uint32_t seed() const { return seed_; }
+  uint8_t quality() const { return quality_; }  // 0 = full detail
+  uint8_t octaves() const { return quality_ < WEATHER_MAX_OCTAVES ? WEATHER_MAX_OCTAVES - quality_ : 1; }
+  const WeatherStats &stats() const { return stats_; }
+
+  // Cloud attenuation in Q16 (0 = clear sky) from the given number of octaves
+  uint32_t shadeAt(uint32_t day, uint32_t msOfDay, uint8_t octaves) const {
+    uint8_t cover = mode_ == WEATHER_STORM && cover_ < WEATHER_STORM_MIN_COVER ? WEATHER_STORM_MIN_COVER : cover_;
+    if (mode_ == WEATHER_OFF || cover == 0) return 0;
+    uint32_t high = WEATHER_COVER_THRESHOLDS[cover / 10];
+    uint32_t low = WEATHER_COVER_THRESHOLDS[cover / 10 + (cover < 100 ? 1 : 0)];
+    uint32_t threshold = high - (high - low) * (cover % 10) / 10;
+    uint32_t noise = weatherCloudNoise(seed_, octaves, day, msOfDay);
+    if (noise <= threshold) return 0;
+    uint32_t thickness = noise - threshold >= WEATHER_EDGE ? 65536 : (noise - threshold) * 65536 / WEATHER_EDGE;
+    uint32_t depth = mode_ == WEATHER_STORM ? WEATHER_STORM_DEPTH : WEATHER_CLOUD_DEPTH;
+    return thickness * depth >> 16;
+  }
+
+  // Lightning brightness in Q16 (0 = none) at msOfDay
+  uint32_t flashAt(uint32_t day, uint32_t msOfDay) const {
+    if (mode_ != WEATHER_STORM) return 0;
+    const uint32_t slotsPerDay = MS_PER_DAY / WEATHER_FLASH_SLOT_MS;
+    uint32_t slot = msOfDay / WEATHER_FLASH_SLOT_MS;
+    uint32_t r = weatherHash(seed_ ^ 0xF1A5F1A5u, day * slotsPerDay + slot);
+    if ((r & 0xFF) >= WEATHER_FLASH_CHANCE) return 0;
+
+    uint32_t length = WEATHER_FLASH_MIN_MS + ((r >> 8) & 63);
+    uint32_t start = ((r >> 14) & 0x3FF) % (WEATHER_FLASH_SLOT_MS - 3 * length - WEATHER_FLASH_GAP_MS);
+    uint32_t brightness = 32768 + ((r >> 24) & 0x7F) * 256;  // 50 - 100 %
+    uint32_t offset = msOfDay % WEATHER_FLASH_SLOT_MS;
+    if (offset >= start && offset < start + length) return brightness;
+    uint32_t second = start + length + WEATHER_FLASH_GAP_MS;
+    if ((r & 0x80000000u) && offset >= second && offset < second + length / 2) return brightness / 2;
+    return 0;
+  }
+
+  // The schedule level with the weather applied; fullScale is the level's
+  // 100 % (PWM_MAX << DITHER_BITS)
+  PwmLevel apply(const PwmLevel &level, uint32_t day, uint32_t msOfDay, uint16_t fullScale) {
+    ++stats_.frames;
+    if (mode_ == WEATHER_OFF) return level;
+
+    if (quality_ < WEATHER_MAX_OCTAVES || holdLeft_ == 0) {
+      stats_.shade = static_cast<uint16_t>(shadeAt(day, msOfDay, octaves()));
+      holdLeft_ = quality_ < WEATHER_MAX_OCTAVES ? 0 : WEATHER_HOLD_FRAMES - 1;
+    } else {
+      --holdLeft_;
+    }
+    uint32_t keep = 65536 - stats_.shade;
+    PwmLevel out = {scale(level.red, keep), scale(level.green, keep), scale(level.blue, keep)};
+
+    uint32_t flash = flashAt(day, msOfDay);
+    if (flash > 0) {
+      uint16_t lit = scale(fullScale, flash);
+      if (out.red < lit) out.red = lit;
+      if (out.green < lit) out.green = lit;
+      if (out.blue < lit) out.blue = lit;
+      ++stats_.flashes;
+    }
+    return out;
+  }
+
+  // The frame's duration against its budget; steps the quality down when
+  // over, back up after a quiet stretch
+  void frameTime(uint32_t us, uint32_t budgetUs) {
+    if (us > budgetUs) {
+      ++stats_.overBudget;
+      calmFrames_ = 0;
+      if (quality_ + 1 < WEATHER_QUALITY_LEVELS) {
+        ++quality_;
+        ++stats_.downgrades;
+      }
+    } else if (us <= budgetUs / 2 && quality_ > 0 && ++calmFrames_ >= WEATHER_RECOVER_FRAMES) {
+      --quality_;
+      calmFrames_ = 0;
+    }
+  }
+
+ private:
+  static uint16_t scale(uint16_t value, uint32_t q16) {
+    return static_cast<uint16_t>(static_cast<uint32_t>(value) * q16 >> 16);
+  }
+
+  WeatherMode mode_ = WEATHER_OFF;
+  uint8_t cover_ = 0;
+  uint32_t seed_ = 0;
+  uint8_t quality_ = 0;
+  uint8_t holdLeft_ = 0;
+  uint16_t calmFrames_ = 0;
+  WeatherStats stats_ = {};
+};
@@ -0,0 +1,223 @@
+// HTTP load test for the control loop.
+//
+//   .pio/build/load/program [options]
+//
+// Runs the firmware's setup() against the stand-ins in host/ and lets
+// --clients browsers fetch --path over and over, each waiting --think-ms
+// after a page before the next. Every client's connection takes --rate
+// bytes per second (a phone on a weak link), so a response larger than the
+// socket's send buffer takes a while to leave.
+//
+// Time is virtual: a write that has to wait for the client advances the
+// clock, as the core's blocking write() holds the CPU. For every pass
+// through loop(), including the requests it answers, the test records the
+// time not spent idling in delay(): the longest anything periodic (fade,
+// dither) can be held up. It prints p50, p99 and the largest, with the
+// firmware's own fade lateness and stream counters from /metrics. Only
+// waiting is counted: the CPU time of handlers and tasks does not move the
+// virtual clock (bench/ measures that).
+//
+// Compare builds: the default streams the pages from a pool (see
+// include/response_stream.h); build_flags = -D RESPONSE_STREAMS=0 sends
+// them from the handler as before. Exit status: 0 after the run, 2 on
+// usage errors or when the firmware does not answer.
+
+#include <Arduino.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "host.h"
+
+// Firmware entry points and the idle counter (src/main.cpp)
+void setup();
+void loop();
+extern uint32_t idleMs;
+
+namespace {
+
+constexpr time_t LOAD_EPOCH = 1717243200;  // 2024-06-01 12:00 UTC, lights on and fading
+constexpr uint32_t SETTLE_LOOPS = 100;
+constexpr uint32_t RETRY_MS = 1000;        // Retry-After of a 503
+
+struct Options {
+  int clients = 4;
+  uint32_t rate = 20000;  // bytes per second per client
+  uint32_t seconds = 60;
+  uint32_t thinkMs = 500;
+  const char *path = "/";
+  uint32_t seed = 1;
+};
+
+struct Client {
+  std::shared_ptr<host::Connection> connection;  // while a response is being streamed
+  uint64_t nextUs = 0;                           // next request
+  uint64_t startUs = 0;
+};
+
+struct Totals {
+  uint32_t pages = 0;
+  uint32_t busy = 0;  // 503
+  uint64_t pageUs = 0;
+  uint64_t bytes = 0;
+};
+
+void usage(FILE *out) {
+  fprintf(out,
+          "usage: program [options]\n"
+          "  --clients N     concurrent browsers (default 4)\n"
+          "  --rate B        bytes per second each client takes, 0 = no limit (default 20000)\n"
+          "  --seconds S     simulated run time (default 60)\n"
+          "  --think-ms MS   pause between a client's pages (default 500)\n"
+          "  --path P        page to fetch (default /)\n"
+          "  --seed N        random seed for the clients' first requests (default 1)\n");
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (strcmp(arg, "--help") == 0) {
+      usage(stdout);
+      exit(0);
+    } else if (!value) {
+      fprintf(stderr, "unknown option or missing value: %s\n", arg);
+      return false;
+    } else if (strcmp(arg, "--clients") == 0) {
+      options.clients = atoi(value);
+    } else if (strcmp(arg, "--rate") == 0) {
+      options.rate = strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--seconds") == 0) {
+      options.seconds = strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--think-ms") == 0) {
+      options.thinkMs = strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--path") == 0) {
+      options.path = value;
+    } else if (strcmp(arg, "--seed") == 0) {
+      options.seed = strtoul(value, nullptr, 10);
+    } else {
+      fprintf(stderr, "unknown option: %s\n", arg);
+      return false;
+    }
+    ++i;
+  }
+  if (options.clients < 1 || options.seconds == 0) {
+    fprintf(stderr, "--clients and --seconds must be positive\n");
+    return false;
+  }
+  return true;
+}
+
+void finishPage(Client &client, uint64_t nowUs, const Options &options, Totals &totals) {
+  ++totals.pages;
+  totals.pageUs += nowUs - client.startUs;
+  client.nextUs = nowUs + options.thinkMs * 1000ull;
+}
+
+// Send the requests that are due. A blocking handler returns with the page
+// sent; a streamed one returns 0 (nothing sent through the server yet) and
+// the client waits for its connection to close.
+void dispatch(std::vector<Client> &clients, const Options &options, Totals &totals) {
+  for (Client &client : clients) {
+    if (client.connection) {
+      if (client.connection->open) continue;
+      totals.bytes += client.connection->bytes;
+      client.connection.reset();
+      finishPage(client, host::nowMicros(), options, totals);
+      continue;
+    }
+    if (host::nowMicros() < client.nextUs) continue;
+
+    client.startUs = host::nowMicros();
+    int code = host::request(HTTP_GET, options.path);
+    if (code == 503) {
+      ++totals.busy;
+      client.nextUs = host::nowMicros() + RETRY_MS * 1000ull;
+    } else if (code == 0) {
+      client.connection = host::lastConnection();
+    } else {
+      totals.bytes += host::lastConnection()->bytes;
+      finishPage(client, host::nowMicros(), options, totals);
+    }
+  }
+}
+
+uint32_t percentile(const std::vector<uint32_t> &sorted, double fraction) {
+  if (sorted.empty()) return 0;
+  size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+  return sorted[index];
+}
+
+// A sample's value from /metrics ("name{labels} value"), or -1
+double metric(const char *series) {
+  const std::string &body = host::responseBody();
+  size_t at = body.find(series);
+  if (at == std::string::npos) return -1;
+  return atof(body.c_str() + at + strlen(series) + 1);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    usage(stderr);
+    return 2;
+  }
+
+  setup();
+  host::syncTime(LOAD_EPOCH);
+  host::setClientRate(0);
+  if (host::request(HTTP_POST, "/mode", "auto=1") != 200) {
+    fprintf(stderr, "/mode: %d\n", host::request(HTTP_POST, "/mode", "auto=1"));
+    return 2;
+  }
+  for (uint32_t i = 0; i < SETTLE_LOOPS; ++i) loop();  // connect, start tasks
+  host::setClientRate(options.rate);
+
+  std::mt19937 random(options.seed);
+  std::uniform_int_distribution<uint32_t> firstRequest(0, options.thinkMs * 1000);
+  std::vector<Client> clients(options.clients);
+  uint64_t startUs = host::nowMicros();
+  for (Client &client : clients) client.nextUs = startUs + firstRequest(random);
+
+  Totals totals;
+  std::vector<uint32_t> busyUs;
+  uint64_t endUs = startUs + options.seconds * 1000000ull;
+  while (host::nowMicros() < endUs) {
+    uint64_t passStart = host::nowMicros();
+    uint32_t idleBefore = idleMs;
+    dispatch(clients, options, totals);
+    loop();
+    uint64_t idleUs = static_cast<uint64_t>(idleMs - idleBefore) * 1000;
+    busyUs.push_back(static_cast<uint32_t>(host::nowMicros() - passStart - idleUs));
+  }
+
+  host::setClientRate(0);
+  if (host::request(HTTP_GET, "/metrics") != 200) {
+    fprintf(stderr, "/metrics did not answer\n");
+    return 2;
+  }
+  std::sort(busyUs.begin(), busyUs.end());
+  printf("%d clients at %u B/s fetching %s for %u s, think %u ms\n", options.clients, options.rate, options.path,
+         options.seconds, options.thinkMs);
+  printf("loop passes   %zu\n", busyUs.size());
+  printf("busy p50      %.3f ms\n", percentile(busyUs, 0.50) / 1000.0);
+  printf("busy p99      %.3f ms\n", percentile(busyUs, 0.99) / 1000.0);
+  printf("busy max      %.3f ms\n", busyUs.empty() ? 0 : busyUs.back() / 1000.0);
+  printf("fade late max %.3f ms\n", metric("aquarium_task_late_max_seconds{task=\"fade\"}") * 1000);
+  printf("pages         %u (%.1f KB), mean %.0f ms each\n", totals.pages, totals.bytes / 1024.0,
+         totals.pages ? totals.pageUs / 1000.0 / totals.pages : 0);
+  printf("503 busy      %u\n", totals.busy);
+  printf("streams       completed %.0f, stalled %.0f, dropped %.0f\n",
+         metric("aquarium_http_streams_total{outcome=\"completed\"}"),
+         metric("aquarium_http_streams_total{outcome=\"stalled\"}"),
+         metric("aquarium_http_streams_total{outcome=\"dropped\"}"));
+  return 0;
+}
@@ -0,0 +1,369 @@
+// Time-accelerated daylight simulator.
+//
+//   .pio/build/sim/program [options] > day.trace
+//   .pio/build/sim/program --diff before.trace after.trace
+//
+// Runs the firmware's setup() against the stand-ins in host/, then steps
+// the virtual clock through one or more days, calling updateAutoMode() at
+// every step and recording the PWM count of every channel pin. A month at
+// one-second steps takes well under a second.
+//
+// Dithering is switched off (through /dither, as a user would) so each
+// sample is the count the fade engine settled on, the "raw" value /state
+// reports. With --dither every sample is one modulator frame instead, which
+// also exposes differences below one count.
+//
+// --weather takes the query of POST /weather (e.g. mode=storm&seed=7); the
+// weather is a function of seed and time, so its traces repeat exactly too.
+//
+// Traces are compared with --diff; run it on traces from two builds, or
+// from the same build with two --schedule files. Exit status: 0 identical,
+// 1 different, 2 usage or input error.
+
+#include <Arduino.h>
+
+#include "host.h"
+
+// Firmware entry points (src/main.cpp)
+void setup();
+void updateAutoMode();
+
+namespace {
+
+constexpr uint8_t CHANNELS = 3;
+constexpr uint64_t MS_PER_DAY = 86400000;
+constexpr char TRACE_MAGIC[4] = {'A', 'Q', 'T', 'R'};
+constexpr uint16_t TRACE_VERSION = 1;
+constexpr uint32_t SETTLE_MS = 10000;  // lets the schedule activation blend finish before the first sample
+
+// ------------------------------------------------------------
+// Trace format
+//
+// Binary (default), little-endian:
+//   "AQTR", u16 version, u16 channels, u32 step ms, i64 start epoch,
+//   u32 samples, then samples x channels u16 PWM counts
+// CSV (--csv): epoch,local,gpioN,... one row per sample
+// ------------------------------------------------------------
+struct TraceHeader {
+  uint16_t channels;
+  uint32_t stepMs;
+  int64_t startEpoch;
+  uint32_t samples;
+};
+
+struct Trace {
+  TraceHeader header;
+  std::string values;  // samples x channels u16, as stored in the file
+};
+
+void putLittle(FILE *out, uint64_t value, uint8_t bytes) {
+  for (uint8_t i = 0; i < bytes; ++i) fputc(static_cast<int>((value >> (8 * i)) & 0xFF), out);
+}
+
+uint64_t getLittle(const std::string &data, size_t &offset, uint8_t bytes) {
+  uint64_t value = 0;
+  for (uint8_t i = 0; i < bytes; ++i) value |= static_cast<uint64_t>(static_cast<uint8_t>(data[offset + i])) << (8 * i);
+  offset += bytes;
+  return value;
+}
+
+void writeBinaryHeader(FILE *out, const TraceHeader &header) {
+  fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), out);
+  putLittle(out, TRACE_VERSION, 2);
+  putLittle(out, header.channels, 2);
+  putLittle(out, header.stepMs, 4);
+  putLittle(out, static_cast<uint64_t>(header.startEpoch), 8);
+  putLittle(out, header.samples, 4);
+}
+
+uint8_t channelPins[CHANNELS];
+
+// Pins as the firmware reports them in /state
+bool readChannelPins() {
+  host::request(HTTP_GET, "/state");
+  const char *p = host::responseBody().c_str();
+  for (uint8_t i = 0; i < CHANNELS; ++i) {
+    p = strstr(p, "\"pin\":");
+    if (!p) return false;
+    p += 6;
+    channelPins[i] = static_cast<uint8_t>(atoi(p));
+  }
+  return true;
+}
+
+void writeCsvHeader(FILE *out) {
+  fputs("epoch,local", out);
+  for (uint8_t pin : channelPins) fprintf(out, ",gpio%u", pin);
+  fputc('\n', out);
+}
+
+void writeCsvRow(FILE *out, int64_t epochMs, const uint16_t *counts) {
+  time_t epoch = static_cast<time_t>(epochMs / 1000);
+  struct tm local;
+  localtime_r(&epoch, &local);
+  char text[32];
+  strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+  char zone[8];
+  strftime(zone, sizeof(zone), "%Z", &local);
+  unsigned ms = static_cast<unsigned>(epochMs % 1000);
+  fprintf(out, "%lld.%03u,%s.%03u %s", static_cast<long long>(epoch), ms, text, ms, zone);
+  for (uint8_t i = 0; i < CHANNELS; ++i) fprintf(out, ",%u", counts[i]);
+  fputc('\n', out);
+}
+
+bool readFile(const char *path, std::string &data) {
+  FILE *in = fopen(path, "rb");
+  if (!in) return false;
+  char buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), in)) > 0) data.append(buffer, length);
+  fclose(in);
+  return true;
+}
+
+bool readTrace(const char *path, Trace &trace) {
+  std::string data;
+  if (!readFile(path, data)) {
+    fprintf(stderr, "%s: cannot read\n", path);
+    return false;
+  }
+  constexpr size_t HEADER_BYTES = 24;
+  if (data.size() < HEADER_BYTES || data.compare(0, 4, TRACE_MAGIC, 4) != 0) {
+    fprintf(stderr, "%s: not a binary trace (CSV traces cannot be diffed)\n", path);
+    return false;
+  }
+  size_t offset = 4;
+  if (getLittle(data, offset, 2) != TRACE_VERSION) {
+    fprintf(stderr, "%s: unsupported trace version\n", path);
+    return false;
+  }
+  trace.header.channels = static_cast<uint16_t>(getLittle(data, offset, 2));
+  trace.header.stepMs = static_cast<uint32_t>(getLittle(data, offset, 4));
+  trace.header.startEpoch = static_cast<int64_t>(getLittle(data, offset, 8));
+  trace.header.samples = static_cast<uint32_t>(getLittle(data, offset, 4));
+  if (data.size() - HEADER_BYTES != static_cast<size_t>(trace.header.samples) * trace.header.channels * 2) {
+    fprintf(stderr, "%s: truncated trace\n", path);
+    return false;
+  }
+  trace.values = data.substr(HEADER_BYTES);
+  return true;
+}
+
+uint16_t traceValue(const Trace &trace, uint32_t sample, uint16_t channel) {
+  size_t offset = (static_cast<size_t>(sample) * trace.header.channels + channel) * 2;
+  return static_cast<uint16_t>(getLittle(trace.values, offset, 2));
+}
+
+// ------------------------------------------------------------
+// Diff mode
+// ------------------------------------------------------------
+int diffTraces(const char *pathA, const char *pathB) {
+  Trace a, b;
+  if (!readTrace(pathA, a) || !readTrace(pathB, b)) return 2;
+  if (a.header.channels != b.header.channels || a.header.stepMs != b.header.stepMs ||
+      a.header.startEpoch != b.header.startEpoch) {
+    fprintf(stderr, "traces cover different runs (start, step or channels differ)\n");
+    return 2;
+  }
+
+  uint32_t samples = min(a.header.samples, b.header.samples);
+  uint32_t differing = 0;
+  int64_t firstDifference = -1;
+  int maxDelta[16] = {0};
+  for (uint32_t s = 0; s < samples; ++s) {
+    bool differs = false;
+    for (uint16_t c = 0; c < a.header.channels && c < 16; ++c) {
+      int delta = abs(static_cast<int>(traceValue(a, s, c)) - traceValue(b, s, c));
+      if (delta > maxDelta[c]) maxDelta[c] = delta;
+      differs |= delta != 0;
+    }
+    if (differs) {
+      if (firstDifference < 0) firstDifference = s;
+      ++differing;
+    }
+  }
+
+  printf("samples: %u compared", samples);
+  if (a.header.samples != b.header.samples) printf(" (lengths %u vs %u)", a.header.samples, b.header.samples);
+  printf(", %u differ\n", differing);
+  if (firstDifference >= 0) {
+    int64_t epochMs = a.header.startEpoch * 1000 + firstDifference * a.header.stepMs;
+    uint16_t first[16], second[16];
+    for (uint16_t c = 0; c < a.header.channels && c < 16; ++c) {
+      first[c] = traceValue(a, static_cast<uint32_t>(firstDifference), c);
+      second[c] = traceValue(b, static_cast<uint32_t>(firstDifference), c);
+    }
+    printf("first difference at sample %lld:\n  ", static_cast<long long>(firstDifference));
+    writeCsvRow(stdout, epochMs, first);
+    printf("  ");
+    writeCsvRow(stdout, epochMs, second);
+    printf("max delta per channel:");
+    for (uint16_t c = 0; c < a.header.channels && c < 16; ++c) printf(" %d", maxDelta[c]);
+    printf("\n");
+  }
+  return differing == 0 && a.header.samples == b.header.samples ? 0 : 1;
+}
+
+// ------------------------------------------------------------
+// Simulation
+// ------------------------------------------------------------
+struct Options {
+  const char *start = "2024-06-21";
+  uint32_t days = 1;
+  uint32_t stepMs = 1000;
+  const char *tz = nullptr;  // POSIX TZ; default: the firmware's configTime() offsets
+  const char *schedule = nullptr;
+  const char *output = nullptr;
+  const char *map = "red,green,blue";
+  const char *weather = nullptr;  // query for /weather
+  bool csv = false;
+  bool dither = false;
+};
+
+void usage() {
+  fprintf(stderr,
+          "usage: program [--start YYYY-MM-DD] [--days N] [--step-ms N] [--tz POSIX-TZ]\n"
+          "               [--schedule FILE.csv] [--map red,green,blue] [--weather mode=clouds&cover=40&seed=1]\n"
+          "               [--dither] [--csv] [-o FILE]\n"
+          "       program --diff A.trace B.trace\n"
+          "example: --days 31 --start 2024-03-15 --tz CET-1CEST,M3.5.0,M10.5.0/3\n");
+}
+
+bool parseUnsigned(const char *text, uint32_t &value) {
+  char *end;
+  unsigned long parsed = strtoul(text, &end, 10);
+  if (*text == '\0' || *end != '\0' || parsed == 0 || parsed > 0xFFFFFFFFul) return false;
+  value = static_cast<uint32_t>(parsed);
+  return true;
+}
+
+// Local midnight of date in the current TZ
+bool parseStart(const char *date, time_t &epoch) {
+  struct tm local = {};
+  if (sscanf(date, "%d-%d-%d", &local.tm_year, &local.tm_mon, &local.tm_mday) != 3) return false;
+  local.tm_year -= 1900;
+  local.tm_mon -= 1;
+  local.tm_isdst = -1;
+  epoch = mktime(&local);
+  return epoch != static_cast<time_t>(-1);
+}
+
+bool expectOk(int code, const char *what) {
+  if (code == 200) return true;
+  fprintf(stderr, "%s: %d %s\n", what, code, host::responseBody().c_str());
+  return false;
+}
+
+// Channel colors, the schedule and the weather go through the firmware's own routes
+bool configure(const Options &options) {
+  char query[32];
+  const char *color = options.map;
+  for (uint8_t i = 0; i < CHANNELS && *color; ++i) {
+    size_t length = strcspn(color, ",");
+    snprintf(query, sizeof(query), "channel=%u&color=%.*s", i, static_cast<int>(length), color);
+    if (!expectOk(host::request(HTTP_POST, "/assign", query), "--map")) return false;
+    color += length + (color[length] == ',');
+  }
+
+  if (options.schedule) {
+    std::string body;
+    if (!readFile(options.schedule, body)) {
+      fprintf(stderr, "%s: cannot read\n", options.schedule);
+      return false;
+    }
+    if (!expectOk(host::request(HTTP_POST, "/schedule", nullptr, body.c_str()), options.schedule)) return false;
+  }
+
+  if (options.weather && !expectOk(host::request(HTTP_POST, "/weather", options.weather), "--weather")) return false;
+  if (!options.dither && !expectOk(host::request(HTTP_POST, "/dither", "enabled=0"), "/dither")) return false;
+  return expectOk(host::request(HTTP_POST, "/mode", "auto=1"), "/mode");
+}
+
+int simulate(const Options &options) {
+  setup();
+  if (options.tz) {
+    setenv("TZ", options.tz, 1);
+    tzset();
+  }
+  time_t start;
+  if (!parseStart(options.start, start)) {
+    fprintf(stderr, "--start: expected YYYY-MM-DD\n");
+    return 2;
+  }
+  if (!configure(options) || !readChannelPins()) return 2;
+  host::advanceMicros(SETTLE_MS * 1000ull);
+
+  FILE *out = options.output ? fopen(options.output, "wb") : stdout;
+  if (!out) {
+    fprintf(stderr, "%s: cannot write\n", options.output);
+    return 2;
+  }
+
+  uint64_t durationMs = static_cast<uint64_t>(options.days) * MS_PER_DAY;
+  TraceHeader header = {CHANNELS, options.stepMs, static_cast<int64_t>(start),
+                        static_cast<uint32_t>(durationMs / options.stepMs)};
+  if (options.csv) {
+    writeCsvHeader(out);
+  } else {
+    writeBinaryHeader(out, header);
+  }
+
+  host::setEpoch(start);
+  uint64_t startUs = host::nowMicros();
+  uint16_t counts[CHANNELS];
+  for (uint32_t sample = 0; sample < header.samples; ++sample) {
+    uint64_t offsetUs = static_cast<uint64_t>(sample) * options.stepMs * 1000;
+    host::advanceMicros(startUs + offsetUs - host::nowMicros());
+    updateAutoMode();
+
+    for (uint8_t i = 0; i < CHANNELS; ++i) counts[i] = static_cast<uint16_t>(max(host::pwmValue(channelPins[i]), 0));
+    if (options.csv) {
+      writeCsvRow(out, static_cast<int64_t>(start) * 1000 + static_cast<int64_t>(offsetUs / 1000), counts);
+    } else {
+      for (uint16_t count : counts) putLittle(out, count, 2);
+    }
+  }
+
+  if (out != stdout) fclose(out);
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(arg, "--help") == 0) {
+      usage();
+      return 0;
+    } else if (strcmp(arg, "--diff") == 0 && i + 2 < argc) {
+      return diffTraces(argv[i + 1], argv[i + 2]);
+    } else if (strcmp(arg, "--csv") == 0) {
+      options.csv = true;
+    } else if (strcmp(arg, "--dither") == 0) {
+      options.dither = true;
+    } else if (strcmp(arg, "--start") == 0 && hasValue) {
+      options.start = argv[++i];
+    } else if (strcmp(arg, "--days") == 0 && hasValue && parseUnsigned(argv[i + 1], options.days)) {
+      ++i;
+    } else if (strcmp(arg, "--step-ms") == 0 && hasValue && parseUnsigned(argv[i + 1], options.stepMs)) {
+      ++i;
+    } else if (strcmp(arg, "--tz") == 0 && hasValue) {
+      options.tz = argv[++i];
+    } else if (strcmp(arg, "--schedule") == 0 && hasValue) {
+      options.schedule = argv[++i];
+    } else if (strcmp(arg, "--map") == 0 && hasValue) {
+      options.map = argv[++i];
+    } else if (strcmp(arg, "--weather") == 0 && hasValue) {
+      options.weather = argv[++i];
+    } else if (strcmp(arg, "-o") == 0 && hasValue) {
+      options.output = argv[++i];
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  return simulate(options);
+}
@@ -3,11 +3,32 @@
 #include <ESP8266WebServer.h>
 #include <ESP8266mDNS.h>
 #include <WiFiUdp.h>
+#include <Wire.h>
 #include <ArduinoOTA.h>
 #include <Updater.h>
+#include <coredecls.h>
 
+#include <sys/time.h>
 #include <time.h>
 
+#include "astro.h"
+#include "command_log.h"
+#include "config_journal.h"
+#include "crossfade.h"
+#include "daylight_curve.h"
+#include "dither.h"
+#include "fade_sync.h"
+#include "json_writer.h"
+#include "metrics.h"
+#include "output_driver.h"
+#include "perceptual_curve.h"
+#include "response_stream.h"
+#include "rtc_state.h"
+#include "schedule_store.h"
+#include "task_scheduler.h"
+#include "web_assets.h"
+#include "weather.h"
+
 // ------------------------------------------------------------
 // WiFi & OTA configuration (update these to match your network)
 // ------------------------------------------------------------
@@ -17,13 +38,108 @@ const char *password = "appelsap";
 const char *otaHostname = "aquarium-esp01";
 
 // ------------------------------------------------------------
-// GPIO configuration - ESP-01 has GPIO0, GPIO2 and GPIO1 (TX) / GPIO3 (RX)
-// Update the third entry if you wired RX instead of TX.
+// Outputs (see output_driver.h)
+//
+// OUTPUT_NATIVE drives the ESP-01's own pins: GPIO0, GPIO2 and GPIO1 (TX) /
+// GPIO3 (RX); update the third entry of channelPins if you wired RX instead
+// of TX. OUTPUT_PCA9685 drives up to 16 channels on a PCA9685 expander with
+// SDA on GPIO0 and SCL on GPIO2, e.g. for extra white, UV or royal blue
+// strips: -D OUTPUT_DRIVER=OUTPUT_PCA9685 -D OUTPUT_CHANNELS=8. Every channel
+// follows one LED color of the schedule (see /assign).
 // ------------------------------------------------------------
+#define OUTPUT_NATIVE 0
+#define OUTPUT_PCA9685 1
+#ifndef OUTPUT_DRIVER
+#define OUTPUT_DRIVER OUTPUT_NATIVE
+#endif
+#ifndef OUTPUT_CHANNELS
+#define OUTPUT_CHANNELS 3
+#endif
+#ifndef PCA9685_ADDRESS
+#define PCA9685_ADDRESS 0x40
+#endif
+static_assert(OUTPUT_CHANNELS <= CONFIG_MAX_CHANNELS, "more channels than the settings journal stores");
+
 const uint8_t channelPins[3] = {0, 2, 3};  // GPIO0, GPIO2, GPIO1(TX)
+constexpr uint8_t I2C_SDA_PIN = 0;
+constexpr uint8_t I2C_SCL_PIN = 2;
+constexpr uint32_t I2C_CLOCK_HZ = 400000;
+constexpr uint32_t PCA9685_CHANNEL_US = 90;  // 4 bytes of a transfer at 400 kHz
 
-// PWM configuration
+// PWM configuration: levels are computed in PWM_MAX steps (plus
+// DITHER_BITS of fraction) whatever the driver's own resolution
 constexpr uint16_t PWM_MAX = 1023;
+constexpr uint32_t PWM_FREQUENCY_HZ = 1000;
+
+// The ESP-01's own pins, at PWM_MAX resolution
+struct NativePwm {
+  static constexpr uint8_t MAX_CHANNELS = sizeof(channelPins);
+  static constexpr uint16_t MAX_COUNT = PWM_MAX;
+  static constexpr bool MERGE_GAPS = false;
+
+  bool write(uint8_t first, const uint16_t *counts, uint8_t count) {
+    for (uint8_t i = 0; i < count; ++i) analogWrite(channelPins[first + i], counts[i]);
+    return true;
+  }
+
+  bool verify() { return true; }  // pins keep their mode and value
+};
+
+#if OUTPUT_DRIVER == OUTPUT_PCA9685
+typedef Pca9685<TwoWire> OutputBackend;
+OutputBackend outputBackend(Wire, PCA9685_ADDRESS);
+#else
+typedef NativePwm OutputBackend;
+OutputBackend outputBackend;
+#endif
+OutputDriver<OUTPUT_CHANNELS, OutputBackend> outputs(outputBackend);
+
+// Default perceptual correction applied to every color (see perceptual_curve.h).
+// Override with -D PERCEPTUAL_CURVE=CURVE_CIE1931 etc.; change at runtime via /curve.
+#ifndef PERCEPTUAL_CURVE
+#define PERCEPTUAL_CURVE CURVE_LINEAR
+#endif
+
+// Fade engine: auto mode is re-evaluated at this rate (50 - 100 Hz) with
+// millisecond resolution. Override with -D FADE_TICK_HZ=... in platformio.ini.
+#ifndef FADE_TICK_HZ
+#define FADE_TICK_HZ 100
+#endif
+static_assert(FADE_TICK_HZ >= 50 && FADE_TICK_HZ <= 100, "FADE_TICK_HZ must be within 50 - 100");
+constexpr unsigned long FADE_TICK_MS = 1000 / FADE_TICK_HZ;
+// Per tick, keeps handleClient() responsive; an I2C expander adds its transfer
+constexpr uint32_t FADE_TICK_BUDGET_US =
+    250 + (OUTPUT_DRIVER == OUTPUT_PCA9685 ? OUTPUT_CHANNELS * PCA9685_CHANNEL_US : 0);
+
+// Temporal dithering: frames per second of the sigma-delta modulator (see
+// dither.h). Must stay below the 1 kHz PWM frequency; 0 disables it at build time.
+// The PCA9685 takes two of the fraction bits directly in its 12-bit counts,
+// and a bus transfer per frame would not fit anyway, so it does without.
+#ifndef DITHER_HZ
+#if OUTPUT_DRIVER == OUTPUT_PCA9685
+#define DITHER_HZ 0
+#else
+#define DITHER_HZ 500
+#endif
+#endif
+static_assert(DITHER_HZ <= PWM_FREQUENCY_HZ, "DITHER_HZ must not exceed the PWM frequency");
+static_assert(DITHER_HZ == 0 || OUTPUT_DRIVER == OUTPUT_NATIVE, "dithering needs the native outputs");
+constexpr uint32_t DITHER_FRAME_US = DITHER_HZ > 0 ? 1000000UL / DITHER_HZ : 0;
+constexpr uint32_t DITHER_BUDGET_US = 60;  // per frame
+
+// Fade synchronization with other controllers on the LAN (see fade_sync.h).
+// Controllers only lock to the same FADE_SYNC_GROUP; -D FADE_SYNC=0 leaves
+// the multicast socket out.
+#ifndef FADE_SYNC
+#define FADE_SYNC 1
+#endif
+#ifndef FADE_SYNC_GROUP
+#define FADE_SYNC_GROUP 0
+#endif
+constexpr uint8_t SYNC_MULTICAST_IP[4] = {239, 255, 72, 81};
+constexpr uint16_t SYNC_PORT = 4681;
+constexpr unsigned long SYNC_POLL_MS = 20;   // receive delay adds to the error, the filter smooths it
+constexpr uint8_t SYNC_MAX_PACKETS = 4;      // read per poll, a flood cannot stall the loop
 
 enum ChannelColor : uint8_t {
   COLOR_UNKNOWN = 0,
@@ -34,31 +150,48 @@ enum ChannelColor : uint8_t {
 
 struct ChannelState {
   ChannelColor mappedColor;
-  uint16_t rawValue;  // 0 - PWM_MAX
+  uint16_t target;       // 0 - PWM_MAX << DITHER_BITS, after perceptual correction
+  uint8_t ditherAccumulator;
 };
 
-ChannelState channels[3] = {
-  {COLOR_UNKNOWN, 0},
-  {COLOR_UNKNOWN, 0},
-  {COLOR_UNKNOWN, 0}
+ChannelState channels[OUTPUT_CHANNELS] = {};  // COLOR_UNKNOWN, off
+
+RGBLevel manualLevel = {0.0f, 0.0f, 0.0f};
+
+// Scene presets: named manual levels (per mille, as the settings store
+// them) with a fade time that suits each. POST /scene switches to manual
+// mode with the preset's levels; /state names the preset while the manual
+// levels still match it.
+struct ScenePreset {
+  char name[12];
+  uint16_t level[3];     // red, green, blue, 0 - 1000
+  uint16_t fadeSeconds;  // unless the request gives ?fade=<ms>
 };
 
-struct RGBLevel {
-  float red;    // 0.0 - 1.0
-  float green;  // 0.0 - 1.0
-  float blue;   // 0.0 - 1.0
+const ScenePreset scenePresets[] PROGMEM = {
+  {"feeding",     { 600,  550,  500},  5},  // bright and neutral, the food is easy to follow
+  {"viewing",     { 700,  750, 1000}, 10},  // cool white with extra blue, colors stand out
+  {"moonlight",   {   0,   20,   80}, 60},  // a faint blue, reached slowly
+  {"maintenance", {1000, 1000, 1000},  2},  // full light for work in the tank
 };
 
-RGBLevel manualLevel = {0.0f, 0.0f, 0.0f};
-RGBLevel autoLevel = {0.0f, 0.0f, 0.0f};
+constexpr uint8_t SCENE_COUNT = sizeof(scenePresets) / sizeof(scenePresets[0]);
 
-// Daylight simulation schedule (times in minutes since midnight)
-struct DayPhase {
-  uint16_t minutes;
-  RGBLevel level;
-};
+// Every change of what the LEDs show (mode, manual levels, scenes, the first
+// light after boot) crossfades over this long (see crossfade.h); requests
+// may pass their own ?fade=<ms>, 0 switches at once.
+#ifndef TRANSITION_MS
+#define TRANSITION_MS 3000
+#endif
 
-const DayPhase daylightSchedule[] = {
+LevelCrossfade transition;
+PwmLevel shownLevel = {0, 0, 0};  // last level written, before correction
+PwmLevel wantedLevel = {0, 0, 0}; // what shownLevel arrives at when the crossfade ends
+bool waitingForClock = false;     // auto mode is dark until the clock is set
+
+// Built-in daylight schedule (times in minutes since midnight), used until
+// one is uploaded with POST /schedule
+constexpr DayPhase daylightSchedule[] = {
   {  0, {0.00f, 0.00f, 0.00f}},  // 00:00 - lights off
   {360, {0.05f, 0.02f, 0.01f}},  // 06:00 - dawn
   {450, {0.35f, 0.25f, 0.20f}},  // 07:30 - sunrise ramp
@@ -70,41 +203,302 @@ const DayPhase daylightSchedule[] = {
 
 constexpr size_t daylightScheduleSize = sizeof(daylightSchedule) / sizeof(daylightSchedule[0]);
 
+static_assert(scheduleIsSorted(daylightSchedule),
+              "daylightSchedule: minutes must be strictly increasing and below 1440");
+static_assert(scheduleLevelsInRange(daylightSchedule),
+              "daylightSchedule: levels must be within 0.0 - 1.0");
+
+// Compact version of the schedule, as uploads are stored
+constexpr SchedulePoints<daylightScheduleSize> defaultSchedule = toSchedulePoints(daylightSchedule);
+
+static_assert(curveMatchesFloatPath<PWM_MAX>(daylightSchedule, defaultSchedule),
+              "defaultSchedule deviates more than one PWM count from the float schedule");
+
+// Active schedule: the built-in one or an upload. Uploads are parsed into the
+// buffer not in use and only swapped in once valid and saved.
+constexpr size_t SCHEDULE_MAX_POINTS = 288;        // 5-minute resolution over a day
+constexpr unsigned long SCHEDULE_BLEND_MS = 2000;  // crossfade to a new schedule
+
+alignas(4) SchedulePoint scheduleBuffers[2][SCHEDULE_MAX_POINTS];
+const SchedulePoint *schedulePoints = defaultSchedule.points;
+size_t schedulePointCount = daylightScheduleSize;
+ScheduleCursor scheduleCursor;
+
+// The schedule from flash (upload or built-in); active unless astro mode is on
+const SchedulePoint *storedPoints = defaultSchedule.points;
+size_t storedPointCount = daylightScheduleSize;
+
+// Astronomical mode (see astro.h): the day's curve follows sunrise, sunset
+// and moon phase at this location. It is rebuilt into astroPoints once a
+// day and after the clock is set; the fade engine evaluates it like any
+// other schedule. Location via POST /astro or -D ASTRO_LATITUDE/LONGITUDE.
+#ifndef ASTRO_LATITUDE
+#define ASTRO_LATITUDE 52.09
+#endif
+#ifndef ASTRO_LONGITUDE
+#define ASTRO_LONGITUDE 5.12
+#endif
+constexpr unsigned long ASTRO_CHECK_MS = 60000;  // how soon a new day is noticed
+
+constexpr int32_t degreesToE4(double degrees) {
+  return static_cast<int32_t>(degrees * 10000 + (degrees >= 0 ? 0.5 : -0.5));
+}
+
+// Levels per phase of the day, as the built-in schedule's
+constexpr AstroLevels astroLevels = {
+  { 500,  200,  100},  // sunrise
+  {3500, 2500, 2000},  // morning
+  {8000, 8000, 8500},  // solar noon
+  {4500, 3500, 3000},  // afternoon
+  {2500, 1000,  500},  // sunset
+  {   0,  100,  400},  // full moon, a faint blue
+};
+
+bool astroEnabled = false;
+int32_t astroLatitude = degreesToE4(ASTRO_LATITUDE);
+int32_t astroLongitude = degreesToE4(ASTRO_LONGITUDE);
+AstroDay astroDay = {-1, -1, 0, 0};
+int32_t astroBuiltDay = -1;  // local date astroPoints were built for, -1 = none
+uint32_t astroBuildUs = 0;
+SchedulePoint astroPoints[ASTRO_MAX_POINTS];
+
+// Weather effects (see weather.h): clouds and thunderstorms on top of the
+// schedule in auto mode, computed per fade tick. -D WEATHER_EFFECTS=0 takes
+// them out of /weather; the engine then stays off.
+#ifndef WEATHER_EFFECTS
+#define WEATHER_EFFECTS 1
+#endif
+constexpr uint8_t WEATHER_DEFAULT_COVER = 40;  // percent
+constexpr uint32_t WEATHER_DEFAULT_SEED = 1;
+
+WeatherEngine weather(WEATHER_DEFAULT_COVER, WEATHER_DEFAULT_SEED);
+
+PwmLevel lastScheduleLevel = {0, 0, 0};
+LevelCrossfade scheduleBlend;
+
 // Operating state
 bool autoMode = true;
 bool timeSynced = false;
 
 String lastUpdateError;
 
+// Firmware upload statistics (reported by /update/status)
+struct UpdateStats {
+  uint32_t size;        // announced image size, 0 = unknown (plain form post)
+  uint32_t received;    // bytes accepted when the session ended
+  uint32_t startMs;
+  uint32_t transferMs;  // first chunk to last byte
+  uint64_t flashUs;     // inside Update.write()/end(): erasing and programming
+  uint32_t maxStallUs;  // longest single write, i.e. the longest the lights waited
+  uint16_t resumes;     // chunks that continued after a dropped connection
+  bool interrupted;     // the last chunk did not arrive completely
+  bool compressed;      // gzip image, unpacked by the bootloader
+};
+
+constexpr unsigned long UPDATE_RESUME_TIMEOUT_MS = 60000;  // unfinished uploads are dropped after this
+constexpr unsigned long UPDATE_RESTART_DELAY_MS = 200;     // lets the answer go out first
+
+UpdateStats updateStats = {};
+bool updateChunkRejected = false;  // current chunk does not continue the session
+
+// Perceptual correction tables (flash) and the curve selected per LED color
+// (outputs in 1/16 counts, so low levels keep their resolution for dithering)
+const CurveTable<PWM_MAX> cieTable PROGMEM = buildCieTable<PWM_MAX, DITHER_BITS>();
+const CurveTable<PWM_MAX> gamma22Table PROGMEM = buildGammaTable<PWM_MAX, DITHER_BITS>(2.2);
+const CurveTable<PWM_MAX> gamma28Table PROGMEM = buildGammaTable<PWM_MAX, DITHER_BITS>(2.8);
+
+PerceptualCurve colorCurves[3] = {PERCEPTUAL_CURVE, PERCEPTUAL_CURVE, PERCEPTUAL_CURVE};  // red, green, blue
+
+// Fade engine statistics (reported in /state)
+struct FadeStats {
+  uint32_t ticks;
+  uint32_t overBudget;  // ticks that took longer than FADE_TICK_BUDGET_US
+  uint16_t lastUs;
+  uint16_t maxUs;
+};
+
+FadeStats fadeStats = {0, 0, 0, 0};
+
+// Boot timeline in ms since power-up, 0 = not reached yet (reported in /state?status=1)
+struct BootMetrics {
+  uint32_t firstLightMs;  // outputs first driven from the schedule or manual levels
+  uint32_t firstHttpMs;   // first HTTP request answered
+  uint32_t wifiMs;        // link first came up
+  uint32_t timeSyncMs;    // NTP time first available
+  bool warmStart;         // WiFi/time restored from RTC memory
+  int32_t restoreErrorMs; // restored clock minus NTP at first sync
+  uint32_t configLoadUs;  // scanning the settings journal
+};
+
+BootMetrics bootMetrics = {0, 0, 0, 0, false, 0, 0};
+uint32_t wifiReconnects = 0;
+
+// millis() for the boot timeline, never 0 so 0 can mean "not yet"
+uint32_t bootTimestamp() {
+  unsigned long now = millis();
+  return now > 0 ? now : 1;
+}
+
+// Dithering state & statistics (reported in /state)
+bool ditherEnabled = DITHER_HZ > 0;
+
+struct DitherStats {
+  uint32_t frames;
+  uint32_t overBudget;  // frames that took longer than DITHER_BUDGET_US
+  uint16_t lastUs;
+  uint16_t maxUs;
+};
+
+DitherStats ditherStats = {0, 0, 0, 0};
+
+// State sections, used to build /state and the pushed /events deltas
+enum StateField : uint8_t {
+  STATE_STATUS   = 1 << 0,  // wifi & time
+  STATE_MODE     = 1 << 1,
+  STATE_MANUAL   = 1 << 2,
+  STATE_CURVE    = 1 << 3,
+  STATE_STATS    = 1 << 4,  // fade & dither timings
+  STATE_CHANNELS = 1 << 5,  // mapping & raw outputs
+  STATE_LOG      = 1 << 6,  // newest command log entry
+};
+constexpr uint8_t STATE_ALL = 0xFF;
+
+// Sections changed since the last push to /events listeners. Output changes
+// from the fade engine are tracked separately so they can be rate limited.
+uint8_t pendingEvents = 0;
+bool pendingOutputEvent = false;
+
+// Bumped on every change that /state reports (except status & stats), so
+// clients can revalidate with If-None-Match and get a bodyless 304. The
+// version starts over at every boot; the ETag also carries bootId, drawn
+// from the hardware RNG in setup(), so a tag from before a restart cannot
+// match a different state with the same version.
+uint32_t stateVersion = 1;
+uint32_t bootId = 0;
+
+void notifyStateChange(uint8_t fields) {
+  pendingEvents |= fields;
+  ++stateVersion;
+}
+
+// Persistent settings journal (see config_journal.h); its first sector is
+// the EEPROM sector from the linker script, which this firmware does not
+// otherwise use, and its second the sector after the uploaded schedules
+#ifndef CONFIG_SECTOR_ADDRESS
+extern "C" uint32_t _EEPROM_start;
+#define CONFIG_SECTOR_ADDRESS (static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&_EEPROM_start)) - 0x40200000)
+#endif
+
+// Uploaded schedules use the first two sectors of the (raw, unmounted)
+// filesystem area; see board_build.ldscript in platformio.ini
+#ifndef SCHEDULE_SECTOR_ADDRESS
+extern "C" uint32_t _FS_start;
+#define SCHEDULE_SECTOR_ADDRESS (static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&_FS_start)) - 0x40200000)
+#endif
+
+#ifndef CONFIG_SECOND_SECTOR_ADDRESS
+#define CONFIG_SECOND_SECTOR_ADDRESS (SCHEDULE_SECTOR_ADDRESS + 2 * SCHEDULE_SECTOR_SIZE)
+#endif
+
+constexpr unsigned long CONFIG_FLUSH_DELAY_MS = 5000;
+
+struct EspFlash {
+  static bool read(uint32_t address, uint32_t *data, size_t size) { return ESP.flashRead(address, data, size); }
+  static bool write(uint32_t address, uint32_t *data, size_t size) { return ESP.flashWrite(address, data, size); }
+  static bool erase(uint32_t address) { return ESP.flashEraseSector(address / CONFIG_SECTOR_SIZE); }
+};
+
+ConfigJournal<EspFlash> configJournal(CONFIG_SECTOR_ADDRESS, CONFIG_SECOND_SECTOR_ADDRESS);
+ScheduleStore<EspFlash, SCHEDULE_MAX_POINTS> scheduleStore(SCHEDULE_SECTOR_ADDRESS);
+ConfigRecord savedConfig;
+uint32_t configWrites = 0;
+
+// Everything periodic or delayed in loop() (see task_scheduler.h); the ids
+// are assigned in setupTasks()
+uint32_t schedulerClock() { return micros(); }
+
+TaskScheduler<13> scheduler(schedulerClock);
+TaskId fadeTask = NO_TASK;
+TaskId ditherTask = NO_TASK;
+TaskId testTask = NO_TASK;
+TaskId configTask = NO_TASK;
+TaskId restartTask = NO_TASK;
+TaskId updateTimeoutTask = NO_TASK;
+TaskId syncTask = NO_TASK;
+TaskId httpTask = NO_TASK;
+uint32_t idleMs = 0;  // spent in delay() waiting for the next deadline
+
+bool configDirty = false;  // changed since the last save (see flushConfig())
+
+// Each change pushes the save back, so a burst of changes costs one write
+void saveConfigSoon() {
+  configDirty = true;
+  scheduler.schedule(configTask, CONFIG_FLUSH_DELAY_MS * 1000);
+}
+
 // Test pulse state
+constexpr unsigned long TEST_PULSE_MS = 4000;
 int8_t testChannel = -1;
-unsigned long testUntil = 0;
 
 ESP8266WebServer server(80);
 
+WiFiUDP syncUdp;
+FadeSync fadeSync(FADE_SYNC_GROUP);
+
 // NTP configuration (set your timezone offset and DST offset as needed)
 const char *ntpServer = "pool.ntp.org";
 constexpr long gmtOffsetSec = 0;      // update to your timezone offset (seconds)
 constexpr int daylightOffsetSec = 0;  // daylight saving offset (seconds)
 
+// ------------------------------------------------------------
+// Streamed responses (see response_stream.h)
+//
+// The pages are larger than a socket's send buffer, so they go out from
+// httpTask a buffer at a time instead of holding loop() until a slow client
+// has taken them. -D RESPONSE_STREAMS=0 sends them from the handler again.
+// ------------------------------------------------------------
+#ifndef RESPONSE_STREAMS
+#define RESPONSE_STREAMS 3  // concurrent downloads; the ESP-01 has few sockets
+#endif
+constexpr size_t RESPONSE_HEAD_BYTES = 192;
+constexpr size_t RESPONSE_CHUNK_BYTES = 256;
+constexpr unsigned long RESPONSE_PUMP_MS = 5;  // an ack takes a few ms on the LAN
+
+ResponseStreams<WiFiClient, (RESPONSE_STREAMS > 0 ? RESPONSE_STREAMS : 1), RESPONSE_HEAD_BYTES, RESPONSE_CHUNK_BYTES>
+    responseStreams;
+
+void pumpResponses() {
+  responseStreams.pump(millis());
+}
+
+// Long handlers (a firmware chunk arriving over a weak link) call this
+// between pieces, so fades, the modulator, a test pulse and the downloads
+// keep going meanwhile
+void serviceTasks() {
+  scheduler.runIfDue(fadeTask);
+  scheduler.runIfDue(ditherTask);
+  scheduler.runIfDue(testTask);
+  scheduler.runIfDue(httpTask);
+}
+
 // ------------------------------------------------------------
 // Helper utilities
 // ------------------------------------------------------------
-String colorName(ChannelColor color) {
+const __FlashStringHelper *colorName(ChannelColor color) {
   switch (color) {
-    case COLOR_RED: return "Rood";
-    case COLOR_GREEN: return "Groen";
-    case COLOR_BLUE: return "Blauw";
-    default: return "Onbekend";
+    case COLOR_RED: return F("Rood");
+    case COLOR_GREEN: return F("Groen");
+    case COLOR_BLUE: return F("Blauw");
+    default: return F("Onbekend");
   }
 }
 
-String colorCode(ChannelColor color) {
+const __FlashStringHelper *colorCode(ChannelColor color) {
   switch (color) {
-    case COLOR_RED: return "red";
-    case COLOR_GREEN: return "green";
-    case COLOR_BLUE: return "blue";
-    default: return "unknown";
+    case COLOR_RED: return F("red");
+    case COLOR_GREEN: return F("green");
+    case COLOR_BLUE: return F("blue");
+    default: return F("unknown");
   }
 }
 
@@ -115,6 +509,63 @@ ChannelColor colorFromString(const String &value) {
   return COLOR_UNKNOWN;
 }
 
+const __FlashStringHelper *curveCode(PerceptualCurve curve) {
+  switch (curve) {
+    case CURVE_CIE1931: return F("cie1931");
+    case CURVE_GAMMA22: return F("gamma22");
+    case CURVE_GAMMA28: return F("gamma28");
+    case CURVE_LINEAR:
+    default: return F("linear");
+  }
+}
+
+PerceptualCurve curveFromString(const String &value) {
+  if (value.equalsIgnoreCase("linear")) return CURVE_LINEAR;
+  if (value.equalsIgnoreCase("cie1931")) return CURVE_CIE1931;
+  if (value.equalsIgnoreCase("gamma22")) return CURVE_GAMMA22;
+  if (value.equalsIgnoreCase("gamma28")) return CURVE_GAMMA28;
+  return CURVE_COUNT;
+}
+
+const __FlashStringHelper *weatherCode(WeatherMode mode) {
+  switch (mode) {
+    case WEATHER_CLOUDS: return F("clouds");
+    case WEATHER_STORM:  return F("storm");
+    case WEATHER_OFF:
+    default: return F("off");
+  }
+}
+
+WeatherMode weatherFromString(const String &value) {
+  if (value.equalsIgnoreCase("off")) return WEATHER_OFF;
+  if (value.equalsIgnoreCase("clouds")) return WEATHER_CLOUDS;
+  if (value.equalsIgnoreCase("storm")) return WEATHER_STORM;
+  return WEATHER_MODE_COUNT;
+}
+
+// Index into scenePresets, or -1
+int sceneFromString(const String &value) {
+  for (uint8_t i = 0; i < SCENE_COUNT; ++i) {
+    char name[sizeof(scenePresets[0].name)];
+    memcpy_P(name, scenePresets[i].name, sizeof(name));
+    if (value.equalsIgnoreCase(name)) return i;
+  }
+  return -1;
+}
+
+// The preset the manual levels are set to, or -1
+int matchingScene() {
+  uint16_t manual[3] = {static_cast<uint16_t>(roundf(manualLevel.red * 1000)),
+                        static_cast<uint16_t>(roundf(manualLevel.green * 1000)),
+                        static_cast<uint16_t>(roundf(manualLevel.blue * 1000))};
+  for (uint8_t i = 0; i < SCENE_COUNT; ++i) {
+    ScenePreset scene;
+    memcpy_P(&scene, &scenePresets[i], sizeof(scene));
+    if (memcmp(scene.level, manual, sizeof(manual)) == 0) return i;
+  }
+  return -1;
+}
+
 String describeUpdateError() {
   uint8_t error = Update.getError();
   switch (error) {
@@ -136,89 +587,269 @@ String describeUpdateError() {
   }
 }
 
+// "HH:MM", or "-" for a negative minute (the sun does not rise or set)
+void formatMinutes(char (&out)[8], int16_t minutes) {
+  if (minutes < 0) {
+    snprintf(out, sizeof(out), "-");
+  } else {
+    snprintf(out, sizeof(out), "%02d:%02d", minutes / 60, minutes % 60);
+  }
+}
+
 float clamp01(float value) {
   if (value < 0.0f) return 0.0f;
   if (value > 1.0f) return 1.0f;
   return value;
 }
 
-void applyOutputs(const RGBLevel &rgb) {
-  autoLevel = rgb;
+// Manual level (0.0 - 1.0) to a target with DITHER_BITS of fraction
+uint16_t levelToTarget(float level) {
+  return static_cast<uint16_t>(roundf(clamp01(level) * (PWM_MAX << DITHER_BITS)));
+}
 
-  for (int i = 0; i < 3; ++i) {
-    float output = 0.0f;
-    switch (channels[i].mappedColor) {
-      case COLOR_RED:   output = rgb.red; break;
-      case COLOR_GREEN: output = rgb.green; break;
-      case COLOR_BLUE:  output = rgb.blue; break;
-      case COLOR_UNKNOWN:
-      default:
-        output = 0.0f;
-        break;
+// Map a perceived-brightness target onto the PWM target for one LED color
+uint16_t correctTarget(ChannelColor color, uint16_t target) {
+  constexpr uint16_t maxTarget = PWM_MAX << DITHER_BITS;
+  if (target > maxTarget) target = maxTarget;
+  if (color == COLOR_UNKNOWN) return target;
+
+  const CurveTable<PWM_MAX> *table = nullptr;
+  switch (colorCurves[color - COLOR_RED]) {
+    case CURVE_CIE1931: table = &cieTable; break;
+    case CURVE_GAMMA22: table = &gamma22Table; break;
+    case CURVE_GAMMA28: table = &gamma28Table; break;
+    case CURVE_LINEAR:
+    default:
+      return target;
+  }
+
+  // Interpolate between neighbouring entries using the fraction bits
+  uint16_t index = target >> DITHER_BITS;
+  uint16_t fraction = target & DITHER_MASK;
+  uint16_t low = pgm_read_word(&table->counts[index]);
+  if (fraction == 0 || index >= PWM_MAX) return low;
+  uint16_t high = pgm_read_word(&table->counts[index + 1]);
+  return low + (((static_cast<int32_t>(high) - low) * fraction) >> DITHER_BITS);
+}
+
+// Write every channel's current target, running one modulator frame; the
+// driver only passes on the channels whose count changed
+void renderOutputs() {
+  constexpr uint32_t maxTarget = PWM_MAX << DITHER_BITS;
+  for (int i = 0; i < OUTPUT_CHANNELS; ++i) {
+    uint16_t target = channels[i].target;
+    uint16_t count;
+    if (OutputBackend::MAX_COUNT != PWM_MAX) {
+      count = (static_cast<uint32_t>(target) * OutputBackend::MAX_COUNT + maxTarget / 2) / maxTarget;
+    } else if (ditherEnabled) {
+      count = ditherStep(target, channels[i].ditherAccumulator);
+    } else {
+      count = ditherRound(target);
     }
-    channels[i].rawValue = static_cast<uint16_t>(roundf(clamp01(output) * PWM_MAX));
-    analogWrite(channelPins[i], channels[i].rawValue);
+    outputs.set(i, count);
+  }
+  outputs.flush();
+}
+
+// An expander that browned out comes back dark while still acknowledging
+// writes (see Pca9685::verify()); its setup is read back this often and
+// every channel rewritten when it had lost it
+constexpr unsigned long OUTPUT_CHECK_MS = 2000;
+
+void checkOutputs() {
+  if (!outputs.verify()) outputs.flush();
+}
+
+void ditherFrame() {
+  uint32_t start = micros();
+  renderOutputs();
+  uint32_t elapsed = micros() - start;
+
+  ditherStats.lastUs = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+  if (ditherStats.lastUs > ditherStats.maxUs) ditherStats.maxUs = ditherStats.lastUs;
+  if (elapsed > DITHER_BUDGET_US) ++ditherStats.overBudget;
+  ++ditherStats.frames;
+}
+
+// A channel's corrected target for a level, by the color mapped to it
+uint16_t channelTarget(const PwmLevel &levels, int channel) {
+  uint16_t output = 0;
+  switch (channels[channel].mappedColor) {
+    case COLOR_RED:   output = levels.red; break;
+    case COLOR_GREEN: output = levels.green; break;
+    case COLOR_BLUE:  output = levels.blue; break;
+    case COLOR_UNKNOWN:
+    default:
+      output = 0;
+      break;
+  }
+  return correctTarget(channels[channel].mappedColor, output);
+}
+
+// Levels are in 1/16 PWM counts (DITHER_BITS of fraction); a running
+// transition mixes them with the level shown when it started
+void writeOutputs(const PwmLevel &wanted) {
+  if (bootMetrics.firstLightMs == 0) bootMetrics.firstLightMs = bootTimestamp();
+
+  PwmLevel levels = transition.apply(wanted, millis());
+  shownLevel = levels;
+  wantedLevel = wanted;
+
+  bool reportedChange = false;
+  for (int i = 0; i < OUTPUT_CHANNELS; ++i) {
+    uint16_t target = channelTarget(levels, i);
+    if (ditherRound(target) != ditherRound(channels[i].target)) reportedChange = true;
+    channels[i].target = target;
   }
+  if (reportedChange) {  // a count /state reports moved
+    pendingOutputEvent = true;
+    ++stateVersion;
+  }
+  renderOutputs();
+}
+
+void applyOutputs(const RGBLevel &rgb) {
+  writeOutputs({levelToTarget(rgb.red), levelToTarget(rgb.green), levelToTarget(rgb.blue)});
 }
 
 void applyManualOutputs() {
   applyOutputs(manualLevel);
 }
 
+// Fade from what is shown now to whatever the next writes ask for
+void startTransition(uint32_t durationMs) {
+  transition.start(shownLevel, durationMs, millis());
+}
+
+// ------------------------------------------------------------
+// Command log (see command_log.h): every state change, who asked for it and
+// where the outputs ended up, for the page's log panel and GET /commands
+// ------------------------------------------------------------
+constexpr uint8_t COMMAND_LOG_SIZE = 16;
+CommandLog<COMMAND_LOG_SIZE, OUTPUT_CHANNELS> commandLog;
+
+// Schedule segments entered so far (the next point, or a seek after a clock
+// jump or a new schedule). fadeTick() logs "auto" when auto mode enters one
+// that no entry has covered yet.
+uint32_t scheduleSegmentChanges() {
+  return scheduleCursor.advances() + scheduleCursor.seeks();
+}
+
+uint32_t loggedSegmentChanges = 0;
+
+// Call once the outputs are refreshed. The counts logged are those the
+// outputs fade to (the first frame of a crossfade still shows the old
+// level), or the pulse while a test pulse runs. Internal events pass
+// fromClient = false and are logged without an address.
+void logCommand(const __FlashStringHelper *command, bool fromClient = true) {
+  uint32_t ip = fromClient ? static_cast<uint32_t>(server.client().remoteIP()) : 0;
+  CommandLog<COMMAND_LOG_SIZE, OUTPUT_CHANNELS>::Entry &entry = commandLog.append(command, millis(), ip);
+  for (int i = 0; i < OUTPUT_CHANNELS; ++i) {
+    entry.raw[i] = ditherRound(testChannel >= 0 ? channels[i].target : channelTarget(wantedLevel, i));
+  }
+  loggedSegmentChanges = scheduleSegmentChanges();
+  notifyStateChange(STATE_LOG);
+}
+
 time_t nowLocal() {
   time_t raw = time(nullptr);
   return raw;
 }
 
-int minutesSinceMidnight() {
-  time_t nowVal = nowLocal();
-  if (nowVal < 1000) {
+// Milliseconds since local midnight, or -1 while the clock is not set.
+// localtime_r() only runs when the second changes.
+int32_t msSinceMidnight() {
+  static time_t cachedSecond = 0;
+  static int32_t cachedSecondOfDay = 0;
+
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  if (tv.tv_sec < 1000) {
     return -1;
   }
-  struct tm timeInfo;
-  localtime_r(&nowVal, &timeInfo);
-  return timeInfo.tm_hour * 60 + timeInfo.tm_min;
+  if (tv.tv_sec != cachedSecond) {
+    time_t nowVal = tv.tv_sec;
+    struct tm timeInfo;
+    localtime_r(&nowVal, &timeInfo);
+    cachedSecond = tv.tv_sec;
+    cachedSecondOfDay = (timeInfo.tm_hour * 60 + timeInfo.tm_min) * 60 + timeInfo.tm_sec;
+  }
+  return cachedSecondOfDay * 1000L + tv.tv_usec / 1000;
 }
 
-RGBLevel interpolateLevels(const RGBLevel &a, const RGBLevel &b, float fraction) {
-  RGBLevel result;
-  result.red = a.red + (b.red - a.red) * fraction;
-  result.green = a.green + (b.green - a.green) * fraction;
-  result.blue = a.blue + (b.blue - a.blue) * fraction;
-  return result;
+PwmLevel evaluateSchedule(int32_t msOfDay) {
+  if (msOfDay < 0) {
+    return {0, 0, 0};
+  }
+  PwmLevel level = scheduleCursor.evaluate(schedulePoints, schedulePointCount,
+                                           static_cast<uint32_t>(msOfDay) % MS_PER_DAY, PWM_MAX, DITHER_BITS);
+  level = scheduleBlend.apply(level, millis());
+  lastScheduleLevel = level;
+  return level;
 }
 
-RGBLevel evaluateSchedule(int minutes) {
-  if (minutes < 0 || daylightScheduleSize == 0) {
-    return {0.0f, 0.0f, 0.0f};
+// Swap in a validated schedule; auto mode crossfades from the old curve
+void activateSchedule(const SchedulePoint *points, size_t count) {
+  schedulePoints = points;
+  schedulePointCount = count;
+  scheduleCursor.reset();
+  if (autoMode) {
+    scheduleBlend.start(lastScheduleLevel, SCHEDULE_BLEND_MS, millis());
   }
+}
 
-  const DayPhase *prevPhase = &daylightSchedule[0];
-  const DayPhase *nextPhase = nullptr;
+// Build today's astronomical schedule, unless it is already active (force:
+// after the clock or the location changed). The UTC offset is taken at
+// local noon, so a DST change during the night is in effect for the day.
+void refreshAstroSchedule(bool force) {
+  time_t now = time(nullptr);
+  if (!astroEnabled || now < 1000) return;
+
+  uint32_t start = micros();
+  struct tm local;
+  localtime_r(&now, &local);
+  time_t noon = now + ((12 - local.tm_hour) * 60 - local.tm_min) * 60 - local.tm_sec;
+  struct tm localNoon;
+  struct tm utcNoon;
+  localtime_r(&noon, &localNoon);
+  gmtime_r(&noon, &utcNoon);
+
+  int32_t day = localNoon.tm_year * 400 + localNoon.tm_yday;
+  if (!force && day == astroBuiltDay) return;
+
+  int32_t dayDelta = localNoon.tm_year != utcNoon.tm_year ? (localNoon.tm_year > utcNoon.tm_year ? 1 : -1)
+                                                          : localNoon.tm_yday - utcNoon.tm_yday;
+  int32_t utcOffset = dayDelta * MINUTES_PER_DAY + (localNoon.tm_hour - utcNoon.tm_hour) * 60 +
+                      (localNoon.tm_min - utcNoon.tm_min);
+
+  astroDay = computeAstroDay(noon, astroLatitude / 10000.0, astroLongitude / 10000.0, utcOffset);
+  size_t count = buildAstroSchedule(astroDay, astroLevels, astroPoints);
+  astroBuiltDay = day;
+  activateSchedule(astroPoints, count);
+  astroBuildUs = micros() - start;
+  notifyStateChange(STATE_MODE);
+}
 
-  for (size_t i = 0; i < daylightScheduleSize; ++i) {
-    if (daylightSchedule[i].minutes <= minutes) {
-      prevPhase = &daylightSchedule[i];
-    } else {
-      nextPhase = &daylightSchedule[i];
-      break;
-    }
-  }
+void updateAstro() {
+  refreshAstroSchedule(false);
+}
 
-  if (nextPhase == nullptr) {
-    // Wrap to first element for overnight interpolation
-    const DayPhase &first = daylightSchedule[0];
-    float duration = (1440 - prevPhase->minutes) + first.minutes;
-    float elapsed = minutes - prevPhase->minutes;
-    if (elapsed < 0) elapsed += 1440;
-    float frac = duration > 0 ? elapsed / duration : 0.0f;
-    return interpolateLevels(prevPhase->level, first.level, frac);
+void setAstroEnabled(bool enabled) {
+  if (enabled == astroEnabled) return;
+  astroEnabled = enabled;
+  astroBuiltDay = -1;
+  if (enabled) {
+    refreshAstroSchedule(true);
+  } else {
+    activateSchedule(storedPoints, storedPointCount);
   }
+}
 
-  float duration = nextPhase->minutes - prevPhase->minutes;
-  float elapsed = minutes - prevPhase->minutes;
-  float fraction = (duration > 0) ? (elapsed / duration) : 0.0f;
-  return interpolateLevels(prevPhase->level, nextPhase->level, fraction);
+// Days since the epoch, counted at local midnight: it turns over exactly
+// when msOfDay wraps, so the weather noise runs on without a seam
+uint32_t weatherDay(int32_t msOfDay) {
+  uint32_t midnight = static_cast<uint32_t>(time(nullptr)) - static_cast<uint32_t>(msOfDay) / 1000;
+  return (midnight + 43200) / 86400;
 }
 
 void updateAutoMode() {
@@ -226,381 +857,1224 @@ void updateAutoMode() {
     return;
   }
 
-  int minutes = minutesSinceMidnight();
-  if (minutes >= 0) {
-    RGBLevel level = evaluateSchedule(minutes);
-    applyOutputs(level);
+  int32_t msOfDay = fadeSync.scheduleTime(msSinceMidnight());
+  if (msOfDay < 0) {
+    waitingForClock = true;
+    return;
+  }
+  if (waitingForClock) {
+    waitingForClock = false;
+    startTransition(TRANSITION_MS);  // the first NTP answer fades the day in
   }
+  PwmLevel level = evaluateSchedule(msOfDay);
+  if (weather.mode() != WEATHER_OFF) {
+    level = weather.apply(level, weatherDay(msOfDay), msOfDay, PWM_MAX << DITHER_BITS);
+  }
+  writeOutputs(level);
 }
 
-String channelSummaryJson() {
-  String json = "[";
-  for (int i = 0; i < 3; ++i) {
-    if (i > 0) json += ",";
-    json += "{\"pin\":" + String(channelPins[i]) +
-            ",\"color\":\"" + colorName(channels[i].mappedColor) +
-            "\",\"code\":\"" + colorCode(channels[i].mappedColor) +
-            "\",\"raw\":" + String(channels[i].rawValue) + "}";
+void fadeTick() {
+  if (testChannel >= 0) {
+    return;  // leave the test pulse alone
   }
-  json += "]";
-  return json;
-}
 
-void stopTestIfExpired() {
-  if (testChannel >= 0 && millis() > testUntil) {
-    testChannel = -1;
-    if (autoMode) {
-      updateAutoMode();
-    } else {
-      applyManualOutputs();
-    }
+  uint32_t start = micros();
+  if (autoMode) {
+    updateAutoMode();
+    if (scheduleSegmentChanges() != loggedSegmentChanges) logCommand(F("auto"), false);
+  } else {
+    applyManualOutputs();  // only runs while a transition does
+  }
+  uint32_t elapsed = micros() - start;
+
+  fadeStats.lastUs = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+  if (fadeStats.lastUs > fadeStats.maxUs) fadeStats.maxUs = fadeStats.lastUs;
+  if (elapsed > FADE_TICK_BUDGET_US) ++fadeStats.overBudget;
+  ++fadeStats.ticks;
+  if (weather.mode() != WEATHER_OFF) {
+    weather.frameTime(elapsed, FADE_TICK_BUDGET_US);  // the weather gives way first
   }
 }
 
-void triggerTestPulse(int channelIndex) {
-  if (channelIndex < 0 || channelIndex >= 3) return;
-
-  testChannel = channelIndex;
-  testUntil = millis() + 4000;  // 4 seconds
+// Re-evaluate the outputs for the current mode
+void refreshOutputs() {
+  if (autoMode) {
+    updateAutoMode();
+  } else {
+    applyManualOutputs();
+  }
+}
 
-  for (int i = 0; i < 3; ++i) {
-    channels[i].rawValue = (i == channelIndex) ? PWM_MAX : 0;
-    analogWrite(channelPins[i], channels[i].rawValue);
+void writeChannelSummary(JsonWriter &json) {
+  json.beginArray();
+  for (int i = 0; i < OUTPUT_CHANNELS; ++i) {
+    json.beginObject();
+#if OUTPUT_DRIVER == OUTPUT_PCA9685
+    json.key(F("pca"));   json.value(i);  // expander output
+#else
+    json.key(F("pin"));   json.value(channelPins[i]);
+#endif
+    json.key(F("color")); json.string(colorName(channels[i].mappedColor));
+    json.key(F("code"));  json.string(colorCode(channels[i].mappedColor));
+    json.key(F("raw"));   json.value(ditherRound(channels[i].target));  // not the dithered frame
+    json.endObject();
   }
+  json.endArray();
 }
 
-// ------------------------------------------------------------
-// HTTP Handlers
-// ------------------------------------------------------------
-void handleRoot() {
-  String html = R"rawliteral(
-<!DOCTYPE html>
-<html lang="nl">
-<head>
-  <meta charset="UTF-8" />
-  <meta name="viewport" content="width=device-width, initial-scale=1" />
-  <title>Aquarium RGB Controller</title>
-  <style>
-    body { font-family: Arial, sans-serif; margin: 16px; background: #f4f6f8; color:#333; }
-    h1 { margin-bottom: 0.4em; }
-    .card { background: #fff; border-radius: 8px; padding: 16px; margin-bottom: 16px; box-shadow: 0 2px 6px rgba(0,0,0,0.1); }
-    table { width: 100%; border-collapse: collapse; margin-top: 8px; }
-    th, td { padding: 8px; border-bottom: 1px solid #ddd; text-align: left; }
-    th { background: #f0f2f5; }
-    button { padding: 6px 12px; border: none; border-radius: 4px; cursor: pointer; background: #1976d2; color: #fff; }
-    button.secondary { background: #455a64; }
-    button.danger { background: #c62828; }
-    .switch { display: flex; align-items: center; gap: 12px; }
-    .sliders { display: flex; flex-direction: column; gap: 12px; }
-    .slider-row { display: flex; align-items: center; gap: 12px; }
-    input[type=range] { flex: 1; }
-    .badge { display:inline-block; padding:3px 6px; border-radius:4px; background:#1976d2; color:#fff; font-size:0.75em; }
-    .error { color:#c62828; font-weight:bold; }
-    .command-log { padding:10px; margin-bottom:15px; background:#fff; border-radius:4px; border:1px solid #ddd; }
-    .command-log h3 { margin:0 0 8px; color:#333; font-size:1em; }
-    .command-entry { padding:6px 0; border-bottom:1px solid #eee; font-size:0.85em; display:flex; flex-direction:column; gap:2px; }
-    .command-entry:last-child { border-bottom:none; }
-    .command-func { font-weight:bold; color:#333; }
-    .command-dir { font-weight:bold; }
-    .command-dir.req { color:#007bff; }
-    .command-dir.res { color:#28a745; }
-    .command-meta { color:#666; font-size:0.75em; }
-    .command-hex { font-family:monospace; font-size:0.75em; color:#555; }
-    .command-empty { font-size:0.85em; color:#666; }
-  </style>
-</head>
-<body>
-  <h1>Aquarium RGB Controller</h1>
-  <div class="card">
-    <h2>Status</h2>
-    <p>WiFi: <span id="wifiStatus">-</span></p>
-    <p>Tijd: <span id="timeStatus">-</span></p>
-    <p>Modus: <span id="modeStatus">-</span></p>
-  </div>
-
-  <div class="card">
-    <h2>Kanalen testen & koppelen</h2>
-    <table>
-      <thead>
-        <tr><th>Kanaal</th><th>Pin</th><th>Huidige kleur</th><th>Actie</th><th>Koppelen</th></tr>
-      </thead>
-      <tbody id="channelTable"></tbody>
-    </table>
-  </div>
-
-  <div class="card">
-    <div class="switch">
-      <strong>Automatische daglicht simulatie</strong>
-      <button id="toggleModeBtn" class="secondary">Toggle</button>
-    </div>
-  </div>
-
-  <div class="card" id="manualCard">
-    <h2>Handmatige RGB regeling</h2>
-    <div class="sliders">
-      <div class="slider-row"><label>Rood</label><input type="range" min="0" max="100" id="sliderR"><span id="valR">0%</span></div>
-      <div class="slider-row"><label>Groen</label><input type="range" min="0" max="100" id="sliderG"><span id="valG">0%</span></div>
-      <div class="slider-row"><label>Blauw</label><input type="range" min="0" max="100" id="sliderB"><span id="valB">0%</span></div>
-    </div>
-    <button id="applyManualBtn">Pas waarden toe</button>
-  </div>
-
-  <div class="command-log">
-    <h3>Laatste Modbus Frames (60s)</h3>
-    <div id="commandLog"><div class="command-empty">Geen recente frames</div></div>
-  </div>
-
-  <div class="card">
-    <small>Tip: gebruik de test-knoppen om te zien welk kanaal welke kleur LED aanstuurt. Koppel daarna de juiste kleur via het keuzemenu.</small>
-  </div>
-
-  <div class="card">
-    <h2>Firmware update</h2>
-    <p>Gebruik deze pagina als OTA niet werkt.</p>
-    <button onclick="window.location.href='/update'">Open updatepagina</button>
-  </div>
-
-  <script>
-    let autoMode = true;
-
-    ['sliderR','sliderG','sliderB'].forEach((id, idx) => {
-      const el = document.getElementById(id);
-      const label = ['valR','valG','valB'][idx];
-      el.addEventListener('input', () => {
-        document.getElementById(label).innerText = el.value + '%';
-      });
-    });
-
-    async function fetchState() {
-      try {
-        const response = await fetch('/state');
-        if (!response.ok) throw new Error('State fetch failed');
-        const data = await response.json();
-        updateUi(data);
-      } catch (err) {
-        document.getElementById('wifiStatus').innerText = 'Offline';
-        console.error(err);
-      }
-    }
+// Write the selected sections as members of an already opened object
+void writeStateFields(JsonWriter &json, uint8_t fields) {
+  json.key(F("version")); json.value(stateVersion);
 
-    function updateUi(data) {
-      document.getElementById('wifiStatus').innerText = data.wifi || '-';
-      document.getElementById('timeStatus').innerText = data.time || '-';
-      autoMode = data.autoMode;
-      document.getElementById('modeStatus').innerText = autoMode ? 'Automatisch' : 'Handmatig';
-      document.getElementById('toggleModeBtn').innerText = autoMode ? 'Zet handmatig' : 'Zet automatisch';
-      document.getElementById('manualCard').style.display = autoMode ? 'none' : 'block';
-
-      // Update sliders
-      document.getElementById('sliderR').value = Math.round(data.manual.red * 100);
-      document.getElementById('sliderG').value = Math.round(data.manual.green * 100);
-      document.getElementById('sliderB').value = Math.round(data.manual.blue * 100);
-      document.getElementById('valR').innerText = Math.round(data.manual.red * 100) + '%';
-      document.getElementById('valG').innerText = Math.round(data.manual.green * 100) + '%';
-      document.getElementById('valB').innerText = Math.round(data.manual.blue * 100) + '%';
-
-      renderChannels(data.channels);
+  if (fields & STATE_STATUS) {
+    char text[40];
+    if (WiFi.isConnected()) {
+      IPAddress ip = WiFi.localIP();
+      snprintf(text, sizeof(text), "%s (%u.%u.%u.%u)", ssid, ip[0], ip[1], ip[2], ip[3]);
+      json.key(F("wifi")); json.string(text);
+    } else {
+      json.key(F("wifi")); json.string(ssid);
     }
 
-    function renderChannels(channels) {
-      const tbody = document.getElementById('channelTable');
-      tbody.innerHTML = '';
-      channels.forEach((ch, index) => {
-        const tr = document.createElement('tr');
-        tr.innerHTML = `
-          <td>Kanaal ${index+1}</td>
-          <td>GPIO ${ch.pin}</td>
-          <td><span class="badge">${ch.color}</span></td>
-          <td><button onclick="testChannel(${index})">Test kanaal</button></td>
-          <td>
-            <select onchange="assignColor(${index}, this.value)">
-              <option value="unknown">Onbekend</option>
-              <option value="red">Rood</option>
-              <option value="green">Groen</option>
-              <option value="blue">Blauw</option>
-            </select>
-          </td>`;
-        const select = tr.querySelector('select');
-        if (select) {
-          select.value = ch.code || 'unknown';
-        }
-        tbody.appendChild(tr);
-      });
+    time_t nowVal = nowLocal();
+    json.key(F("time"));
+    if (nowVal > 0) {
+      struct tm timeInfo;
+      localtime_r(&nowVal, &timeInfo);
+      snprintf(text, sizeof(text), "%02d:%02d:%02d", timeInfo.tm_hour, timeInfo.tm_min, timeInfo.tm_sec);
+      json.string(text);
+    } else {
+      json.string(F("-"));
     }
 
-    async function testChannel(index) {
-      await fetch(`/test?channel=${index}`, { method:'POST' });
+    json.key(F("boot"));
+    json.beginObject();
+    json.key(F("firstLightMs")); json.value(bootMetrics.firstLightMs);
+    json.key(F("firstHttpMs"));  json.value(bootMetrics.firstHttpMs);
+    json.key(F("wifiMs"));       json.value(bootMetrics.wifiMs);
+    json.key(F("timeSyncMs"));   json.value(bootMetrics.timeSyncMs);
+    json.key(F("reconnects"));   json.value(wifiReconnects);
+    json.key(F("warmStart"));    json.value(bootMetrics.warmStart);
+    json.key(F("restoreErrorMs")); json.value(bootMetrics.restoreErrorMs);
+    json.key(F("configLoadUs")); json.value(bootMetrics.configLoadUs);
+    json.endObject();
+
+    uint32_t now = millis();
+    const SyncStats &sync = fadeSync.stats();
+    json.key(F("sync"));
+    json.beginObject();
+    json.key(F("role"));
+    json.string(!fadeSync.started()      ? F("off")
+                : fadeSync.leading(now)   ? F("leader")
+                : fadeSync.following(now) ? F("follower")
+                                          : F("listening"));
+    snprintf(text, sizeof(text), "%08x", static_cast<unsigned>(fadeSync.leaderId(now)));
+    json.key(F("leader"));   json.string(text);
+    json.key(F("offsetMs")); json.value(fadeSync.offsetMs());
+    json.key(F("errorMs"));  json.value(sync.lastErrorMs);
+    json.key(F("sent"));     json.value(sync.sent);
+    json.key(F("received")); json.value(sync.received);
+    json.endObject();
+  }
+
+  if (fields & STATE_MODE) {
+    json.key(F("autoMode")); json.value(autoMode);
+    json.key(F("schedule"));
+    json.beginObject();
+    json.key(F("points"));     json.value(schedulePointCount);
+    json.key(F("custom"));     json.value(storedPoints != defaultSchedule.points);
+    json.key(F("generation")); json.value(scheduleStore.generation());
+    json.endObject();
+
+    char text[8];
+    json.key(F("astro"));
+    json.beginObject();
+    json.key(F("enabled")); json.value(astroEnabled);
+    json.key(F("lat"));     json.value(astroLatitude / 10000.0f, 4);
+    json.key(F("lon"));     json.value(astroLongitude / 10000.0f, 4);
+    if (astroBuiltDay >= 0) {
+      formatMinutes(text, astroDay.sunrise);
+      json.key(F("sunrise")); json.string(text);
+      formatMinutes(text, astroDay.sunset);
+      json.key(F("sunset"));  json.string(text);
+      json.key(F("moon"));    json.value(astroDay.moonPermille / 1000.0f, 3);
+      json.key(F("day"));     json.value(astroBuiltDay);
+      json.key(F("buildUs")); json.value(astroBuildUs);
     }
+    json.endObject();
+
+    json.key(F("weather"));
+    json.beginObject();
+    json.key(F("mode"));  json.string(weatherCode(weather.mode()));
+    json.key(F("cover")); json.value(weather.cover());
+    json.key(F("seed"));  json.value(weather.seed());
+    json.endObject();
+  }
 
-    async function assignColor(index, color) {
-      await fetch(`/assign?channel=${index}&color=${color}`, { method:'POST' });
-      fetchState();
+  if (fields & STATE_MANUAL) {
+    json.key(F("manual"));
+    json.beginObject();
+    json.key(F("red"));   json.value(manualLevel.red, 3);
+    json.key(F("green")); json.value(manualLevel.green, 3);
+    json.key(F("blue"));  json.value(manualLevel.blue, 3);
+    int scene = matchingScene();
+    if (scene >= 0) {
+      json.key(F("scene")); json.string(reinterpret_cast<const __FlashStringHelper *>(scenePresets[scene].name));
     }
+    json.endObject();
+  }
+
+  if (fields & STATE_CURVE) {
+    json.key(F("curve"));
+    json.beginObject();
+    json.key(F("red"));   json.string(curveCode(colorCurves[0]));
+    json.key(F("green")); json.string(curveCode(colorCurves[1]));
+    json.key(F("blue"));  json.string(curveCode(colorCurves[2]));
+    json.endObject();
+  }
 
-    document.getElementById('toggleModeBtn').addEventListener('click', async () => {
-      await fetch(`/mode?auto=${autoMode ? 0 : 1}`, { method:'POST' });
-      fetchState();
-    });
+  if (fields & STATE_LOG) {
+    json.key(F("log"));  json.value(commandLog.newest());  // fetch what is new from /commands
+    json.key(F("boot")); json.value(bootId);               // sequence numbers start over with it
+  }
 
-    document.getElementById('applyManualBtn').addEventListener('click', async () => {
-      const r = document.getElementById('sliderR').value;
-      const g = document.getElementById('sliderG').value;
-      const b = document.getElementById('sliderB').value;
-      await fetch(`/manual?r=${r}&g=${g}&b=${b}`, { method:'POST' });
-      fetchState();
-    });
+  if (fields & STATE_STATS) {
+    json.key(F("fade"));
+    json.beginObject();
+    json.key(F("hz"));         json.value(FADE_TICK_HZ);
+    json.key(F("lastUs"));     json.value(fadeStats.lastUs);
+    json.key(F("maxUs"));      json.value(fadeStats.maxUs);
+    json.key(F("budgetUs"));   json.value(FADE_TICK_BUDGET_US);
+    json.key(F("overBudget")); json.value(fadeStats.overBudget);
+    json.key(F("ticks"));      json.value(fadeStats.ticks);
+    json.key(F("writes"));     json.value(outputs.stats().channelWrites);  // changed channels only
+    json.key(F("transfers"));  json.value(outputs.stats().transactions);
+    json.key(F("outputErrors")); json.value(outputs.stats().errors);
+    json.key(F("advances"));   json.value(scheduleCursor.advances());  // next schedule segment
+    json.key(F("seeks"));      json.value(scheduleCursor.seeks());     // binary search (boot, clock jump)
+    json.key(F("transitionMs")); json.value(transition.remainingMs(millis()));  // left of the running crossfade
+    json.endObject();
+
+    json.key(F("dither"));
+    json.beginObject();
+    json.key(F("enabled"));    json.value(ditherEnabled);
+    json.key(F("hz"));         json.value(DITHER_HZ);
+    json.key(F("bits"));       json.value(DITHER_BITS);
+    json.key(F("lastUs"));     json.value(ditherStats.lastUs);
+    json.key(F("maxUs"));      json.value(ditherStats.maxUs);
+    json.key(F("budgetUs"));   json.value(DITHER_BUDGET_US);
+    json.key(F("overBudget")); json.value(ditherStats.overBudget);
+    json.key(F("frames"));     json.value(ditherStats.frames);
+    json.endObject();
+
+    const WeatherStats &weatherStats = weather.stats();
+    json.key(F("weatherEngine"));
+    json.beginObject();
+    json.key(F("octaves"));    json.value(weather.octaves());
+    json.key(F("quality"));    json.value(weather.quality());
+    json.key(F("shade"));      json.value(weatherStats.shade / 65536.0f, 3);
+    json.key(F("frames"));     json.value(weatherStats.frames);
+    json.key(F("overBudget")); json.value(weatherStats.overBudget);
+    json.key(F("downgrades")); json.value(weatherStats.downgrades);
+    json.key(F("flashes"));    json.value(weatherStats.flashes);
+    json.endObject();
+
+    const ResponseStreamStats &streamStats = responseStreams.stats();
+    json.key(F("http"));
+    json.beginObject();
+    json.key(F("streams"));    json.value(responseStreams.active());
+    json.key(F("peak"));       json.value(streamStats.peak);
+    json.key(F("completed"));  json.value(streamStats.completed);
+    json.key(F("rejected"));   json.value(streamStats.rejected);  // answered 503, pool full
+    json.key(F("stalled"));    json.value(streamStats.stalled);
+    json.key(F("dropped"));    json.value(streamStats.dropped);
+    json.endObject();
+
+    json.key(F("tasks"));
+    json.beginObject();
+    for (uint8_t i = 0; i < scheduler.size(); ++i) {
+      const TaskStats &stats = scheduler.task(i).stats;
+      json.key(scheduler.task(i).name);
+      json.beginObject();
+      json.key(F("runs"));      json.value(stats.runs);
+      json.key(F("avgUs"));     json.value(stats.runs > 0 ? static_cast<uint32_t>(stats.totalUs / stats.runs) : 0);
+      json.key(F("maxUs"));     json.value(stats.maxUs);
+      json.key(F("lateUs"));    json.value(stats.lateUs);
+      json.key(F("maxLateUs")); json.value(stats.maxLateUs);
+      json.endObject();
+    }
+    json.endObject();
+    json.key(F("idleMs")); json.value(idleMs);
+
+    json.key(F("config"));
+    json.beginObject();
+    json.key(F("slots"));      json.value(configJournal.usedSlots());
+    json.key(F("slotsMax"));   json.value(ConfigJournal<EspFlash>::SLOTS);
+    json.key(F("writes"));     json.value(configWrites);
+    json.key(F("erases"));     json.value(configJournal.erases());
+    json.key(F("pending"));    json.value(configDirty);
+    json.endObject();
+  }
 
-    setInterval(fetchState, 5000);
-    fetchState();
-  </script>
-</body>
-</html>
-)rawliteral";
+  if (fields & STATE_CHANNELS) {
+    json.key(F("channels"));
+    writeChannelSummary(json);
+  }
+}
 
-  server.send(200, "text/html", html);
+void endTestPulse() {
+  testChannel = -1;
+  refreshOutputs();
+  notifyStateChange(STATE_CHANNELS);
+  logCommand(F("test-end"), false);
 }
 
-void handleState() {
-  stopTestIfExpired();
+void triggerTestPulse(int channelIndex) {
+  if (channelIndex < 0 || channelIndex >= OUTPUT_CHANNELS) return;
 
-  String json = "{";
-  json += "\"wifi\":\"" + WiFi.SSID() + (WiFi.isConnected() ? " (" + WiFi.localIP().toString() + ")" : "") + "\",";
+  testChannel = channelIndex;
+  scheduler.schedule(testTask, TEST_PULSE_MS * 1000);
 
-  time_t nowVal = nowLocal();
-  if (nowVal > 0) {
-    struct tm timeInfo;
-    localtime_r(&nowVal, &timeInfo);
-    char buffer[32];
-    snprintf(buffer, sizeof(buffer), "%02d:%02d:%02d", timeInfo.tm_hour, timeInfo.tm_min, timeInfo.tm_sec);
-    json += "\"time\":\"" + String(buffer) + "\",";
-  } else {
-    json += "\"time\":\"-\",";
+  for (int i = 0; i < OUTPUT_CHANNELS; ++i) {
+    bool on = i == channelIndex;
+    channels[i].target = on ? PWM_MAX << DITHER_BITS : 0;
+    outputs.set(i, on ? OutputBackend::MAX_COUNT : 0);
   }
+  outputs.flush();
+  notifyStateChange(STATE_CHANNELS);
+}
 
-  json += "\"autoMode\":" + String(autoMode ? "true" : "false") + ",";
-  json += "\"manual\":{\"red\":" + String(manualLevel.red, 3) +
-          ",\"green\":" + String(manualLevel.green, 3) +
-          ",\"blue\":" + String(manualLevel.blue, 3) + "},";
-  json += "\"channels\":" + channelSummaryJson();
-  json += "}";
+// ------------------------------------------------------------
+// Warm restart state (see rtc_state.h)
+// ------------------------------------------------------------
+constexpr uint32_t RTC_STATE_OFFSET = 32;  // in 4-byte blocks; the first 128 bytes belong to OTA (eboot)
+constexpr unsigned long RTC_SAVE_INTERVAL_MS = 60000;
+
+RtcState rtcState;
+bool rtcLoaded = false;
+
+// Clock restored at boot, kept to measure the estimate against NTP
+bool timeRestored = false;
+int64_t restoredEpochMs = 0;
+unsigned long restoredAtMs = 0;
+uint64_t restoredGapUs = 0;
+
+void writeRtcState() {
+  rtcState.magic = RTC_STATE_MAGIC;
+  rtcState.crc = rtcStateCrc(rtcState);
+  ESP.rtcUserMemoryWrite(RTC_STATE_OFFSET, reinterpret_cast<uint32_t *>(&rtcState), sizeof(rtcState));
+}
 
-  server.send(200, "application/json", json);
+void saveRtcWifi() {
+  memcpy(rtcState.bssid, WiFi.BSSID(), sizeof(rtcState.bssid));
+  rtcState.wifiChannel = WiFi.channel();
+  rtcState.ip = WiFi.localIP();
+  rtcState.gateway = WiFi.gatewayIP();
+  rtcState.subnet = WiFi.subnetMask();
+  rtcState.dns = WiFi.dnsIP();
+  rtcState.flags |= RTC_HAS_WIFI;
+  writeRtcState();
 }
 
-void handleAssign() {
-  if (!server.hasArg("channel") || !server.hasArg("color")) {
-    server.send(400, "text/plain", "Missing parameters");
+void forgetRtcWifi() {
+  rtcState.flags &= ~RTC_HAS_WIFI;
+  writeRtcState();
+}
+
+// Record the current wall clock; called periodically and right before restarts
+void saveRtcState() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  if (tv.tv_sec < 1000) {
     return;
   }
+  rtcState.epochSec = tv.tv_sec;
+  rtcState.epochUsec = tv.tv_usec;
+  rtcState.rtcTicks = system_get_rtc_time();
+  rtcState.rtcPeriod = system_rtc_clock_cali_proc();
+  rtcState.flags |= RTC_HAS_TIME;
+  writeRtcState();
+}
 
-  int ch = server.arg("channel").toInt();
-  String colorStr = server.arg("color");
+// Load the RTC block and, if it holds a clock, set the time from it plus the
+// reset gap measured by the RTC timer (which keeps running across resets)
+void restoreRtcState() {
+  ESP.rtcUserMemoryRead(RTC_STATE_OFFSET, reinterpret_cast<uint32_t *>(&rtcState), sizeof(rtcState));
+  rtcLoaded = rtcStateValid(rtcState);
+  if (!rtcLoaded) {
+    memset(&rtcState, 0, sizeof(rtcState));
+    return;
+  }
 
-  if (ch < 0 || ch >= 3) {
-    server.send(400, "text/plain", "Invalid channel");
+  bootMetrics.warmStart = true;
+  if (!(rtcState.flags & RTC_HAS_TIME)) {
     return;
   }
 
-  ChannelColor color = colorFromString(colorStr);
-  channels[ch].mappedColor = color;
+  restoredGapUs = rtcElapsedUs(rtcState.rtcTicks, system_get_rtc_time(), rtcState.rtcPeriod, rtcState.gapPpm);
+  uint64_t epochUs = static_cast<uint64_t>(rtcState.epochSec) * 1000000ULL + rtcState.epochUsec + restoredGapUs;
 
-  if (autoMode) {
-    updateAutoMode();
-  } else {
-    applyManualOutputs();
-  }
+  struct timeval tv;
+  tv.tv_sec = epochUs / 1000000ULL;
+  tv.tv_usec = epochUs % 1000000ULL;
+  settimeofday(&tv, nullptr);
 
-  server.send(200, "text/plain", "OK");
+  timeRestored = true;
+  restoredEpochMs = epochUs / 1000ULL;
+  restoredAtMs = millis();
 }
 
-void handleManual() {
-  if (!server.hasArg("r") || !server.hasArg("g") || !server.hasArg("b")) {
-    server.send(400, "text/plain", "Missing parameters");
-    return;
-  }
+// SNTP reports a sync here (SYS context: only set flags)
+volatile bool sntpSynced = false;
+volatile uint32_t lastSntpSyncMs = 0;  // for the sync age in /metrics
 
-  manualLevel.red = clamp01(server.arg("r").toInt() / 100.0f);
-  manualLevel.green = clamp01(server.arg("g").toInt() / 100.0f);
-  manualLevel.blue = clamp01(server.arg("b").toInt() / 100.0f);
+void onTimeSet(bool fromSntp) {
+  if (fromSntp) {
+    sntpSynced = true;
+    lastSntpSyncMs = bootTimestamp();
+  }
+}
 
-  if (!autoMode) {
-    applyManualOutputs();
+// First NTP sync after a restore: compare with the estimate and fold the
+// error into the gap correction used on the next warm restart
+void learnRestoreError() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  int64_t nowMs = static_cast<int64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+  int64_t estimateMs = restoredEpochMs + (millis() - restoredAtMs);
+  int64_t errorMs = estimateMs - nowMs;
+  bootMetrics.restoreErrorMs = errorMs;
+
+  if (restoredGapUs > 0) {
+    int64_t measuredPpm = -errorMs * 1000 * 1000000 / static_cast<int64_t>(restoredGapUs);
+    if (measuredPpm > 200000) measuredPpm = 200000;
+    if (measuredPpm < -200000) measuredPpm = -200000;
+    rtcState.gapPpm = (rtcState.gapPpm + static_cast<int32_t>(measuredPpm)) / 2;
   }
+}
 
-  server.send(200, "text/plain", "OK");
+void updateRtcState() {
+  if (timeSynced) saveRtcState();
 }
 
-void handleMode() {
-  if (!server.hasArg("auto")) {
-    server.send(400, "text/plain", "Missing parameters");
-    return;
+// ------------------------------------------------------------
+// Persistent settings (see config_journal.h)
+//
+// Channel mapping, mode, manual levels, curves and dithering survive a
+// reboot. Changes are coalesced: the journal is written once nothing has
+// changed for CONFIG_FLUSH_DELAY_MS, so slider drags and repeated /assign
+// calls cost one record, and identical settings are never rewritten.
+// ------------------------------------------------------------
+ConfigRecord currentConfig() {
+  ConfigRecord record;
+  memset(&record, 0xFF, sizeof(record));
+  record.autoMode = autoMode;
+  record.ditherEnabled = ditherEnabled;
+  for (int i = 0; i < OUTPUT_CHANNELS; ++i) {
+    record.mapping[i] = channels[i].mappedColor;
   }
-
-  autoMode = server.arg("auto").toInt() != 0;
-  if (autoMode) {
-    updateAutoMode();
-  } else {
-    applyManualOutputs();
+  for (int i = 0; i < 3; ++i) {
+    record.curves[i] = colorCurves[i];
   }
-
-  server.send(200, "text/plain", "OK");
+  record.manual[0] = static_cast<uint16_t>(roundf(manualLevel.red * 1000));
+  record.manual[1] = static_cast<uint16_t>(roundf(manualLevel.green * 1000));
+  record.manual[2] = static_cast<uint16_t>(roundf(manualLevel.blue * 1000));
+  record.astroMode = astroEnabled;
+  record.latitude = astroLatitude;
+  record.longitude = astroLongitude;
+  record.weather = weather.mode();
+  record.weatherCover = weather.cover();
+  record.weatherSeed = weather.seed();
+  return record;
 }
 
-void handleTest() {
-  if (!server.hasArg("channel")) {
-    server.send(400, "text/plain", "Missing channel");
+void loadConfig() {
+  uint32_t start = micros();
+  ConfigRecord record;
+  bool found = configJournal.load(record);
+  bootMetrics.configLoadUs = micros() - start;
+  if (!found) {
+    savedConfig = currentConfig();
     return;
   }
 
-  int ch = server.arg("channel").toInt();
-  if (ch < 0 || ch >= 3) {
-    server.send(400, "text/plain", "Invalid channel");
+  autoMode = record.autoMode != 0;
+  ditherEnabled = DITHER_HZ > 0 && record.ditherEnabled != 0;
+  for (int i = 0; i < OUTPUT_CHANNELS; ++i) {
+    channels[i].mappedColor = record.mapping[i] <= COLOR_BLUE ? static_cast<ChannelColor>(record.mapping[i]) : COLOR_UNKNOWN;
+  }
+  for (int i = 0; i < 3; ++i) {
+    colorCurves[i] = record.curves[i] < CURVE_COUNT ? static_cast<PerceptualCurve>(record.curves[i]) : CURVE_LINEAR;
+  }
+  manualLevel.red = clamp01(record.manual[0] / 1000.0f);
+  manualLevel.green = clamp01(record.manual[1] / 1000.0f);
+  manualLevel.blue = clamp01(record.manual[2] / 1000.0f);
+  if (record.astroMode <= 1) {
+    astroEnabled = record.astroMode != 0;
+    if (record.latitude >= -900000 && record.latitude <= 900000) astroLatitude = record.latitude;
+    if (record.longitude >= -1800000 && record.longitude <= 1800000) astroLongitude = record.longitude;
+  }
+  if (WEATHER_EFFECTS && record.weather < WEATHER_MODE_COUNT && record.weatherCover <= 100) {
+    weather.configure(static_cast<WeatherMode>(record.weather), record.weatherCover, record.weatherSeed);
+  }
+  savedConfig = record;
+}
+
+// Write pending settings (configTask, or directly before a restart)
+void flushConfig() {
+  if (!configDirty) {
+    return;
+  }
+  configDirty = false;
+
+  ConfigRecord record = currentConfig();
+  if (configRecordSame(record, savedConfig)) {
+    return;
+  }
+  if (configJournal.append(record)) {
+    savedConfig = record;
+    ++configWrites;
+  }
+}
+
+void loadSchedule() {
+  uint32_t start = micros();
+  size_t count = 0;
+  if (scheduleStore.load(scheduleBuffers[0], count) && count > 0) {
+    storedPoints = scheduleBuffers[0];
+    storedPointCount = count;
+    schedulePoints = storedPoints;
+    schedulePointCount = count;
+  }
+  bootMetrics.configLoadUs += micros() - start;
+}
+
+// Persist everything that should survive ESP.restart()/OTA
+void prepareForRestart() {
+  saveRtcState();
+  scheduler.cancel(configTask);
+  flushConfig();
+}
+
+// ------------------------------------------------------------
+// Fade synchronization (see fade_sync.h)
+//
+// The socket joins the multicast group every time WiFi comes up: the
+// membership does not outlive the link, and a reconnect may bring a new
+// address. syncTask then reads announcements and sends our own while this
+// node leads.
+// ------------------------------------------------------------
+IPAddress syncGroupIp() {
+  return IPAddress(SYNC_MULTICAST_IP[0], SYNC_MULTICAST_IP[1], SYNC_MULTICAST_IP[2], SYNC_MULTICAST_IP[3]);
+}
+
+void startSync() {
+  if (!FADE_SYNC || !syncUdp.beginMulticast(WiFi.localIP(), syncGroupIp(), SYNC_PORT)) return;
+  fadeSync.begin(ESP.getChipId(), millis());
+  scheduler.setRunning(syncTask, true);
+}
+
+// While the link is down, and while a firmware upload writes flash (see
+// beginUpdate()); startSync() joins again
+void stopSync() {
+  scheduler.setRunning(syncTask, false);
+  syncUdp.stop();
+}
+
+void updateSync() {
+  uint32_t now = millis();
+  int32_t localMs = msSinceMidnight();
+  uint8_t packet[SYNC_PACKET_SIZE];
+
+  for (uint8_t i = 0; i < SYNC_MAX_PACKETS; ++i) {
+    int length = syncUdp.parsePacket();
+    if (length <= 0) break;
+    syncUdp.read(packet, sizeof(packet));  // the rest of an oversized packet is dropped
+    fadeSync.receive(packet, length, now, localMs);
+  }
+
+  size_t length = fadeSync.announce(now, localMs, packet, sizeof(packet));
+  if (length > 0 && syncUdp.beginPacketMulticast(syncGroupIp(), SYNC_PORT, WiFi.localIP())) {
+    syncUdp.write(packet, length);
+    syncUdp.endPacket();
+  }
+}
+
+// ------------------------------------------------------------
+// HTTP Handlers
+// ------------------------------------------------------------
+// Static pages are gzipped into flash at build time (tools/embed_web.py) and
+// streamed straight from PROGMEM. Browsers revalidate with If-None-Match and
+// get a bodyless 304 while the firmware is unchanged. A streamed 200 writes
+// its own head, so the server's pending headers are only set when it sends.
+//
+// The server's header calls take Strings, and on the device a String over
+// 10 characters lives on the heap; the names used on every request and the
+// state ETag are built once instead of per call.
+const String ETAG_HEADER("ETag");
+const String CACHE_CONTROL_HEADER("Cache-Control");
+const String IF_NONE_MATCH_HEADER("If-None-Match");
+const String NO_CACHE("no-cache");
+
+constexpr size_t STATE_ETAG_BYTES = 24;  // "s<boot id>-<version>", quotes included
+String stateEtag;
+uint32_t stateEtagVersion = 0;
+
+// The ETag /state and /batch send; rebuilt in place when stateVersion moves
+const String &currentStateEtag() {
+  if (stateEtagVersion != stateVersion) {
+    char etag[STATE_ETAG_BYTES];
+    snprintf(etag, sizeof(etag), "\"s%08lx-%lu\"", static_cast<unsigned long>(bootId),
+             static_cast<unsigned long>(stateVersion));
+    stateEtag.reserve(STATE_ETAG_BYTES);  // allocates on the first call only
+    stateEtag = etag;
+    stateEtagVersion = stateVersion;
+  }
+  return stateEtag;
+}
+
+void sendGzipAsset(const uint8_t *data, size_t length, const char *etag, const char *contentType) {
+  if (server.header(IF_NONE_MATCH_HEADER) == etag) {
+    server.sendHeader(ETAG_HEADER, etag);
+    server.sendHeader(CACHE_CONTROL_HEADER, NO_CACHE);
+    server.send(304);
+    return;
+  }
+
+  if (RESPONSE_STREAMS == 0) {
+    server.sendHeader(ETAG_HEADER, etag);
+    server.sendHeader(CACHE_CONTROL_HEADER, NO_CACHE);
+    server.sendHeader("Content-Encoding", "gzip");
+    server.send_P(200, contentType, reinterpret_cast<PGM_P>(data), length);
+    return;
+  }
+
+  char *head = responseStreams.acquire();
+  if (head == nullptr) {
+    server.sendHeader("Retry-After", "1");
+    server.send(503, "text/plain", "Busy");
+    return;
+  }
+  int headLength = snprintf(head, RESPONSE_HEAD_BYTES,
+                            "HTTP/1.1 200 OK\r\n"
+                            "Content-Type: %s\r\n"
+                            "Content-Length: %u\r\n"
+                            "Content-Encoding: gzip\r\n"
+                            "ETag: %s\r\n"
+                            "Cache-Control: no-cache\r\n"
+                            "Connection: close\r\n\r\n",
+                            contentType, static_cast<unsigned>(length), etag);
+  responseStreams.start(server.client(), headLength, data, length, millis());
+}
+
+void handleRoot() {
+  sendGzipAsset(INDEX_HTML_GZ, INDEX_HTML_GZ_LEN, INDEX_HTML_ETAG, INDEX_HTML_TYPE);
+}
+
+// Response buffer for /state; reused on every poll so the handler itself
+// does not touch the heap. Sized for three channels plus room for more.
+constexpr size_t CHANNEL_JSON_BYTES = 64;  // one entry of writeChannelSummary()
+char stateJson[2432 + (OUTPUT_CHANNELS > 3 ? OUTPUT_CHANNELS - 3 : 0) * CHANNEL_JSON_BYTES];
+
+// The /state body, also the answer to /batch
+void sendState(bool withStatus) {
+  JsonWriter json(stateJson, sizeof(stateJson));
+  json.beginObject();
+  writeStateFields(json, withStatus ? STATE_ALL : STATE_ALL & ~(STATE_STATUS | STATE_STATS));
+  json.endObject();
+
+  if (json.overflowed()) {
+    server.send(500, "text/plain", "State too large");
+    return;
+  }
+  server.send(200, "application/json", json.c_str(), json.length());
+}
+
+// /state carries the versioned fields and answers If-None-Match with 304.
+// The clock, wifi and timings change constantly, so they are only included
+// (uncached) with /state?status=1; status=0 is the plain, cacheable form.
+void handleState() {
+  bool withStatus = server.hasArg("status") && server.arg("status").toInt() != 0;
+  if (!withStatus) {
+    const String &etag = currentStateEtag();
+    server.sendHeader(ETAG_HEADER, etag);
+    server.sendHeader(CACHE_CONTROL_HEADER, NO_CACHE);
+    if (server.header(IF_NONE_MATCH_HEADER) == etag) {
+      server.send(304);
+      return;
+    }
+  }
+
+  sendState(withStatus);
+}
+
+// Command log entries after ?after=<sequence> (the newest one the client
+// has), oldest first. Sequence numbers start at 1 again after a restart, so
+// the cursor is only valid together with the ?boot= it was read in; under
+// another boot id (or past the newest entry) it starts over. The reply
+// fits stateJson even with the whole log in it.
+constexpr size_t COMMAND_JSON_BYTES = 88 + 5 * OUTPUT_CHANNELS;  // one entry, all numbers at their widest
+static_assert(112 + COMMAND_LOG_SIZE * COMMAND_JSON_BYTES <= sizeof(stateJson), "stateJson too small for /commands");
+
+void handleCommands() {
+  uint32_t after = server.hasArg("after") ? strtoul(server.arg("after").c_str(), nullptr, 10) : 0;
+  bool sameBoot = !server.hasArg("boot") || strtoul(server.arg("boot").c_str(), nullptr, 10) == bootId;
+  if (!sameBoot || after > commandLog.newest()) after = 0;
+
+  JsonWriter json(stateJson, sizeof(stateJson));
+  json.beginObject();
+  json.key(F("boot"));    json.value(bootId);    // the cursor's other half
+  json.key(F("now"));     json.value(millis());  // entries carry millis() too
+  json.key(F("newest"));  json.value(commandLog.newest());
+  json.key(F("missed"));  json.value(commandLog.missedAfter(after));  // overwritten since the cursor
+  json.key(F("entries"));
+  json.beginArray();
+  char address[16];
+  for (uint32_t sequence = commandLog.firstAfter(after); sequence <= commandLog.newest(); ++sequence) {
+    const CommandLog<COMMAND_LOG_SIZE, OUTPUT_CHANNELS>::Entry &entry = commandLog.at(sequence);
+    json.beginObject();
+    json.key(F("seq")); json.value(entry.sequence);
+    json.key(F("ms"));  json.value(entry.ms);
+    if (entry.ip != 0) {
+      IPAddress ip(entry.ip);
+      snprintf(address, sizeof(address), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+      json.key(F("ip")); json.string(address);
+    }
+    json.key(F("cmd")); json.string(entry.command);
+    json.key(F("raw"));
+    json.beginArray();
+    for (int i = 0; i < OUTPUT_CHANNELS; ++i) json.value(entry.raw[i]);
+    json.endArray();
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+
+  if (json.overflowed()) {
+    server.send(500, "text/plain", "Log too large");
+    return;
+  }
+  server.send(200, "application/json", json.c_str(), json.length());
+}
+
+void handleAssign() {
+  if (!server.hasArg("channel") || !server.hasArg("color")) {
+    server.send(400, "text/plain", "Missing parameters");
+    return;
+  }
+
+  int ch = server.arg("channel").toInt();
+  String colorStr = server.arg("color");
+
+  if (ch < 0 || ch >= OUTPUT_CHANNELS) {
+    server.send(400, "text/plain", "Invalid channel");
+    return;
+  }
+
+  ChannelColor color = colorFromString(colorStr);
+  channels[ch].mappedColor = color;
+  refreshOutputs();
+  notifyStateChange(STATE_CHANNELS);
+  saveConfigSoon();
+
+  logCommand(F("assign"));
+  server.send(200, "text/plain", "OK");
+}
+
+// Transition time from ?fade=<ms>, or fallback; false when out of range
+bool readFadeArg(uint32_t &durationMs, uint32_t fallback) {
+  durationMs = fallback;
+  if (!server.hasArg("fade")) return true;
+  long value = server.arg("fade").toInt();
+  if (value < 0 || value > static_cast<long>(CROSSFADE_MAX_MS)) return false;
+  durationMs = static_cast<uint32_t>(value);
+  return true;
+}
+
+void handleManual() {
+  if (!server.hasArg("r") || !server.hasArg("g") || !server.hasArg("b")) {
+    server.send(400, "text/plain", "Missing parameters");
+    return;
+  }
+  uint32_t fadeMs;
+  if (!readFadeArg(fadeMs, TRANSITION_MS)) {
+    server.send(400, "text/plain", "Invalid fade");
+    return;
+  }
+
+  manualLevel.red = clamp01(server.arg("r").toInt() / 100.0f);
+  manualLevel.green = clamp01(server.arg("g").toInt() / 100.0f);
+  manualLevel.blue = clamp01(server.arg("b").toInt() / 100.0f);
+  notifyStateChange(STATE_MANUAL);
+  saveConfigSoon();
+
+  if (!autoMode) {
+    startTransition(fadeMs);
+    applyManualOutputs();
+  }
+
+  logCommand(F("manual"));
+  server.send(200, "text/plain", "OK");
+}
+
+void handleMode() {
+  if (!server.hasArg("auto")) {
+    server.send(400, "text/plain", "Missing parameters");
+    return;
+  }
+  uint32_t fadeMs;
+  if (!readFadeArg(fadeMs, TRANSITION_MS)) {
+    server.send(400, "text/plain", "Invalid fade");
+    return;
+  }
+
+  bool newAutoMode = server.arg("auto").toInt() != 0;
+  if (newAutoMode != autoMode) startTransition(fadeMs);
+  autoMode = newAutoMode;
+  refreshOutputs();
+  notifyStateChange(STATE_MODE);
+  saveConfigSoon();
+
+  logCommand(F("mode"));
+  server.send(200, "text/plain", "OK");
+}
+
+void handleCurve() {
+  static const char *const argNames[3] = {"red", "green", "blue"};
+
+  PerceptualCurve requested[3] = {colorCurves[0], colorCurves[1], colorCurves[2]};
+  bool any = false;
+  for (int i = 0; i < 3; ++i) {
+    if (!server.hasArg(argNames[i])) continue;
+    PerceptualCurve curve = curveFromString(server.arg(argNames[i]));
+    if (curve == CURVE_COUNT) {
+      server.send(400, "text/plain", "Invalid curve");
+      return;
+    }
+    requested[i] = curve;
+    any = true;
+  }
+
+  if (!any) {
+    server.send(400, "text/plain", "Missing parameters");
+    return;
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    colorCurves[i] = requested[i];
+  }
+  notifyStateChange(STATE_CURVE);
+  saveConfigSoon();
+  if (testChannel < 0) {
+    refreshOutputs();
+  }
+
+  logCommand(F("curve"));
+  server.send(200, "text/plain", "OK");
+}
+
+void handleDither() {
+  if (!server.hasArg("enabled")) {
+    server.send(400, "text/plain", "Missing parameters");
+    return;
+  }
+
+  bool enabled = server.arg("enabled").toInt() != 0;
+  if (enabled && DITHER_HZ == 0) {
+    server.send(400, "text/plain", "Dithering disabled at build time");
+    return;
+  }
+
+  ditherEnabled = enabled;
+  renderOutputs();
+  notifyStateChange(STATE_STATS);
+  saveConfigSoon();
+  logCommand(F("dither"));
+  server.send(200, "text/plain", "OK");
+}
+
+// CSV, one point per line (see schedule_store.h); sent in chunks
+void handleScheduleGet() {
+  static char chunk[512];
+  size_t length = 0;
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/csv", "tijd,rood,groen,blauw\n");
+  for (size_t i = 0; i < schedulePointCount; ++i) {
+    length += formatSchedulePoint(schedulePoints[i], chunk + length);
+    if (length + SCHEDULE_LINE_MAX > sizeof(chunk)) {
+      server.sendContent(chunk, length);
+      length = 0;
+    }
+  }
+  if (length > 0) server.sendContent(chunk, length);
+  server.sendContent("");
+}
+
+// Body: CSV as served by GET /schedule; ?reset=1 returns to the built-in one
+void handleSchedulePost() {
+  const SchedulePoint *points = defaultSchedule.points;
+  size_t count = daylightScheduleSize;
+  SchedulePoint *spare = scheduleBuffers[storedPoints == scheduleBuffers[0] ? 1 : 0];
+
+  if (server.hasArg("reset") && server.arg("reset").toInt() != 0) {
+    if (!scheduleStore.save(spare, 0)) {
+      server.send(500, "text/plain", "Saving schedule failed");
+      return;
+    }
+  } else {
+    if (!server.hasArg("plain")) {
+      server.send(400, "text/plain", "Missing schedule");
+      return;
+    }
+    const String &body = server.arg("plain");
+    ScheduleParseResult result = parseSchedule(body.c_str(), body.length(), spare, SCHEDULE_MAX_POINTS);
+    if (result.error) {
+      String message = result.errorLine > 0 ? "Line " + String(result.errorLine) + ": " : String();
+      server.send(400, "text/plain", message + result.error);
+      return;
+    }
+    if (!scheduleStore.save(spare, result.count)) {
+      server.send(500, "text/plain", "Saving schedule failed");
+      return;
+    }
+    points = spare;
+    count = result.count;
+  }
+
+  // A schedule of one's own replaces the astronomical one
+  storedPoints = points;
+  storedPointCount = count;
+  if (astroEnabled) {
+    astroEnabled = false;
+    astroBuiltDay = -1;
+    saveConfigSoon();
+  }
+  activateSchedule(points, count);
+  notifyStateChange(STATE_MODE);
+  logCommand(F("schedule"));
+  server.send(200, "text/plain", "OK");
+}
+
+// ?enabled=0|1&lat=..&lon=.. (degrees, north/east positive), any subset
+void handleAstro() {
+  bool enabled = astroEnabled;
+  int32_t latitude = astroLatitude;
+  int32_t longitude = astroLongitude;
+  bool any = false;
+
+  if (server.hasArg("enabled")) {
+    enabled = server.arg("enabled").toInt() != 0;
+    any = true;
+  }
+  if (server.hasArg("lat")) {
+    float value = server.arg("lat").toFloat();
+    if (value < -90.0f || value > 90.0f) {
+      server.send(400, "text/plain", "Invalid latitude");
+      return;
+    }
+    latitude = degreesToE4(value);
+    any = true;
+  }
+  if (server.hasArg("lon")) {
+    float value = server.arg("lon").toFloat();
+    if (value < -180.0f || value > 180.0f) {
+      server.send(400, "text/plain", "Invalid longitude");
+      return;
+    }
+    longitude = degreesToE4(value);
+    any = true;
+  }
+  if (!any) {
+    server.send(400, "text/plain", "Missing parameters");
+    return;
+  }
+
+  bool moved = latitude != astroLatitude || longitude != astroLongitude;
+  astroLatitude = latitude;
+  astroLongitude = longitude;
+  if (enabled != astroEnabled) {
+    setAstroEnabled(enabled);
+  } else if (moved) {
+    refreshAstroSchedule(true);
+  }
+  notifyStateChange(STATE_MODE);
+  saveConfigSoon();
+  if (testChannel < 0) {
+    refreshOutputs();
+  }
+
+  logCommand(F("astro"));
+  server.send(200, "text/plain", "OK");
+}
+
+// ?mode=off|clouds|storm&cover=0..100&seed=N, any subset
+void handleWeather() {
+  if (!WEATHER_EFFECTS) {
+    server.send(400, "text/plain", "Weather disabled at build time");
+    return;
+  }
+
+  WeatherMode mode = weather.mode();
+  uint8_t cover = weather.cover();
+  uint32_t seed = weather.seed();
+  bool any = false;
+
+  if (server.hasArg("mode")) {
+    mode = weatherFromString(server.arg("mode"));
+    if (mode == WEATHER_MODE_COUNT) {
+      server.send(400, "text/plain", "Invalid mode");
+      return;
+    }
+    any = true;
+  }
+  if (server.hasArg("cover")) {
+    long value = server.arg("cover").toInt();
+    if (value < 0 || value > 100) {
+      server.send(400, "text/plain", "Invalid cover");
+      return;
+    }
+    cover = static_cast<uint8_t>(value);
+    any = true;
+  }
+  if (server.hasArg("seed")) {
+    seed = strtoul(server.arg("seed").c_str(), nullptr, 10);
+    any = true;
+  }
+  if (!any) {
+    server.send(400, "text/plain", "Missing parameters");
+    return;
+  }
+
+  weather.configure(mode, cover, seed);
+  notifyStateChange(STATE_MODE);
+  saveConfigSoon();
+  if (testChannel < 0) {
+    refreshOutputs();
+  }
+
+  logCommand(F("weather"));
+  server.send(200, "text/plain", "OK");
+}
+
+// Manual mode with a preset's levels (?name=feeding|viewing|moonlight|
+// maintenance), faded over the preset's own time unless ?fade=<ms> is given
+void handleScene() {
+  if (!server.hasArg("name")) {
+    server.send(400, "text/plain", "Missing parameters");
+    return;
+  }
+  int index = sceneFromString(server.arg("name"));
+  if (index < 0) {
+    server.send(400, "text/plain", "Invalid scene");
+    return;
+  }
+  ScenePreset scene;
+  memcpy_P(&scene, &scenePresets[index], sizeof(scene));
+  uint32_t fadeMs;
+  if (!readFadeArg(fadeMs, scene.fadeSeconds * 1000UL)) {
+    server.send(400, "text/plain", "Invalid fade");
+    return;
+  }
+
+  startTransition(fadeMs);
+  autoMode = false;
+  manualLevel = {scene.level[0] / 1000.0f, scene.level[1] / 1000.0f, scene.level[2] / 1000.0f};
+  notifyStateChange(STATE_MODE | STATE_MANUAL);
+  saveConfigSoon();
+  if (testChannel < 0) {
+    refreshOutputs();
+  }
+
+  logCommand(F("scene"));
+  server.send(200, "text/plain", "OK");
+}
+
+void handleTest() {
+  if (!server.hasArg("channel")) {
+    server.send(400, "text/plain", "Missing channel");
+    return;
+  }
+
+  int ch = server.arg("channel").toInt();
+  if (ch < 0 || ch >= OUTPUT_CHANNELS) {
+    server.send(400, "text/plain", "Invalid channel");
     return;
   }
 
   triggerTestPulse(ch);
+  logCommand(F("test"));
   server.send(200, "text/plain", "OK");
 }
 
+// Several changes in one request, form encoded (body or query):
+//   auto=0|1  map=red,green,blue  r=..&g=..&b=.. (0-100)  test=<channel>
+//   fade=<ms>
+// An empty map entry keeps that channel; manual levels may be given singly.
+// Everything is validated before anything changes, the outputs are written
+// once and the answer is the new state, so the page needs no extra /state.
+void handleBatch() {
+  static const char *const levelArgs[3] = {"r", "g", "b"};
+
+  bool setMode = server.hasArg("auto");
+  bool newAutoMode = setMode ? server.arg("auto").toInt() != 0 : autoMode;
+
+  ChannelColor mapping[OUTPUT_CHANNELS];
+  for (int i = 0; i < OUTPUT_CHANNELS; ++i) mapping[i] = channels[i].mappedColor;
+  bool setMapping = server.hasArg("map");
+  if (setMapping) {
+    String list = server.arg("map");
+    int start = 0;
+    for (int i = 0; i < OUTPUT_CHANNELS; ++i) {
+      int end = list.indexOf(',', start);
+      if ((end < 0) != (i == OUTPUT_CHANNELS - 1)) {
+        server.send(400, "text/plain", "Invalid map");
+        return;
+      }
+      String name = end < 0 ? list.substring(start) : list.substring(start, end);
+      if (name.length() > 0) {
+        mapping[i] = colorFromString(name);
+        if (mapping[i] == COLOR_UNKNOWN && !name.equalsIgnoreCase("unknown")) {
+          server.send(400, "text/plain", "Invalid color");
+          return;
+        }
+      }
+      start = end + 1;
+    }
+  }
+
+  float levels[3] = {manualLevel.red, manualLevel.green, manualLevel.blue};
+  bool setManual = false;
+  for (int i = 0; i < 3; ++i) {
+    if (!server.hasArg(levelArgs[i])) continue;
+    levels[i] = clamp01(server.arg(levelArgs[i]).toInt() / 100.0f);
+    setManual = true;
+  }
+
+  int test = -1;
+  if (server.hasArg("test")) {
+    test = server.arg("test").toInt();
+    if (test < 0 || test >= OUTPUT_CHANNELS) {
+      server.send(400, "text/plain", "Invalid channel");
+      return;
+    }
+  }
+
+  uint32_t fadeMs;
+  if (!readFadeArg(fadeMs, TRANSITION_MS)) {
+    server.send(400, "text/plain", "Invalid fade");
+    return;
+  }
+
+  if (!setMode && !setMapping && !setManual && test < 0) {
+    server.send(400, "text/plain", "Missing parameters");
+    return;
+  }
+
+  // Only what actually changes is announced and saved
+  uint8_t fields = 0;
+  if (newAutoMode != autoMode) fields |= STATE_MODE;
+  for (int i = 0; i < OUTPUT_CHANNELS; ++i) {
+    if (mapping[i] != channels[i].mappedColor) fields |= STATE_CHANNELS;
+  }
+  if (levels[0] != manualLevel.red || levels[1] != manualLevel.green || levels[2] != manualLevel.blue) {
+    fields |= STATE_MANUAL;
+  }
+
+  if ((fields & STATE_MODE) || ((fields & STATE_MANUAL) && !newAutoMode)) {
+    startTransition(fadeMs);
+  }
+  autoMode = newAutoMode;
+  for (int i = 0; i < OUTPUT_CHANNELS; ++i) channels[i].mappedColor = mapping[i];
+  manualLevel = {levels[0], levels[1], levels[2]};
+  if (fields != 0) {
+    notifyStateChange(fields);
+    saveConfigSoon();
+  }
+
+  if (test >= 0) {
+    triggerTestPulse(test);
+  } else if (testChannel < 0) {
+    refreshOutputs();
+  }
+  logCommand(F("batch"));
+
+  server.sendHeader(ETAG_HEADER, currentStateEtag());
+  server.sendHeader(CACHE_CONTROL_HEADER, NO_CACHE);
+  sendState(false);
+}
+
 void handleUpdatePage() {
-  String status = lastUpdateError.length() ? ("<p class=\"error\">Laatste fout: " + lastUpdateError + "</p>") : "";
-  String html = R"rawliteral(
-<!DOCTYPE html>
-<html lang="nl">
-<head>
-  <meta charset="UTF-8" />
-  <meta name="viewport" content="width=device-width, initial-scale=1" />
-  <title>Firmware update</title>
-  <style>
-    body { font-family: Arial, sans-serif; margin: 32px; background:#f4f6f8; color:#333; }
-    .container { max-width: 420px; margin: 0 auto; background:#fff; padding:24px; border-radius:8px; box-shadow:0 2px 6px rgba(0,0,0,0.1); }
-    h1 { margin-top:0; }
-    form { display:flex; flex-direction:column; gap:16px; }
-    input[type=file] { padding:8px 0; }
-    button { padding:8px 16px; border:none; border-radius:4px; background:#1976d2; color:#fff; cursor:pointer; }
-    .back { margin-top:16px; display:inline-block; }
-    .error { margin-top:12px; color:#c62828; font-weight:bold; }
-  </style>
-</head>
-<body>
-  <div class="container">
-    <h1>Firmware update</h1>
-    <p>Selecteer een .bin bestand dat door PlatformIO/Arduino is gecompileerd.</p>
-    %STATUS%
-    <form method="POST" action="/update" enctype="multipart/form-data">
-      <input type="file" name="update" accept=".bin" required />
-      <button type="submit">Update starten</button>
-    </form>
-    <a class="back" href="/">&larr; Terug naar overzicht</a>
-  </div>
-</body>
-</html>
-)rawliteral";
-  html.replace("%STATUS%", status);
-  server.send(200, "text/html", html);
+  sendGzipAsset(UPDATE_HTML_GZ, UPDATE_HTML_GZ_LEN, UPDATE_HTML_ETAG, UPDATE_HTML_TYPE);
+}
+
+// Firmware upload (/update)
+//
+// The page sends the image in chunks (64 kB), each a multipart POST to
+// /update?size=..&md5=..&offset=... offset=0 starts a new
+// session; a later chunk must continue exactly where Update.progress() is,
+// so after a dropped connection the page asks /update/status how far it got
+// and resumes from there. The image is checked against the MD5 before it is
+// activated. gzip images (.bin.gz) are written as they are; the bootloader
+// unpacks them on the next boot.
+//
+// A plain form post without size still works: the image then ends with the
+// request and cannot be resumed.
+void writeUpdateStatus(JsonWriter &json) {
+  uint32_t received = Update.isRunning() ? Update.progress() : updateStats.received;
+  uint32_t bytesPerSec = updateStats.transferMs > 0 ? uint64_t(received) * 1000 / updateStats.transferMs : 0;
+
+  json.beginObject();
+  json.key(F("error"));       json.string(lastUpdateError.c_str());
+  json.key(F("running"));     json.value(Update.isRunning());
+  json.key(F("done"));        json.value(scheduler.pending(restartTask));
+  json.key(F("size"));        json.value(updateStats.size);
+  json.key(F("received"));    json.value(received);
+  json.key(F("compressed"));  json.value(updateStats.compressed);
+  json.key(F("resumes"));     json.value(updateStats.resumes);
+  json.key(F("transferMs"));  json.value(updateStats.transferMs);
+  json.key(F("bytesPerSec")); json.value(bytesPerSec);
+  json.key(F("flashMs"));     json.value(static_cast<uint32_t>(updateStats.flashUs / 1000));
+  json.key(F("maxStallUs"));  json.value(updateStats.maxStallUs);
+  json.endObject();
+}
+
+void sendUpdateStatus(int code) {
+  char body[320];
+  JsonWriter json(body, sizeof(body));
+  writeUpdateStatus(json);
+  server.send(code, "application/json", json.c_str(), json.length());
+}
+
+void handleUpdateStatus() {
+  sendUpdateStatus(200);
+}
+
+void restartNow() {
+  ESP.restart();
 }
 
+// An image that will not be activated: give the flash back and rejoin the
+// fade sync
+void failUpdate() {
+  Update.end();
+  startSync();
+}
+
+// A session nobody resumes gives the flash and the idle delay back
+void abandonUpdate() {
+  if (!Update.isRunning()) return;
+  updateStats.received = Update.progress();
+  failUpdate();
+  lastUpdateError = "Upload niet hervat";
+}
+
+// Runs after the upload handler has seen the whole request body
 void handleUpdatePost() {
+  if (updateChunkRejected) {
+    sendUpdateStatus(409);  // the page resumes from "received"
+    return;
+  }
   if (Update.hasError() || lastUpdateError.length()) {
     String message = lastUpdateError.length() ? lastUpdateError : ("Update mislukt: " + describeUpdateError());
     server.send(500, "text/plain", "Update mislukt. " + message);
@@ -608,47 +2082,108 @@ void handleUpdatePost() {
     return;
   }
 
+  if (scheduler.pending(restartTask)) {
+    // Restart from the scheduler so this answer still goes out and the
+    // lights keep running meanwhile
+    prepareForRestart();
+  }
+  sendUpdateStatus(200);
+}
+
+// Update.write() erases and programs flash whenever a sector fills up; the
+// loop (and the fade) waits meanwhile
+bool writeUpdate(uint8_t *data, size_t length) {
+  uint32_t start = micros();
+  bool ok = Update.write(data, length) == length;
+  uint32_t elapsed = micros() - start;
+  updateStats.flashUs += elapsed;
+  if (elapsed > updateStats.maxStallUs) updateStats.maxStallUs = elapsed;
+  return ok;
+}
+
+void beginUpdate() {
+  if (Update.isRunning()) Update.end();  // a new upload replaces an unfinished one
   lastUpdateError = "";
-  server.send(200, "text/plain", "Update geslaagd. Het apparaat herstart nu.");
-  delay(200);
-  ESP.restart();
+  updateStats = {};
+  updateStats.size = server.arg("size").toInt();
+  updateStats.startMs = millis();
+  stopSync();
+
+  size_t freeSpace = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
+  if (!Update.begin(updateStats.size > 0 ? updateStats.size : freeSpace)) {
+    lastUpdateError = "Kan update niet starten: " + describeUpdateError();
+    failUpdate();
+    return;
+  }
+  if (server.hasArg("md5") && !Update.setMD5(server.arg("md5").c_str())) {
+    lastUpdateError = "Ongeldige MD5";
+    failUpdate();
+  }
+}
+
+void finishUpdate() {
+  scheduler.cancel(updateTimeoutTask);
+  updateStats.received = Update.progress();
+  uint32_t start = micros();
+  bool ok = Update.end(updateStats.size == 0);  // without a size, whatever arrived is the image
+  updateStats.flashUs += micros() - start;
+  updateStats.transferMs = millis() - updateStats.startMs;
+  if (ok) {
+    scheduler.schedule(restartTask, UPDATE_RESTART_DELAY_MS * 1000);
+  } else {
+    lastUpdateError = "Afronden mislukt: " + describeUpdateError();
+    startSync();
+  }
 }
 
 void handleUpdateUpload() {
   HTTPUpload &upload = server.upload();
   switch (upload.status) {
     case UPLOAD_FILE_START: {
-      lastUpdateError = "";
-      WiFiUDP::stopAll();
-      size_t freeSpace = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
-      if (!Update.begin(freeSpace)) {
-        lastUpdateError = "Kan update niet starten: " + describeUpdateError();
-        Update.end();
+      uint32_t offset = server.arg("offset").toInt();
+      updateChunkRejected = false;
+      if (offset == 0) {
+        beginUpdate();
+      } else if (!Update.isRunning() || offset != Update.progress() || server.arg("size").toInt() != updateStats.size) {
+        updateChunkRejected = true;  // body is skipped, see handleUpdatePost()
+        break;
+      } else if (updateStats.interrupted) {
+        lastUpdateError = "";
+        updateStats.interrupted = false;
+        ++updateStats.resumes;
       }
+      scheduler.schedule(updateTimeoutTask, UPDATE_RESUME_TIMEOUT_MS * 1000);
       break;
     }
     case UPLOAD_FILE_WRITE: {
-      if (!Update.hasError()) {
-        if (Update.write(upload.buf, upload.currentSize) != upload.currentSize) {
-          lastUpdateError = "Schrijven mislukt: " + describeUpdateError();
-          Update.end();
-        }
+      if (updateChunkRejected || !Update.isRunning() || Update.hasError()) break;
+      if (Update.progress() == 0) updateStats.compressed = upload.buf[0] == 0x1f;  // gzip magic
+      if (!writeUpdate(upload.buf, upload.currentSize)) {
+        lastUpdateError = "Schrijven mislukt: " + describeUpdateError();
+        failUpdate();
+        break;
       }
+      updateStats.transferMs = millis() - updateStats.startMs;
+      scheduler.schedule(updateTimeoutTask, UPDATE_RESUME_TIMEOUT_MS * 1000);
+      serviceTasks();
       break;
     }
     case UPLOAD_FILE_END: {
-      if (!Update.hasError()) {
-        if (!Update.end(true)) {
-          lastUpdateError = "Afronden mislukt: " + describeUpdateError();
-        }
-      } else {
-        Update.end();
+      if (updateChunkRejected || !Update.isRunning()) break;
+      if (Update.hasError()) {
+        failUpdate();
+      } else if (updateStats.size == 0 || Update.progress() >= updateStats.size) {
+        finishUpdate();
       }
       break;
     }
     case UPLOAD_FILE_ABORTED: {
-      Update.end();
-      lastUpdateError = "Upload afgebroken";
+      if (updateStats.size == 0) {
+        failUpdate();
+        lastUpdateError = "Upload afgebroken";
+      } else {
+        updateStats.interrupted = true;  // the session stays open for the page to resume
+      }
       break;
     }
     default:
@@ -659,84 +2194,541 @@ void handleUpdateUpload() {
 }
 
 // ------------------------------------------------------------
-// Setup & Loop
+// Server-sent events (/events)
+//
+// Open pages keep one connection to /events and receive a compact JSON delta
+// whenever mode, mapping, manual levels, curves or outputs change, instead of
+// polling /state. The page falls back to polling when the stream drops.
 // ------------------------------------------------------------
-void connectWifi() {
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(ssid, password);
-  unsigned long startAttempt = millis();
+constexpr uint8_t EVENT_MAX_CLIENTS = 2;                // sockets are scarce on the ESP-01
+constexpr unsigned long EVENT_MIN_INTERVAL_MS = 100;    // pushStateEvents() period, coalesces bursts
+constexpr unsigned long EVENT_OUTPUT_INTERVAL_MS = 1000;  // fade ramps change outputs every tick
+constexpr unsigned long EVENT_KEEPALIVE_MS = 20000;
+
+// Fields a freshly connected page needs (status & stats still come from /state)
+constexpr uint8_t EVENT_FULL_FIELDS = STATE_MODE | STATE_MANUAL | STATE_CURVE | STATE_CHANNELS;
+
+struct EventClient {
+  WiFiClient client;
+  bool active;
+  bool needsFull;  // missed a delta (new or backpressured): send everything next time
+};
+
+EventClient eventClients[EVENT_MAX_CLIENTS];
+char eventJson[640 + (OUTPUT_CHANNELS > 3 ? OUTPUT_CHANNELS - 3 : 0) * CHANNEL_JSON_BYTES];
 
-  while (WiFi.status() != WL_CONNECTED && millis() - startAttempt < 20000) {
-    delay(500);
+void handleEvents() {
+  EventClient *slot = nullptr;
+  for (EventClient &c : eventClients) {
+    if (!c.active || !c.client.connected()) {
+      slot = &c;
+      break;
+    }
+  }
+  if (slot == nullptr) {
+    server.send(503, "text/plain", "Too many listeners");
+    return;
   }
+
+  slot->client = server.client();
+  slot->client.setNoDelay(true);
+  slot->active = true;
+  slot->needsFull = true;
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.sendContent_P(PSTR("HTTP/1.1 200 OK\r\n"
+                            "Content-Type: text/event-stream\r\n"
+                            "Cache-Control: no-cache\r\n"
+                            "Connection: keep-alive\r\n\r\n"
+                            "retry: 5000\n\n"));
+}
+
+size_t buildEvent(uint8_t fields) {
+  JsonWriter json(eventJson, sizeof(eventJson));
+  json.beginObject();
+  writeStateFields(json, fields);
+  json.endObject();
+  return json.overflowed() ? 0 : json.length();
+}
+
+// Write one frame without blocking; a full socket buffer marks the client for
+// a complete resync instead of stalling the light loop
+bool writeEvent(EventClient &c, const char *frame, size_t length) {
+  if (c.client.availableForWrite() < length) {
+    c.needsFull = true;
+    return false;
+  }
+  return c.client.write(reinterpret_cast<const uint8_t *>(frame), length) == length;
 }
 
+bool sendStateEvent(EventClient &c, size_t jsonLength) {
+  static const char prefix[] = "event: state\ndata: ";
+  if (c.client.availableForWrite() < sizeof(prefix) - 1 + jsonLength + 2) {
+    c.needsFull = true;
+    return false;
+  }
+  c.client.write(reinterpret_cast<const uint8_t *>(prefix), sizeof(prefix) - 1);
+  c.client.write(reinterpret_cast<const uint8_t *>(eventJson), jsonLength);
+  c.client.write(reinterpret_cast<const uint8_t *>("\n\n"), 2);
+  return true;
+}
+
+void pushStateEvents() {
+  static unsigned long lastOutputEvent = 0;
+  static unsigned long lastKeepAlive = 0;
+
+  unsigned long now = millis();
+  uint8_t fields = pendingEvents;
+  if (pendingOutputEvent && now - lastOutputEvent >= EVENT_OUTPUT_INTERVAL_MS) {
+    fields |= STATE_CHANNELS;
+  }
+
+  bool anyActive = false;
+  bool anyFull = false;
+  for (EventClient &c : eventClients) {
+    if (c.active && !c.client.connected()) {
+      c.active = false;
+      c.client.stop();
+    }
+    anyActive |= c.active;
+    anyFull |= c.active && c.needsFull;
+  }
+
+  if (!anyActive) {
+    pendingEvents = 0;
+    pendingOutputEvent = false;
+    return;
+  }
+
+  if (fields != 0 || anyFull) {
+    lastKeepAlive = now;
+    pendingEvents = 0;
+    if (fields & STATE_CHANNELS) {
+      pendingOutputEvent = false;
+      lastOutputEvent = now;
+    }
+
+    size_t deltaLength = fields != 0 ? buildEvent(fields) : 0;
+    for (EventClient &c : eventClients) {
+      if (c.active && !c.needsFull && deltaLength > 0) {
+        sendStateEvent(c, deltaLength);
+      }
+    }
+
+    if (anyFull) {
+      size_t fullLength = buildEvent(EVENT_FULL_FIELDS);
+      for (EventClient &c : eventClients) {
+        if (c.active && c.needsFull && fullLength > 0) {
+          c.needsFull = !sendStateEvent(c, fullLength);
+        }
+      }
+    }
+    return;
+  }
+
+  if (now - lastKeepAlive >= EVENT_KEEPALIVE_MS) {
+    lastKeepAlive = now;
+    for (EventClient &c : eventClients) {
+      if (c.active) writeEvent(c, ":\n\n", 3);
+    }
+  }
+}
+
+// ------------------------------------------------------------
+// Metrics (/metrics, Prometheus text format)
+//
+// loop() times its phases and onRoute() times every handler into fixed
+// bucket histograms (see metrics.h); everything else is read when scraped.
+// ------------------------------------------------------------
+enum LoopPhase : uint8_t {
+  PHASE_NETWORK,  // MDNS.update() + ArduinoOTA.handle()
+  PHASE_HTTP,     // server.handleClient(), including the handler
+  PHASE_TASKS,    // scheduler.run()
+  PHASE_LOOP,     // the whole iteration, without the idle delay()
+  PHASE_COUNT
+};
+
+const char *const loopPhaseLabels[PHASE_COUNT] = {
+  "phase=\"network\"", "phase=\"http\"", "phase=\"tasks\"", "phase=\"loop\""
+};
+
+LatencyHistogram loopLatency[PHASE_COUNT];
+
+struct RouteMetrics {
+  const char *uri;
+  HTTPMethod method;
+  LatencyHistogram latency;
+};
+
+constexpr uint8_t MAX_METERED_ROUTES = 20;
+RouteMetrics routeMetrics[MAX_METERED_ROUTES];
+uint8_t routeMetricsCount = 0;
+
+// task="<name>" (task names are flash strings)
+const char *taskLabel(char *out, size_t size, uint8_t index) {
+  char name[16];
+  strncpy_P(name, reinterpret_cast<PGM_P>(scheduler.task(index).name), sizeof(name) - 1);
+  name[sizeof(name) - 1] = '\0';
+  snprintf(out, size, "task=\"%s\"", name);
+  return out;
+}
+
+void sendMetricsChunk(const char *data, size_t length) {
+  server.sendContent(data, length);
+}
+
+void handleMetrics() {
+  static char chunk[512];
+  char labels[48];
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain; version=0.0.4", "");
+  PrometheusWriter<void (*)(const char *, size_t)> out(chunk, sizeof(chunk), sendMetricsChunk);
+
+  out.describe(F("aquarium_uptime_seconds"), F("gauge"), F("Time since boot"));
+  out.sample(F("aquarium_uptime_seconds"), nullptr, micros64() / 1000000);
+
+  out.describe(F("aquarium_heap_free_bytes"), F("gauge"), F("Free heap"));
+  out.sample(F("aquarium_heap_free_bytes"), nullptr, ESP.getFreeHeap());
+  out.describe(F("aquarium_heap_max_block_bytes"), F("gauge"), F("Largest allocatable heap block"));
+  out.sample(F("aquarium_heap_max_block_bytes"), nullptr, ESP.getMaxFreeBlockSize());
+  out.describe(F("aquarium_heap_fragmentation_percent"), F("gauge"), F("Heap fragmentation (0 = one free block)"));
+  out.sample(F("aquarium_heap_fragmentation_percent"), nullptr, ESP.getHeapFragmentation());
+
+  out.describe(F("aquarium_wifi_reconnects_total"), F("counter"), F("WiFi link losses since boot"));
+  out.sample(F("aquarium_wifi_reconnects_total"), nullptr, wifiReconnects);
+  if (WiFi.status() == WL_CONNECTED) {
+    out.describe(F("aquarium_wifi_rssi_dbm"), F("gauge"), F("WiFi signal strength"));
+    out.sample(F("aquarium_wifi_rssi_dbm"), nullptr, WiFi.RSSI());
+  }
+  if (lastSntpSyncMs != 0) {
+    out.describe(F("aquarium_ntp_sync_age_seconds"), F("gauge"), F("Time since the last NTP sync"));
+    out.sample(F("aquarium_ntp_sync_age_seconds"), nullptr, (millis() - lastSntpSyncMs) / 1000);
+  }
+
+  if (fadeSync.started()) {
+    out.describe(F("aquarium_sync_offset_milliseconds"), F("gauge"), F("Schedule clock correction towards the sync leader"));
+    out.sample(F("aquarium_sync_offset_milliseconds"), nullptr, fadeSync.offsetMs());
+    out.describe(F("aquarium_sync_leader"), F("gauge"), F("1 while this controller leads the fade sync"));
+    out.sample(F("aquarium_sync_leader"), nullptr, fadeSync.leading(millis()) ? 1 : 0);
+  }
+  if (weather.mode() != WEATHER_OFF) {
+    out.describe(F("aquarium_weather_quality"), F("gauge"), F("Weather detail steps given up for time (0 = full detail)"));
+    out.sample(F("aquarium_weather_quality"), nullptr, weather.quality());
+    out.describe(F("aquarium_weather_over_budget_total"), F("counter"), F("Fade ticks over budget with weather on"));
+    out.sample(F("aquarium_weather_over_budget_total"), nullptr, weather.stats().overBudget);
+  }
+
+  out.describe(F("aquarium_loop_seconds"), F("histogram"), F("loop() iteration time per phase"));
+  for (uint8_t i = 0; i < PHASE_COUNT; ++i) {
+    out.histogram(F("aquarium_loop_seconds"), loopPhaseLabels[i], loopLatency[i]);
+  }
+
+  const ResponseStreamStats &streamStats = responseStreams.stats();
+  out.describe(F("aquarium_http_streams"), F("gauge"), F("Responses being streamed"));
+  out.sample(F("aquarium_http_streams"), nullptr, responseStreams.active());
+  out.describe(F("aquarium_http_streams_total"), F("counter"), F("Streamed responses by outcome"));
+  out.sample(F("aquarium_http_streams_total"), "outcome=\"completed\"", streamStats.completed);
+  out.sample(F("aquarium_http_streams_total"), "outcome=\"rejected\"", streamStats.rejected);
+  out.sample(F("aquarium_http_streams_total"), "outcome=\"stalled\"", streamStats.stalled);
+  out.sample(F("aquarium_http_streams_total"), "outcome=\"dropped\"", streamStats.dropped);
+  out.describe(F("aquarium_http_stream_bytes_total"), F("counter"), F("Bytes written by streamed responses"));
+  out.sample(F("aquarium_http_stream_bytes_total"), nullptr, streamStats.bytes);
+
+  // Routes that were never requested are left out
+  out.describe(F("aquarium_http_request_seconds"), F("histogram"), F("Handler time per route"));
+  for (uint8_t i = 0; i < routeMetricsCount; ++i) {
+    if (routeMetrics[i].latency.total() == 0) continue;
+    snprintf(labels, sizeof(labels), "route=\"%s\",method=\"%s\"", routeMetrics[i].uri,
+             routeMetrics[i].method == HTTP_GET ? "GET" : "POST");
+    out.histogram(F("aquarium_http_request_seconds"), labels, routeMetrics[i].latency);
+  }
+
+  out.describe(F("aquarium_task_runs_total"), F("counter"), F("Scheduler task runs"));
+  for (uint8_t i = 0; i < scheduler.size(); ++i) {
+    out.sample(F("aquarium_task_runs_total"), taskLabel(labels, sizeof(labels), i), scheduler.task(i).stats.runs);
+  }
+  out.describe(F("aquarium_task_seconds_total"), F("counter"), F("Scheduler task run time"));
+  for (uint8_t i = 0; i < scheduler.size(); ++i) {
+    out.sampleSeconds(F("aquarium_task_seconds_total"), taskLabel(labels, sizeof(labels), i),
+                      scheduler.task(i).stats.totalUs);
+  }
+  out.describe(F("aquarium_task_late_max_seconds"), F("gauge"), F("Largest start delay past the deadline"));
+  for (uint8_t i = 0; i < scheduler.size(); ++i) {
+    out.sampleSeconds(F("aquarium_task_late_max_seconds"), taskLabel(labels, sizeof(labels), i),
+                      scheduler.task(i).stats.maxLateUs);
+  }
+
+  out.describe(F("aquarium_config_writes_total"), F("counter"), F("Settings records written to flash"));
+  out.sample(F("aquarium_config_writes_total"), nullptr, configWrites);
+
+  out.finish();
+  server.sendContent("");
+}
+
+// ------------------------------------------------------------
+// Setup & Loop
+// ------------------------------------------------------------
 void setupPwm() {
+#if OUTPUT_DRIVER == OUTPUT_PCA9685
+  Wire.begin(I2C_SDA_PIN, I2C_SCL_PIN);
+  Wire.setClock(I2C_CLOCK_HZ);
+  outputBackend.begin(PWM_FREQUENCY_HZ);  // a missing chip shows up as outputErrors
+#else
   analogWriteRange(PWM_MAX);
-  analogWriteFreq(1000);
-  for (uint8_t pin : channelPins) {
-    pinMode(pin, OUTPUT);
-    analogWrite(pin, 0);
+  analogWriteFreq(PWM_FREQUENCY_HZ);
+  for (int i = 0; i < OUTPUT_CHANNELS; ++i) {
+    pinMode(channelPins[i], OUTPUT);
   }
+#endif
+  outputs.reset();
+  outputs.flush();
 }
 
 void setupOta() {
   ArduinoOTA.setHostname(otaHostname);
   ArduinoOTA.onStart([]() {});
-  ArduinoOTA.onEnd([]() {});
+  ArduinoOTA.onEnd([]() { prepareForRestart(); });
   ArduinoOTA.onError([](ota_error_t error) {
     (void)error;
   });
   ArduinoOTA.begin();
 }
 
+// Register a route; the wrapper times the handler for /metrics and records
+// when the first request was answered
+void onRoute(const char *uri, HTTPMethod method, void (*handler)()) {
+  LatencyHistogram *latency = nullptr;
+  if (routeMetricsCount < MAX_METERED_ROUTES) {
+    RouteMetrics &route = routeMetrics[routeMetricsCount++];
+    route.uri = uri;
+    route.method = method;
+    latency = &route.latency;
+  }
+  server.on(uri, method, [handler, latency]() {
+    uint32_t start = micros();
+    handler();
+    if (latency) latency->record(micros() - start);
+    if (bootMetrics.firstHttpMs == 0) bootMetrics.firstHttpMs = bootTimestamp();
+  });
+}
+
 void setupServer() {
-  server.on("/", HTTP_GET, handleRoot);
-  server.on("/state", HTTP_GET, handleState);
-  server.on("/assign", HTTP_POST, handleAssign);
-  server.on("/manual", HTTP_POST, handleManual);
-  server.on("/mode", HTTP_POST, handleMode);
-  server.on("/test", HTTP_POST, handleTest);
-  server.on("/update", HTTP_GET, handleUpdatePage);
+  onRoute("/", HTTP_GET, handleRoot);
+  onRoute("/state", HTTP_GET, handleState);
+  onRoute("/events", HTTP_GET, handleEvents);
+  onRoute("/commands", HTTP_GET, handleCommands);
+  onRoute("/assign", HTTP_POST, handleAssign);
+  onRoute("/manual", HTTP_POST, handleManual);
+  onRoute("/mode", HTTP_POST, handleMode);
+  onRoute("/scene", HTTP_POST, handleScene);
+  onRoute("/test", HTTP_POST, handleTest);
+  onRoute("/batch", HTTP_POST, handleBatch);
+  onRoute("/curve", HTTP_POST, handleCurve);
+  onRoute("/dither", HTTP_POST, handleDither);
+  onRoute("/schedule", HTTP_GET, handleScheduleGet);
+  onRoute("/schedule", HTTP_POST, handleSchedulePost);
+  onRoute("/astro", HTTP_POST, handleAstro);
+  onRoute("/weather", HTTP_POST, handleWeather);
+  onRoute("/metrics", HTTP_GET, handleMetrics);
+  onRoute("/update", HTTP_GET, handleUpdatePage);
+  onRoute("/update/status", HTTP_GET, handleUpdateStatus);
   server.on("/update", HTTP_POST, handleUpdatePost, handleUpdateUpload);
   server.onNotFound([](){ server.send(404, "text/plain", "Not found"); });
+
+  static const char *headerKeys[] = {"If-None-Match"};
+  server.collectHeaders(headerKeys, 1);
   server.begin();
 }
 
-void setupTime() {
-  configTime(gmtOffsetSec, daylightOffsetSec, ntpServer);
-  unsigned long start = millis();
-  while (!time(nullptr) && millis() - start < 15000) {
-    delay(200);
+// ------------------------------------------------------------
+// Network bring-up
+//
+// Nothing here blocks: setup() only starts the association and NTP, and
+// updateNetwork() advances from loop(). The lights and the web server run
+// from the first loop iteration; mDNS and OTA start once the link is up.
+// ------------------------------------------------------------
+constexpr unsigned long NETWORK_POLL_MS = 50;
+constexpr unsigned long WIFI_RETRY_MS = 20000;  // restart the association after this long without a link
+constexpr unsigned long FAST_CONNECT_TIMEOUT_MS = 3000;  // cached BSSID/lease must work within this
+constexpr unsigned long LEASE_SETTLE_MS = 10000;  // DHCP after a fast connect has its lease by then
+
+enum NetState : uint8_t {
+  NET_CONNECTING,
+  NET_CONNECTED
+};
+
+NetState netState = NET_CONNECTING;
+unsigned long netStateSince = 0;
+bool networkServicesStarted = false;
+bool fastConnect = false;
+bool leaseSavePending = false;
+unsigned long dhcpStartedMs = 0;
+
+// After a warm restart, skip the scan and DHCP: join the cached BSSID on its
+// channel with the previous lease. Once that link is up the DHCP client is
+// switched back on, so the lease is renewed instead of being kept as a
+// static address past its expiry, and what it hands out is cached next.
+void startWifi() {
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(true);
+
+  fastConnect = rtcLoaded && (rtcState.flags & RTC_HAS_WIFI);
+  if (fastConnect) {
+    WiFi.config(IPAddress(rtcState.ip), IPAddress(rtcState.gateway), IPAddress(rtcState.subnet),
+                IPAddress(rtcState.dns));
+    WiFi.begin(ssid, password, rtcState.wifiChannel, rtcState.bssid, true);
+  } else {
+    WiFi.begin(ssid, password);
   }
-  timeSynced = time(nullptr) > 1000;
+  netState = NET_CONNECTING;
+  netStateSince = millis();
 }
 
-void setup() {
-  setupPwm();
-  connectWifi();
+// Fall back to a full scan with DHCP
+void restartWifi() {
+  if (fastConnect) {
+    fastConnect = false;
+    forgetRtcWifi();
+    WiFi.config(IPAddress(), IPAddress(), IPAddress());
+  }
+  WiFi.disconnect();
+  WiFi.begin(ssid, password);
+  netStateSince = millis();
+}
 
-  if (WiFi.isConnected()) {
-    if (MDNS.begin(otaHostname)) {
-      MDNS.addService("http", "tcp", 80);
-    }
-    setupOta();
-    setupServer();
-    setupTime();
+void startNetworkServices() {
+  if (MDNS.begin(otaHostname)) {
+    MDNS.addService("http", "tcp", 80);
+  }
+  setupOta();
+  networkServicesStarted = true;
+}
+
+void updateNetwork() {
+  bool connected = WiFi.status() == WL_CONNECTED;
+
+  switch (netState) {
+    case NET_CONNECTING:
+      if (connected) {
+        netState = NET_CONNECTED;
+        if (bootMetrics.wifiMs == 0) bootMetrics.wifiMs = bootTimestamp();
+        if (!networkServicesStarted) startNetworkServices();
+        if (!Update.isRunning()) startSync();  // an upload waiting to resume rejoins when it fails
+        if (fastConnect) {
+          fastConnect = false;
+          WiFi.config(IPAddress(), IPAddress(), IPAddress());
+          leaseSavePending = true;
+          dhcpStartedMs = millis();
+        } else {
+          leaseSavePending = false;
+          saveRtcWifi();
+        }
+        notifyStateChange(STATE_STATUS);
+      } else if (millis() - netStateSince >= (fastConnect ? FAST_CONNECT_TIMEOUT_MS : WIFI_RETRY_MS)) {
+        restartWifi();
+      }
+      break;
+
+    case NET_CONNECTED:
+      if (!connected) {
+        netState = NET_CONNECTING;
+        netStateSince = millis();
+        stopSync();
+        ++wifiReconnects;
+        notifyStateChange(STATE_STATUS);
+      } else if (leaseSavePending && millis() - dhcpStartedMs >= LEASE_SETTLE_MS) {
+        leaseSavePending = false;
+        saveRtcWifi();
+      }
+      break;
   }
 
-  updateAutoMode();
+  // SNTP runs in the background once the link is up
+  if (sntpSynced && !timeSynced) {
+    timeSynced = true;
+    bootMetrics.timeSyncMs = bootTimestamp();
+    if (timeRestored) learnRestoreError();
+    saveRtcState();
+    refreshAstroSchedule(true);
+    if (testChannel < 0) refreshOutputs();
+  }
 }
 
-void loop() {
-  ArduinoOTA.handle();
-  server.handleClient();
-  stopTestIfExpired();
+// Fade, dither and the response streams only run while they have something
+// to do
+void updateTaskStates() {
+  scheduler.setRunning(fadeTask, autoMode || transition.active());
+  scheduler.setRunning(ditherTask, DITHER_HZ > 0 && ditherEnabled);
+  scheduler.setRunning(httpTask, responseStreams.active() > 0);
+}
 
-  static unsigned long lastAutoUpdate = 0;
-  unsigned long nowMillis = millis();
-  if (autoMode && nowMillis - lastAutoUpdate > 30000) {
-    lastAutoUpdate = nowMillis;
-    updateAutoMode();
+void setupTasks() {
+  fadeTask = scheduler.every(F("fade"), FADE_TICK_MS * 1000, fadeTick, false);
+  ditherTask = scheduler.every(F("dither"), DITHER_FRAME_US, ditherFrame, false);
+  scheduler.every(F("events"), EVENT_MIN_INTERVAL_MS * 1000, pushStateEvents);
+  scheduler.every(F("network"), NETWORK_POLL_MS * 1000, updateNetwork);
+  scheduler.every(F("rtc"), RTC_SAVE_INTERVAL_MS * 1000, updateRtcState);
+  testTask = scheduler.once(F("test"), endTestPulse);
+  configTask = scheduler.once(F("config"), flushConfig);
+  restartTask = scheduler.once(F("restart"), restartNow);
+  updateTimeoutTask = scheduler.once(F("update"), abandonUpdate);
+  syncTask = scheduler.every(F("sync"), SYNC_POLL_MS * 1000, updateSync, false);
+  httpTask = scheduler.every(F("http"), RESPONSE_PUMP_MS * 1000, pumpResponses, false);
+  scheduler.every(F("astro"), ASTRO_CHECK_MS * 1000, updateAstro);
+#if OUTPUT_DRIVER == OUTPUT_PCA9685
+  scheduler.every(F("outputs"), OUTPUT_CHECK_MS * 1000, checkOutputs);
+#endif
+  updateTaskStates();
+}
+
+// Wait for the next deadline in delay(), which hands the time to the SDK
+// (WiFi modem sleep between beacons). CPU light sleep is not used: it stops
+// the PWM waveform generator. Capped so HTTP/OTA polling stays responsive.
+constexpr unsigned long IDLE_MAX_MS = 5;
+
+void idleUntilNextTask() {
+  if (Update.isRunning()) return;  // uploads come in as fast as we poll
+  uint32_t idle = scheduler.idleUs(IDLE_MAX_MS * 1000) / 1000;
+  if (idle > 0) {
+    delay(idle);
+    idleMs += idle;
+  }
+}
+
+void setup() {
+  bootId = ESP.random();
+  setupPwm();
+  loadConfig();
+  loadSchedule();
+  setupTasks();
+  restoreRtcState();
+  startWifi();
+  settimeofday_cb(onTimeSet);
+  configTime(gmtOffsetSec, daylightOffsetSec, ntpServer);
+  setupServer();
+  refreshAstroSchedule(true);  // a clock restored from RTC memory is good enough
+  startTransition(TRANSITION_MS);
+  refreshOutputs();
+}
+
+void loop() {
+  uint32_t loopStart = micros();
+  if (networkServicesStarted) {
+    MDNS.update();
+    ArduinoOTA.handle();
   }
+  uint32_t httpStart = micros();
+  server.handleClient();
+  uint32_t tasksStart = micros();
+  updateTaskStates();
+  scheduler.run();
+  uint32_t loopEnd = micros();
+
+  loopLatency[PHASE_NETWORK].record(httpStart - loopStart);
+  loopLatency[PHASE_HTTP].record(tasksStart - httpStart);
+  loopLatency[PHASE_TASKS].record(loopEnd - tasksStart);
+  loopLatency[PHASE_LOOP].record(loopEnd - loopStart);
+  idleUntilNextTask();
 }
\ No newline at end of file
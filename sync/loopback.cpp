@@ -0,0 +1,340 @@
+// Fade sync protocol test on loopback.
+//
+//   .pio/build/sync/program [options]
+//
+// Runs several FadeSync nodes (include/fade_sync.h) in one process, each
+// with its own UDP socket in the multicast group on 127.0.0.1, so every
+// announcement goes through the kernel as on the LAN. Time is simulated:
+// each node gets a clock that is off by up to --skew-ms and runs fast or
+// slow by up to --drift-ppm, and the nodes boot at random moments in the
+// first two seconds. --kill-leader stops the leader halfway, to watch
+// another node take over. --late-joiner boots one more node a quarter of
+// the way in, with a lower id than all the others: it has to lock to the
+// running leader and take over on the group's time, not its own.
+//
+// Every --report seconds it prints the leader, the spread of the nodes'
+// schedule times (largest minus smallest) and the datagrams sent. Exit
+// status: 0 when the run ends with one leader and a spread within
+// --tolerance-ms (with --late-joiner: the late node leads and the group's
+// time moved by no more than that either), 1 otherwise, 2 on usage or
+// socket errors.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <random>
+#include <vector>
+
+#include "fade_sync.h"
+
+namespace {
+
+constexpr const char *GROUP_IP = "239.255.72.81";  // as SYNC_MULTICAST_IP in src/main.cpp
+constexpr uint16_t DEFAULT_PORT = 4681;
+constexpr uint32_t STEP_MS = 20;                    // SYNC_POLL_MS
+constexpr uint32_t START_MS_OF_DAY = 12 * 3600000;
+constexpr uint32_t BOOT_SPREAD_MS = 2000;
+constexpr uint32_t LATE_JOINER_ID = 0x000C0FFE;   // below every id the others get
+
+struct Options {
+  int nodes = 4;
+  uint32_t seconds = 300;
+  uint32_t skewMs = 2000;
+  double driftPpm = 50;
+  double loss = 0;  // fraction of received datagrams dropped
+  bool killLeader = false;
+  bool lateJoiner = false;
+  int32_t toleranceMs = 50;
+  uint32_t reportSeconds = 10;
+  uint16_t port = DEFAULT_PORT;
+  uint32_t seed = 1;
+};
+
+struct Node {
+  FadeSync sync{0};
+  int socket = -1;
+  uint32_t id;
+  uint32_t bootMs;    // simulated time the node starts
+  int32_t skewMs;     // clock error at time 0
+  double drift;       // relative rate error
+  bool alive = true;
+};
+
+void usage(FILE *out) {
+  fprintf(out,
+          "usage: program [options]\n"
+          "  --nodes N          nodes on loopback (default 4)\n"
+          "  --seconds S        simulated run time (default 300)\n"
+          "  --skew-ms MS       largest initial clock error per node (default 2000)\n"
+          "  --drift-ppm PPM    largest clock rate error per node (default 50)\n"
+          "  --loss PERCENT     drop this share of received datagrams (default 0)\n"
+          "  --kill-leader      stop the leader halfway through\n"
+          "  --late-joiner      boot a node with the lowest id a quarter of the way in\n"
+          "  --tolerance-ms MS  largest final spread that passes (default 50)\n"
+          "  --report S         seconds between report lines (default 10)\n"
+          "  --port P           UDP port (default %u)\n"
+          "  --seed N           random seed (default 1)\n",
+          DEFAULT_PORT);
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (strcmp(arg, "--help") == 0) {
+      usage(stdout);
+      exit(0);
+    } else if (strcmp(arg, "--kill-leader") == 0) {
+      options.killLeader = true;
+      continue;
+    } else if (strcmp(arg, "--late-joiner") == 0) {
+      options.lateJoiner = true;
+      continue;
+    } else if (!value) {
+      fprintf(stderr, "unknown option or missing value: %s\n", arg);
+      return false;
+    } else if (strcmp(arg, "--nodes") == 0) {
+      options.nodes = atoi(value);
+    } else if (strcmp(arg, "--seconds") == 0) {
+      options.seconds = strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--skew-ms") == 0) {
+      options.skewMs = strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--drift-ppm") == 0) {
+      options.driftPpm = atof(value);
+    } else if (strcmp(arg, "--loss") == 0) {
+      options.loss = atof(value) / 100;
+    } else if (strcmp(arg, "--tolerance-ms") == 0) {
+      options.toleranceMs = atoi(value);
+    } else if (strcmp(arg, "--report") == 0) {
+      options.reportSeconds = strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--port") == 0) {
+      options.port = static_cast<uint16_t>(atoi(value));
+    } else if (strcmp(arg, "--seed") == 0) {
+      options.seed = strtoul(value, nullptr, 10);
+    } else {
+      fprintf(stderr, "unknown option: %s\n", arg);
+      return false;
+    }
+    ++i;
+  }
+  if (options.nodes < 1 || options.seconds == 0 || options.reportSeconds == 0) {
+    fprintf(stderr, "--nodes, --seconds and --report must be positive\n");
+    return false;
+  }
+  return true;
+}
+
+// A socket in the multicast group, sending and receiving on loopback.
+// SO_REUSEPORT lets every node bind the same port, like separate hosts.
+int openSocket(uint16_t port) {
+  int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) return -1;
+  int on = 1;
+  in_addr loopback;
+  inet_pton(AF_INET, "127.0.0.1", &loopback);
+  ip_mreq membership = {};
+  inet_pton(AF_INET, GROUP_IP, &membership.imr_multiaddr);
+  membership.imr_interface = loopback;
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 ||
+      bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &loopback, sizeof(loopback)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &on, sizeof(on)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// The node's own time of day, as msSinceMidnight() would report it
+int32_t localTime(const Node &node, uint32_t nowMs) {
+  double ms = START_MS_OF_DAY + node.skewMs + nowMs * (1 + node.drift);
+  int64_t wrapped = static_cast<int64_t>(ms) % MS_PER_DAY;
+  return static_cast<int32_t>(wrapped < 0 ? wrapped + MS_PER_DAY : wrapped);
+}
+
+bool running(const Node &node, uint32_t nowMs) {
+  return node.alive && nowMs >= node.bootMs;
+}
+
+// Wait briefly for datagrams sent this step, so delivery order does not
+// depend on the scheduler
+void settle(const std::vector<Node> &nodes) {
+  std::vector<pollfd> fds;
+  for (const Node &node : nodes) {
+    if (node.alive) fds.push_back({node.socket, POLLIN, 0});
+  }
+  poll(fds.data(), fds.size(), 1);
+}
+
+void receiveAll(Node &node, uint32_t nowMs, std::mt19937 &random, double loss) {
+  std::uniform_real_distribution<double> chance(0, 1);
+  uint8_t packet[64];
+  for (;;) {
+    ssize_t length = recv(node.socket, packet, sizeof(packet), MSG_DONTWAIT);
+    if (length < 0) break;
+    if (chance(random) < loss) continue;
+    node.sync.receive(packet, static_cast<size_t>(length), nowMs - node.bootMs, localTime(node, nowMs));
+  }
+}
+
+bool announce(Node &node, uint32_t nowMs, uint16_t port) {
+  uint8_t packet[SYNC_PACKET_SIZE];
+  size_t length = node.sync.announce(nowMs - node.bootMs, localTime(node, nowMs), packet, sizeof(packet));
+  if (length == 0) return false;
+  sockaddr_in group = {};
+  group.sin_family = AF_INET;
+  group.sin_port = htons(port);
+  inet_pton(AF_INET, GROUP_IP, &group.sin_addr);
+  sendto(node.socket, packet, length, 0, reinterpret_cast<sockaddr *>(&group), sizeof(group));
+  return true;
+}
+
+struct GroupState {
+  int leaders;
+  uint32_t leaderId;
+  int32_t spreadMs;  // largest minus smallest schedule time of the running nodes
+};
+
+GroupState groupState(const std::vector<Node> &nodes, uint32_t nowMs) {
+  GroupState state = {0, 0, 0};
+  bool haveReference = false;
+  int32_t reference = 0;
+  int32_t low = 0;
+  int32_t high = 0;
+  for (const Node &node : nodes) {
+    if (!running(node, nowMs)) continue;
+    uint32_t syncMs = nowMs - node.bootMs;
+    if (node.sync.leading(syncMs)) {
+      ++state.leaders;
+      state.leaderId = node.id;
+    }
+    int32_t time = node.sync.scheduleTime(localTime(node, nowMs));
+    if (!haveReference) {
+      reference = time;
+      haveReference = true;
+    }
+    int32_t delta = wrapDayDelta(time - reference);
+    if (delta < low) low = delta;
+    if (delta > high) high = delta;
+  }
+  state.spreadMs = high - low;
+  return state;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    usage(stderr);
+    return 2;
+  }
+
+  std::mt19937 random(options.seed);
+  std::uniform_int_distribution<int32_t> skew(-static_cast<int32_t>(options.skewMs),
+                                              static_cast<int32_t>(options.skewMs));
+  std::uniform_real_distribution<double> drift(-options.driftPpm * 1e-6, options.driftPpm * 1e-6);
+  std::uniform_int_distribution<uint32_t> boot(0, BOOT_SPREAD_MS);
+
+  uint32_t endMs = options.seconds * 1000;
+  std::vector<Node> nodes(options.nodes + (options.lateJoiner ? 1 : 0));
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    Node &node = nodes[i];
+    node.id = 0x00100000u + static_cast<uint32_t>(random() & 0xFFFFF);  // like chip ids: unrelated to boot order
+    node.bootMs = boot(random);
+    if (static_cast<int>(i) == options.nodes) {
+      node.id = LATE_JOINER_ID;
+      node.bootMs = endMs / 4;
+    }
+    node.skewMs = skew(random);
+    node.drift = drift(random);
+    node.socket = openSocket(options.port);
+    if (node.socket < 0) {
+      fprintf(stderr, "socket: %s\n", strerror(errno));
+      return 2;
+    }
+  }
+
+  printf("%8s %10s %10s %8s\n", "time s", "leader", "spread ms", "sent");
+  uint32_t reportMs = options.reportSeconds * 1000;
+  uint32_t sent = 0;
+  bool killed = false;
+  GroupState state = {0, 0, 0};
+  // The group's time against the leader's own clock when the late node
+  // boots; that leader stays and follows, so its offset is how far the
+  // group moved
+  const Node *firstLeader = nullptr;
+  int32_t firstLeaderOffsetMs = 0;
+
+  for (uint32_t now = 0; now <= endMs; now += STEP_MS) {
+    if (options.killLeader && !killed && now >= endMs / 2 && state.leaders == 1) {
+      for (Node &node : nodes) {
+        if (node.alive && node.id == state.leaderId) {
+          node.alive = false;
+          close(node.socket);
+          printf("%8.1f %08x stopped\n", now / 1000.0, static_cast<unsigned>(node.id));
+        }
+      }
+      killed = true;
+    }
+
+    // Announce first and receive in the same step: the datagrams arrive
+    // without the up to SYNC_POLL_MS a device takes to pick them up
+    bool anySent = false;
+    for (Node &node : nodes) {
+      if (!running(node, now)) continue;
+      if (!node.sync.started()) {
+        if (node.id == LATE_JOINER_ID && options.lateJoiner) {
+          for (const Node &other : nodes) {
+            if (other.alive && other.id == state.leaderId) firstLeader = &other;
+          }
+          if (firstLeader) firstLeaderOffsetMs = firstLeader->sync.offsetMs();
+          printf("%8.1f %08x boots\n", now / 1000.0, static_cast<unsigned>(node.id));
+        }
+        node.sync.begin(node.id, 0);
+      }
+      if (announce(node, now, options.port)) {
+        anySent = true;
+        ++sent;
+      }
+    }
+    if (anySent) settle(nodes);
+    for (Node &node : nodes) {
+      if (running(node, now)) receiveAll(node, now, random, options.loss);
+    }
+
+    state = groupState(nodes, now);
+    if (now % reportMs == 0) {
+      printf("%8.1f %08x %10d %8u\n", now / 1000.0, static_cast<unsigned>(state.leaderId), state.spreadMs, sent);
+    }
+  }
+
+  bool pass = state.leaders == 1 && state.spreadMs <= options.toleranceMs;
+  if (options.lateJoiner) {
+    int32_t movedMs = firstLeader ? wrapDayDelta(firstLeader->sync.offsetMs() - firstLeaderOffsetMs) : 0;
+    bool joined = state.leaderId == LATE_JOINER_ID && firstLeader && abs(movedMs) <= options.toleranceMs;
+    printf("late node %s, group moved %d ms\n", state.leaderId == LATE_JOINER_ID ? "leads" : "does not lead",
+           movedMs);
+    pass = pass && joined;
+  }
+  printf("%s: %d leader(s), spread %d ms (tolerance %d ms), %u datagrams in %u s\n", pass ? "PASS" : "FAIL",
+         state.leaders, state.spreadMs, options.toleranceMs, sent, options.seconds);
+  for (Node &node : nodes) {
+    if (node.alive) close(node.socket);
+  }
+  return pass ? 0 : 1;
+}
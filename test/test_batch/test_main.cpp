@@ -0,0 +1,180 @@
+// POST /batch (handleBatch() in src/main.cpp): partial maps and levels,
+// values that are already set, every way a request can be refused, and the
+// one output write for all of a request's changes.
+//
+//   pio test -e native -f test_batch
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include <stdio.h>
+#include <string>
+
+#include "daylight_curve.h"
+#include "dither.h"
+#include "host.h"
+
+// Firmware state and functions under test (src/main.cpp)
+void setup();
+void loop();
+uint16_t channelTarget(const PwmLevel &levels, int channel);
+extern PwmLevel wantedLevel;
+extern RGBLevel manualLevel;
+extern bool autoMode;
+extern bool configDirty;
+extern uint8_t pendingEvents;
+
+namespace {
+
+constexpr uint8_t CHANNELS = 3;
+constexpr uint8_t PINS[CHANNELS] = {0, 2, 3};  // channelPins in src/main.cpp
+constexpr uint8_t STATE_MODE = 1 << 1;         // StateField in src/main.cpp
+constexpr uint8_t STATE_MANUAL = 1 << 2;
+constexpr uint8_t STATE_CHANNELS = 1 << 5;
+constexpr uint8_t SAVED_FIELDS = STATE_MODE | STATE_MANUAL | STATE_CHANNELS;
+
+int batch(const char *query) {
+  return host::request(HTTP_POST, "/batch", query);
+}
+
+// The color code of output channel n in the last /batch or /state answer
+std::string channelColor(uint8_t n) {
+  const std::string &body = host::responseBody();
+  size_t at = body.find("\"channels\":[");
+  for (uint8_t i = 0; i <= n && at != std::string::npos; ++i) at = body.find("\"code\":\"", at + 1);
+  if (at == std::string::npos) return std::string();
+  at += 8;
+  return body.substr(at, body.find('"', at) - at);
+}
+
+void assertColors(const char *a, const char *b, const char *c) {
+  TEST_ASSERT_EQUAL_STRING(a, channelColor(0).c_str());
+  TEST_ASSERT_EQUAL_STRING(b, channelColor(1).c_str());
+  TEST_ASSERT_EQUAL_STRING(c, channelColor(2).c_str());
+}
+
+// Changes since the last call: what would be pushed and whether a save is due
+uint8_t announced() {
+  uint8_t fields = pendingEvents & SAVED_FIELDS;
+  pendingEvents = 0;
+  return fields;
+}
+
+bool saveDue() {
+  bool due = configDirty;
+  configDirty = false;
+  return due;
+}
+
+uint8_t pinWrites[CHANNELS];
+
+void countWrite(uint8_t pin, int) {
+  for (uint8_t c = 0; c < CHANNELS; ++c) {
+    if (PINS[c] == pin) ++pinWrites[c];
+  }
+}
+
+}  // namespace
+
+// Each test starts in manual mode at 50/40/30 % with red, green and blue
+// mapped in that order and nothing waiting to be announced or saved
+void setUp() {
+  TEST_ASSERT_EQUAL_INT(200, batch("auto=0&map=red,green,blue&r=50&g=40&b=30&fade=0"));
+  announced();
+  saveDue();
+}
+
+void tearDown() {}
+
+void test_partial_map_keeps_the_other_channels() {
+  TEST_ASSERT_EQUAL_INT(200, batch("map=,blue,"));
+  assertColors("red", "blue", "blue");
+  TEST_ASSERT_EQUAL_HEX8(STATE_CHANNELS, announced());
+  TEST_ASSERT_TRUE(saveDue());
+
+  TEST_ASSERT_EQUAL_INT(200, batch("map=unknown,,"));
+  assertColors("unknown", "blue", "blue");
+  TEST_ASSERT_EQUAL_HEX8(STATE_CHANNELS, announced());
+}
+
+void test_single_level_keeps_the_others() {
+  TEST_ASSERT_EQUAL_INT(200, batch("g=75&fade=0"));
+  TEST_ASSERT_EQUAL_FLOAT(0.5f, manualLevel.red);
+  TEST_ASSERT_EQUAL_FLOAT(0.75f, manualLevel.green);
+  TEST_ASSERT_EQUAL_FLOAT(0.3f, manualLevel.blue);
+  TEST_ASSERT_EQUAL_HEX8(STATE_MANUAL, announced());
+  TEST_ASSERT_TRUE(saveDue());
+}
+
+// Values a request repeats are neither announced nor saved again
+void test_unchanged_values_are_not_announced() {
+  TEST_ASSERT_EQUAL_INT(200, batch("auto=0&map=red,green,blue&r=50&g=40&b=30"));
+  TEST_ASSERT_EQUAL_HEX8(0, announced());
+  TEST_ASSERT_FALSE(saveDue());
+
+  TEST_ASSERT_EQUAL_INT(200, batch("auto=0&map=red,,blue&r=50&g=41"));
+  TEST_ASSERT_EQUAL_HEX8(STATE_MANUAL, announced());
+  TEST_ASSERT_TRUE(saveDue());
+
+  TEST_ASSERT_EQUAL_INT(200, batch("auto=1&map=red,green,blue&b=30"));
+  TEST_ASSERT_EQUAL_HEX8(STATE_MODE, announced());
+  TEST_ASSERT_TRUE(autoMode);
+}
+
+// A refused request changes nothing, the valid parts included
+void test_invalid_values_change_nothing() {
+  static const struct {
+    const char *query;
+    const char *error;
+  } refused[] = {
+      {"auto=1&map=red,green", "Invalid map"},
+      {"auto=1&map=red,green,blue,red", "Invalid map"},
+      {"auto=1&map=red,purple,blue", "Invalid color"},
+      {"r=90&test=3", "Invalid channel"},
+      {"r=90&test=-1", "Invalid channel"},
+      {"r=90&fade=-5", "Invalid fade"},
+      {"r=90&fade=99999999", "Invalid fade"},
+      {"fade=100", "Missing parameters"},
+      {"", "Missing parameters"},
+  };
+  for (const auto &request : refused) {
+    TEST_ASSERT_EQUAL_INT_MESSAGE(400, batch(request.query), request.query);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(request.error, host::responseBody().c_str(), request.query);
+    TEST_ASSERT_FALSE_MESSAGE(autoMode, request.query);
+    TEST_ASSERT_EQUAL_FLOAT_MESSAGE(0.5f, manualLevel.red, request.query);
+    TEST_ASSERT_EQUAL_HEX8_MESSAGE(0, announced(), request.query);
+    TEST_ASSERT_FALSE_MESSAGE(saveDue(), request.query);
+  }
+  TEST_ASSERT_EQUAL_INT(200, host::request(HTTP_GET, "/state"));
+  assertColors("red", "green", "blue");
+}
+
+// Mapping and levels together reach each pin in one write, with the result
+// of both
+void test_changes_write_the_outputs_once() {
+  for (uint8_t c = 0; c < CHANNELS; ++c) pinWrites[c] = 0;
+  host::onAnalogWrite(countWrite);
+  TEST_ASSERT_EQUAL_INT(200, batch("map=blue,green,red&r=10&g=20&b=60&fade=0"));
+  host::onAnalogWrite(nullptr);
+
+  for (uint8_t c = 0; c < CHANNELS; ++c) {
+    TEST_ASSERT_EQUAL_UINT8(1, pinWrites[c]);
+    TEST_ASSERT_EQUAL_INT(ditherRound(channelTarget(wantedLevel, c)), host::pwmValue(PINS[c]));
+  }
+  TEST_ASSERT_EQUAL_HEX8(STATE_MANUAL | STATE_CHANNELS, announced());
+  TEST_ASSERT_GREATER_THAN_UINT32(host::pwmValue(PINS[2]), host::pwmValue(PINS[0]));  // blue 60 % over red 10 %
+}
+
+int main() {
+  setup();
+  host::request(HTTP_POST, "/dither", "enabled=0");  // one write per change, no dither frames
+  for (int i = 0; i < 100; ++i) loop();               // connect, start tasks
+
+  UNITY_BEGIN();
+  RUN_TEST(test_partial_map_keeps_the_other_channels);
+  RUN_TEST(test_single_level_keeps_the_others);
+  RUN_TEST(test_unchanged_values_are_not_announced);
+  RUN_TEST(test_invalid_values_change_nothing);
+  RUN_TEST(test_changes_write_the_outputs_once);
+  return UNITY_END();
+}
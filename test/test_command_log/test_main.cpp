@@ -0,0 +1,159 @@
+// CommandLog (include/command_log.h) as a reader polling it with a cursor
+// sees it: what follows the cursor and how many entries were overwritten
+// before the reader got to them, across the ring wrapping around; and the
+// (boot id, sequence number) cursor of GET /commands in src/main.cpp.
+//
+//   pio test -e native -f test_command_log
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "command_log.h"
+#include "host.h"
+
+// Firmware state and functions under test (src/main.cpp)
+void setup();
+void loop();
+extern uint32_t bootId;
+
+namespace {
+
+constexpr uint8_t CAPACITY = 8;
+typedef CommandLog<CAPACITY, 1> Log;
+
+void record(Log &log, uint32_t count) {
+  for (uint32_t i = 0; i < count; ++i) log.append(F("test"), 0, 0).raw[0] = 0;
+}
+
+// The sequence numbers a reader at cursor gets, as it walks them
+uint32_t readAfter(const Log &log, uint32_t cursor, uint32_t &first) {
+  first = log.firstAfter(cursor);
+  uint32_t read = 0;
+  for (uint32_t sequence = first; sequence <= log.newest(); ++sequence) {
+    TEST_ASSERT_EQUAL_UINT32(sequence, log.at(sequence).sequence);
+    ++read;
+  }
+  return read;
+}
+
+// A number in the last answer
+unsigned long jsonNumber(const char *key) {
+  const std::string &body = host::responseBody();
+  size_t at = body.find(std::string("\"") + key + "\":");
+  TEST_ASSERT_TRUE_MESSAGE(at != std::string::npos, key);
+  return strtoul(body.c_str() + at + strlen(key) + 3, nullptr, 10);
+}
+
+// Entries in the last GET /commands answer
+int commandEntries() {
+  const std::string &body = host::responseBody();
+  int entries = 0;
+  for (size_t at = body.find("\"seq\":"); at != std::string::npos; at = body.find("\"seq\":", at + 1)) ++entries;
+  return entries;
+}
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_empty_log() {
+  Log log;
+  TEST_ASSERT_EQUAL_UINT32(0, log.newest());
+  TEST_ASSERT_EQUAL_UINT32(1, log.oldest());
+  TEST_ASSERT_EQUAL_UINT32(0, log.missedAfter(0));
+  uint32_t first;
+  TEST_ASSERT_EQUAL_UINT32(0, readAfter(log, 0, first));
+}
+
+void test_cursor_within_the_ring() {
+  Log log;
+  record(log, 5);
+  uint32_t first;
+  TEST_ASSERT_EQUAL_UINT32(5, readAfter(log, 0, first));
+  TEST_ASSERT_EQUAL_UINT32(1, first);
+  TEST_ASSERT_EQUAL_UINT32(2, readAfter(log, 3, first));
+  TEST_ASSERT_EQUAL_UINT32(4, first);
+  TEST_ASSERT_EQUAL_UINT32(0, readAfter(log, 5, first));
+  for (uint32_t cursor = 0; cursor <= 5; ++cursor) TEST_ASSERT_EQUAL_UINT32(0, log.missedAfter(cursor));
+}
+
+// Once the ring has wrapped, a reader that fell behind gets what is still
+// stored and the count of what was overwritten in between; together they
+// account for every entry since its cursor
+void test_wraparound_counts_the_missed_entries() {
+  Log log;
+  record(log, 3 * CAPACITY + 3);  // 27: 20 to 27 still stored
+  TEST_ASSERT_EQUAL_UINT32(3 * CAPACITY + 3, log.newest());
+  TEST_ASSERT_EQUAL_UINT32(2 * CAPACITY + 4, log.oldest());
+
+  for (uint32_t cursor = 0; cursor <= log.newest(); ++cursor) {
+    uint32_t first;
+    uint32_t read = readAfter(log, cursor, first);
+    uint32_t missed = log.missedAfter(cursor);
+    char message[32];
+    snprintf(message, sizeof(message), "cursor %u", static_cast<unsigned>(cursor));
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(log.newest() - cursor, missed + read, message);
+    TEST_ASSERT_TRUE_MESSAGE(first >= log.oldest(), message);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cursor + 1 + missed, first, message);
+    TEST_ASSERT_TRUE_MESSAGE(read <= CAPACITY, message);
+  }
+  TEST_ASSERT_EQUAL_UINT32(2 * CAPACITY + 3, log.missedAfter(0));
+  TEST_ASSERT_EQUAL_UINT32(1, log.missedAfter(2 * CAPACITY + 2));
+  TEST_ASSERT_EQUAL_UINT32(0, log.missedAfter(2 * CAPACITY + 3));  // just in time
+}
+
+void test_entries_land_in_their_slots() {
+  Log log;
+  record(log, CAPACITY - 1);
+  for (uint32_t round = 0; round < 3 * CAPACITY; ++round) {
+    log.append(F("test"), round, 0).raw[0] = static_cast<uint16_t>(round);
+    TEST_ASSERT_EQUAL_UINT32(round, log.at(log.newest()).ms);
+    TEST_ASSERT_EQUAL_UINT32(log.newest() - CAPACITY + 1, log.at(log.oldest()).sequence);
+  }
+}
+
+// A cursor only counts under the boot id it was read in: sequence numbers
+// start at 1 again after a restart
+void test_commands_cursor_carries_the_boot_id() {
+  host::request(HTTP_POST, "/manual", "r=10&g=20&b=30&fade=0");
+  host::request(HTTP_POST, "/manual", "r=11&g=20&b=30&fade=0");
+  TEST_ASSERT_EQUAL_INT(200, host::request(HTTP_GET, "/commands"));
+  int stored = commandEntries();
+  TEST_ASSERT_TRUE(stored >= 2);
+  TEST_ASSERT_EQUAL_UINT32(bootId, jsonNumber("boot"));
+
+  char query[64];
+  unsigned long newest = jsonNumber("newest");
+  snprintf(query, sizeof(query), "boot=%lu&after=%lu", static_cast<unsigned long>(bootId), newest - 1);
+  TEST_ASSERT_EQUAL_INT(200, host::request(HTTP_GET, "/commands", query));
+  TEST_ASSERT_EQUAL_INT(1, commandEntries());
+
+  // The same numbers from before a restart (another boot id): everything
+  snprintf(query, sizeof(query), "boot=%lu&after=%lu", static_cast<unsigned long>(bootId + 1), newest - 1);
+  TEST_ASSERT_EQUAL_INT(200, host::request(HTTP_GET, "/commands", query));
+  TEST_ASSERT_EQUAL_INT(stored, commandEntries());
+
+  TEST_ASSERT_EQUAL_INT(200, host::request(HTTP_GET, "/state"));  // where the page gets both halves
+  TEST_ASSERT_EQUAL_UINT32(bootId, jsonNumber("boot"));
+  TEST_ASSERT_EQUAL_UINT32(newest, jsonNumber("log"));
+}
+
+int main() {
+  setup();
+  for (int i = 0; i < 100; ++i) loop();  // connect, start tasks
+
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_log);
+  RUN_TEST(test_cursor_within_the_ring);
+  RUN_TEST(test_wraparound_counts_the_missed_entries);
+  RUN_TEST(test_entries_land_in_their_slots);
+  RUN_TEST(test_commands_cursor_carries_the_boot_id);
+  return UNITY_END();
+}
@@ -0,0 +1,236 @@
+// ConfigJournal (include/config_journal.h) on a flash that can lose power
+// in the middle of any write or erase: after every cut, the next load()
+// must come up with the last settings that were fully saved, or the ones
+// being saved, never with nothing.
+//
+//   pio test -e native -f test_config_journal
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "config_journal.h"
+
+namespace {
+
+constexpr uint32_t FIRST_SECTOR = 0x0000;
+constexpr uint32_t SECOND_SECTOR = 0x3000;  // need not follow the first
+constexpr uint32_t FLASH_BYTES = SECOND_SECTOR + CONFIG_SECTOR_SIZE;
+constexpr uint16_t SLOTS = CONFIG_SECTOR_SIZE / sizeof(ConfigRecord);
+
+uint8_t memory[FLASH_BYTES];
+int operations = 0;  // writes and erases since the last boot
+int cutAt = -1;      // the operation the power fails in; -1: never
+bool cutHalfway = false;
+bool powered = true;
+
+enum Outcome { DONE, HALF, NOTHING };
+
+Outcome nextOperation() {
+  if (!powered) return NOTHING;
+  if (operations++ != cutAt) return DONE;
+  powered = false;
+  return cutHalfway ? HALF : NOTHING;
+}
+
+// Flash as ConfigJournal sees it; writes can only clear bits
+struct CutFlash {
+  static bool read(uint32_t address, uint32_t *data, size_t size) {
+    memcpy(data, memory + address, size);
+    return true;
+  }
+
+  static bool write(uint32_t address, uint32_t *data, size_t size) {
+    Outcome outcome = nextOperation();
+    size_t bytes = outcome == DONE ? size : outcome == HALF ? size / 8 * 4 : 0;
+    const uint8_t *from = reinterpret_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < bytes; ++i) memory[address + i] &= from[i];
+    return outcome == DONE;
+  }
+
+  static bool erase(uint32_t address) {
+    Outcome outcome = nextOperation();
+    size_t bytes = outcome == DONE ? CONFIG_SECTOR_SIZE : outcome == HALF ? CONFIG_SECTOR_SIZE / 2 : 0;
+    memset(memory + address, 0xFF, bytes);
+    return outcome == DONE;
+  }
+};
+
+typedef ConfigJournal<CutFlash> Journal;
+
+// Power back on; the operation numbered cut (counted from here) fails
+void boot(int cut = -1, bool halfway = false) {
+  operations = 0;
+  cutAt = cut;
+  cutHalfway = halfway;
+  powered = true;
+}
+
+// Settings told apart by one number
+ConfigRecord settings(uint16_t id) {
+  ConfigRecord record;
+  memset(&record, 0xFF, sizeof(record));
+  record.autoMode = 1;
+  record.manual[0] = id;
+  return record;
+}
+
+uint16_t loadedId() {
+  Journal journal(FIRST_SECTOR, SECOND_SECTOR);
+  ConfigRecord record;
+  TEST_ASSERT_TRUE_MESSAGE(journal.load(record), "no settings after a reboot");
+  return record.manual[0];
+}
+
+// Saves ids first..last in order, through one journal as between two boots
+void save(Journal &journal, uint16_t first, uint16_t last) {
+  for (uint16_t id = first; id <= last; ++id) {
+    ConfigRecord record = settings(id);
+    TEST_ASSERT_TRUE(journal.append(record));
+  }
+}
+
+bool sectorErased(uint32_t address) {
+  for (uint32_t i = 0; i < CONFIG_SECTOR_SIZE; ++i) {
+    if (memory[address + i] != 0xFF) return false;
+  }
+  return true;
+}
+
+// The first sector full, the second holding leftovers, so that the next
+// save erases the second, writes there and then erases the first
+void fillFirstSector() {
+  memset(memory, 0xFF, sizeof(memory));
+  memset(memory + SECOND_SECTOR, 0x5A, 200);
+  Journal journal(FIRST_SECTOR, SECOND_SECTOR);
+  ConfigRecord record;
+  TEST_ASSERT_FALSE(journal.load(record));
+  save(journal, 1, SLOTS);
+  TEST_ASSERT_EQUAL_UINT16(SLOTS, journal.usedSlots());
+}
+
+// One save after a (simulated) reboot, with the power failing in operation cut
+bool saveWithCut(uint16_t id, int cut, bool halfway) {
+  Journal journal(FIRST_SECTOR, SECOND_SECTOR);
+  ConfigRecord record;
+  journal.load(record);
+  boot(cut, halfway);
+  record = settings(id);
+  bool saved = journal.append(record);
+  boot();
+  return saved;
+}
+
+}  // namespace
+
+void setUp() {
+  boot();
+  memset(memory, 0xFF, sizeof(memory));
+}
+
+void tearDown() {}
+
+void test_erased_flash_has_no_settings() {
+  Journal journal(FIRST_SECTOR, SECOND_SECTOR);
+  ConfigRecord record;
+  TEST_ASSERT_FALSE(journal.load(record));
+  TEST_ASSERT_EQUAL_UINT16(0, journal.usedSlots());
+}
+
+void test_load_returns_the_newest_record() {
+  Journal journal(FIRST_SECTOR, SECOND_SECTOR);
+  ConfigRecord record;
+  journal.load(record);
+  save(journal, 1, 5);
+  TEST_ASSERT_EQUAL_UINT16(5, loadedId());
+  TEST_ASSERT_EQUAL_UINT32(0, journal.erases());
+}
+
+void test_full_sector_continues_in_the_other() {
+  Journal journal(FIRST_SECTOR, SECOND_SECTOR);
+  ConfigRecord record;
+  journal.load(record);
+  save(journal, 1, SLOTS + 1);
+  TEST_ASSERT_EQUAL_UINT16(1, journal.usedSlots());
+  TEST_ASSERT_EQUAL_UINT32(1, journal.erases());  // the full one; the other was blank
+  TEST_ASSERT_TRUE(sectorErased(FIRST_SECTOR));
+  TEST_ASSERT_EQUAL_UINT16(SLOTS + 1, loadedId());
+
+  save(journal, SLOTS + 2, 2 * SLOTS + 1);  // and back to the first
+  TEST_ASSERT_EQUAL_UINT16(1, journal.usedSlots());
+  TEST_ASSERT_EQUAL_UINT32(2, journal.erases());
+  TEST_ASSERT_TRUE(sectorErased(SECOND_SECTOR));
+  TEST_ASSERT_EQUAL_UINT16(2 * SLOTS + 1, loadedId());
+}
+
+void test_power_cut_between_erase_and_write() {
+  fillFirstSector();
+  TEST_ASSERT_FALSE(saveWithCut(SLOTS + 1, 1, false));  // the second sector is erased, nothing written
+  TEST_ASSERT_TRUE(sectorErased(SECOND_SECTOR));
+  TEST_ASSERT_EQUAL_UINT16(SLOTS, loadedId());
+
+  TEST_ASSERT_TRUE(saveWithCut(SLOTS + 1, -1, false));
+  TEST_ASSERT_EQUAL_UINT16(SLOTS + 1, loadedId());
+}
+
+// Every operation of the move, cut before it starts and halfway through
+void test_power_cut_anywhere_in_a_move() {
+  for (int cut = 0; cut < 3; ++cut) {
+    for (int halfway = 0; halfway < 2; ++halfway) {
+      fillFirstSector();
+      bool saved = saveWithCut(SLOTS + 1, cut, halfway != 0);
+      uint16_t id = loadedId();
+      char message[64];
+      snprintf(message, sizeof(message), "cut in operation %d%s", cut, halfway ? ", halfway" : "");
+      TEST_ASSERT_TRUE_MESSAGE(id == SLOTS || id == SLOTS + 1, message);
+      if (saved) TEST_ASSERT_EQUAL_UINT16_MESSAGE(SLOTS + 1, id, message);
+
+      // And the journal carries on from whatever was left
+      TEST_ASSERT_TRUE_MESSAGE(saveWithCut(SLOTS + 2, -1, false), message);
+      TEST_ASSERT_EQUAL_UINT16_MESSAGE(SLOTS + 2, loadedId(), message);
+    }
+  }
+}
+
+void test_power_cut_in_an_append() {
+  Journal journal(FIRST_SECTOR, SECOND_SECTOR);
+  ConfigRecord record;
+  journal.load(record);
+  save(journal, 1, 3);
+  TEST_ASSERT_FALSE(saveWithCut(4, 0, true));  // a torn record
+  TEST_ASSERT_EQUAL_UINT16(3, loadedId());
+  TEST_ASSERT_TRUE(saveWithCut(5, -1, false));
+  TEST_ASSERT_EQUAL_UINT16(5, loadedId());
+}
+
+// The old layout stays in the first sector until its upgrade is saved in
+// the second
+void test_old_layout_survives_a_cut_upgrade() {
+  for (int cut = 0; cut < 3; ++cut) {
+    memset(memory, 0xFF, sizeof(memory));
+    ConfigRecordV1 old;
+    memset(&old, 0, sizeof(old));
+    old.magic = CONFIG_RECORD_MAGIC_V1;
+    old.sequence = 7;
+    old.manual[0] = 700;
+    old.crc = configRecordCrc(old);
+    memcpy(memory + FIRST_SECTOR, &old, sizeof(old));
+
+    TEST_ASSERT_EQUAL_UINT16(700, loadedId());
+    bool saved = saveWithCut(701, cut, true);
+    uint16_t id = loadedId();
+    TEST_ASSERT_TRUE(id == 700 || id == 701);
+    if (saved) TEST_ASSERT_EQUAL_UINT16(701, id);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_erased_flash_has_no_settings);
+  RUN_TEST(test_load_returns_the_newest_record);
+  RUN_TEST(test_full_sector_continues_in_the_other);
+  RUN_TEST(test_power_cut_between_erase_and_write);
+  RUN_TEST(test_power_cut_anywhere_in_a_move);
+  RUN_TEST(test_power_cut_in_an_append);
+  RUN_TEST(test_old_layout_survives_a_cut_upgrade);
+  return UNITY_END();
+}
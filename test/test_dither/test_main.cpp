@@ -0,0 +1,137 @@
+// The sigma-delta dither (include/dither.h) as the firmware runs it: manual
+// levels go through the perceptual curves into 14-bit channel targets, and
+// the frames the dither task writes to the pins must average to exactly
+// those targets.
+//
+//   pio test -e native -f test_dither
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include <stdio.h>
+
+#include "daylight_curve.h"
+#include "dither.h"
+#include "host.h"
+
+// Firmware state and functions under test (src/main.cpp)
+void setup();
+void loop();
+void ditherFrame();
+uint16_t channelTarget(const PwmLevel &levels, int channel);
+extern PwmLevel wantedLevel;
+
+namespace {
+
+constexpr uint8_t CHANNELS = 3;
+constexpr uint8_t PINS[CHANNELS] = {0, 2, 3};  // channelPins in src/main.cpp
+const char *const CURVES[] = {"linear", "cie1931", "gamma22", "gamma28"};
+
+void request(HTTPMethod method, const char *uri, const char *query) {
+  TEST_ASSERT_EQUAL_INT_MESSAGE(200, host::request(method, uri, query), uri);
+}
+
+void setCurve(const char *curve) {
+  char query[64];
+  snprintf(query, sizeof(query), "red=%s&green=%s&blue=%s", curve, curve, curve);
+  request(HTTP_POST, "/curve", query);
+}
+
+void setManual(int red, int green, int blue) {
+  char query[48];
+  snprintf(query, sizeof(query), "r=%d&g=%d&b=%d&fade=0", red, green, blue);
+  request(HTTP_POST, "/manual", query);
+}
+
+// Time-weighted pin values while the scheduler runs the dither task
+uint64_t lastChangeUs[CHANNELS];
+int lastValue[CHANNELS];
+double countUs[CHANNELS];
+
+void recordWrite(uint8_t pin, int value) {
+  for (uint8_t c = 0; c < CHANNELS; ++c) {
+    if (PINS[c] != pin) continue;
+    uint64_t now = host::nowMicros();
+    countUs[c] += static_cast<double>(lastValue[c]) * (now - lastChangeUs[c]);
+    lastChangeUs[c] = now;
+    lastValue[c] = value;
+  }
+}
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+// Every DITHER_ONE frames of ditherFrame() (the dither task's body) write
+// counts that sum to the channel's target, for every curve and a spread of
+// levels, whatever the modulator's state when the level changed
+void test_frames_average_to_the_target() {
+  uint32_t fractional = 0;
+  for (const char *curve : CURVES) {
+    setCurve(curve);
+    for (int percent = 0; percent <= 100; ++percent) {
+      setManual(percent, (percent * 37) % 101, (percent * 59) % 101);
+      for (uint8_t c = 0; c < CHANNELS; ++c) {
+        uint16_t target = channelTarget(wantedLevel, c);
+        if (target & DITHER_MASK) ++fractional;
+        for (int round = 0; round < 2; ++round) {
+          uint32_t sum = 0;
+          for (uint16_t frame = 0; frame < DITHER_ONE; ++frame) {
+            ditherFrame();
+            sum += host::pwmValue(PINS[c]);
+          }
+          char message[64];
+          snprintf(message, sizeof(message), "%s, %d %%, channel %u", curve, percent, c);
+          TEST_ASSERT_EQUAL_UINT32_MESSAGE(target, sum, message);
+        }
+      }
+    }
+  }
+  TEST_ASSERT_GREATER_THAN_UINT32(CHANNELS * 100, fractional);  // most targets do need the dither
+}
+
+// Run by the scheduler from loop(), the task writes DITHER_HZ frames a
+// second and the pins' time-averaged count is the target to well within one
+// fraction step
+void test_dither_task_duty_cycle() {
+  setCurve("cie1931");
+  setManual(37, 11, 83);
+  uint16_t targets[CHANNELS];
+  for (uint8_t c = 0; c < CHANNELS; ++c) {
+    targets[c] = channelTarget(wantedLevel, c);
+    lastValue[c] = host::pwmValue(PINS[c]);
+    lastChangeUs[c] = host::nowMicros();
+    countUs[c] = 0;
+  }
+
+  host::onAnalogWrite(recordWrite);
+  uint64_t startUs = host::nowMicros();
+  uint64_t endUs = startUs + 2000000;
+  while (host::nowMicros() < endUs) loop();
+  uint64_t elapsedUs = host::nowMicros() - startUs;
+  for (uint8_t c = 0; c < CHANNELS; ++c) recordWrite(PINS[c], host::pwmValue(PINS[c]));
+  host::onAnalogWrite(nullptr);
+
+  for (uint8_t c = 0; c < CHANNELS; ++c) {
+    double average = countUs[c] / elapsedUs * DITHER_ONE;
+    char message[80];
+    snprintf(message, sizeof(message), "channel %u: target %u, averaged %.3f", c, targets[c], average);
+    TEST_ASSERT_TRUE_MESSAGE(average > targets[c] - 0.25 && average < targets[c] + 0.25, message);
+  }
+}
+
+int main() {
+  setup();
+  host::request(HTTP_POST, "/assign", "channel=0&color=red");
+  host::request(HTTP_POST, "/assign", "channel=1&color=green");
+  host::request(HTTP_POST, "/assign", "channel=2&color=blue");
+  host::request(HTTP_POST, "/mode", "auto=0&fade=0");
+  for (int i = 0; i < 100; ++i) loop();  // connect, start tasks
+
+  UNITY_BEGIN();
+  RUN_TEST(test_frames_average_to_the_target);
+  RUN_TEST(test_dither_task_duty_cycle);
+  return UNITY_END();
+}
@@ -0,0 +1,245 @@
+// OutputDriver<N, Pca9685<TwoWire>> (include/output_driver.h) against the
+// Wire stand-in in host/, whose devices keep the registers written to them
+// and count completed transmissions: what reaches the chip, and how often,
+// and how a chip that reset itself is found and set up again.
+//
+//   pio test -e native -f test_pca9685
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <unity.h>
+
+#include "host.h"
+#include "output_driver.h"
+
+namespace {
+
+constexpr uint8_t ADDRESS = 0x40;
+constexpr uint8_t WIDE_ADDRESS = 0x41;  // a second chip for the 16-channel burst
+constexpr uint32_t FREQUENCY_HZ = 1000;
+constexpr uint8_t SETUP_TRANSACTIONS = 4;  // MODE1 sleep, PRESCALE, MODE2, MODE1 awake
+constexpr uint8_t VERIFY_TRANSACTIONS = 2;  // select MODE1, read it
+
+typedef Pca9685<TwoWire> Chip;
+
+uint8_t channelRegister(uint8_t address, uint8_t channel, uint8_t offset) {
+  return host::i2cRegister(address, PCA9685_LED0_ON_L + 4 * channel + offset);
+}
+
+// ON and OFF of a channel as the chip holds them, full bits included
+uint16_t onCount(uint8_t address, uint8_t channel) {
+  return channelRegister(address, channel, 0) | channelRegister(address, channel, 1) << 8;
+}
+
+uint16_t offCount(uint8_t address, uint8_t channel) {
+  return channelRegister(address, channel, 2) | channelRegister(address, channel, 3) << 8;
+}
+
+void assertCounts(uint8_t address, uint8_t channel, uint16_t on, uint16_t off) {
+  TEST_ASSERT_EQUAL_HEX16(on, onCount(address, channel));
+  TEST_ASSERT_EQUAL_HEX16(off, offCount(address, channel));
+}
+
+void assertFullOff(uint8_t address, uint8_t channel) {
+  assertCounts(address, channel, 0, PCA9685_FULL << 8);
+}
+
+void assertFullOn(uint8_t address, uint8_t channel) {
+  assertCounts(address, channel, PCA9685_FULL << 8, 0);
+}
+
+// What a brownout leaves (datasheet 7.3): MODE1 asleep with ALLCALL, MODE2
+// open-drain off, the default prescaler and every channel full off; the
+// chip answers on the bus all the while
+void powerOnReset(uint8_t address) {
+  host::setI2cRegister(address, PCA9685_MODE1, 0x11);
+  host::setI2cRegister(address, PCA9685_MODE2, 0x04);
+  host::setI2cRegister(address, PCA9685_PRESCALE, 0x1E);
+  for (uint8_t channel = 0; channel < 16; ++channel) {
+    for (uint8_t offset = 0; offset < 4; ++offset) {
+      host::setI2cRegister(address, PCA9685_LED0_ON_L + 4 * channel + offset, offset == 3 ? PCA9685_FULL : 0);
+    }
+  }
+}
+
+// Transactions that one call of fn puts on the bus
+template <typename Fn>
+uint32_t transactionsOf(Fn fn) {
+  uint32_t before = host::i2cTransactions();
+  fn();
+  return host::i2cTransactions() - before;
+}
+
+// Each test starts with a chip that answers, set up, and all eight
+// channels flushed once (full off)
+Chip chip(Wire, ADDRESS);
+OutputDriver<8, Chip> outputs(chip);
+
+}  // namespace
+
+void setUp() {
+  host::setI2cPresent(ADDRESS, true);
+  chip.begin(FREQUENCY_HZ);
+  outputs.reset();
+  outputs.flush();
+}
+
+void tearDown() {}
+
+void test_begin_sets_up_the_chip() {
+  bool started = false;
+  TEST_ASSERT_EQUAL_UINT32(SETUP_TRANSACTIONS, transactionsOf([&]() { started = chip.begin(FREQUENCY_HZ); }));
+  TEST_ASSERT_TRUE(started);
+  TEST_ASSERT_EQUAL_HEX8(pca9685Prescale(FREQUENCY_HZ), host::i2cRegister(ADDRESS, PCA9685_PRESCALE));
+  TEST_ASSERT_EQUAL_HEX8(PCA9685_MODE1_AUTO_INCREMENT, host::i2cRegister(ADDRESS, PCA9685_MODE1));
+  TEST_ASSERT_EQUAL_HEX8(PCA9685_MODE2_OUTDRV, host::i2cRegister(ADDRESS, PCA9685_MODE2));
+}
+
+void test_reset_sends_every_channel_in_one_burst() {
+  uint32_t writesBefore = outputs.stats().channelWrites;
+  outputs.reset();
+  TEST_ASSERT_EQUAL_UINT32(1, transactionsOf([]() { outputs.flush(); }));
+  TEST_ASSERT_EQUAL_UINT32(8, outputs.stats().channelWrites - writesBefore);
+  for (uint8_t channel = 0; channel < 8; ++channel) assertFullOff(ADDRESS, channel);
+}
+
+void test_unchanged_channels_stay_off_the_bus() {
+  TEST_ASSERT_EQUAL_UINT32(0, transactionsOf([]() { outputs.flush(); }));
+  outputs.set(3, 0);  // its current count
+  TEST_ASSERT_FALSE(outputs.dirty());
+  TEST_ASSERT_EQUAL_UINT32(0, transactionsOf([]() { outputs.flush(); }));
+
+  uint32_t writesBefore = outputs.stats().channelWrites;
+  outputs.set(6, 1);
+  TEST_ASSERT_EQUAL_UINT32(1, transactionsOf([]() { outputs.flush(); }));
+  TEST_ASSERT_EQUAL_UINT32(1, outputs.stats().channelWrites - writesBefore);
+  assertCounts(ADDRESS, 6, 0, 1);
+}
+
+void test_changes_go_in_one_burst_from_first_to_last() {
+  outputs.set(6, 1);
+  outputs.flush();
+  uint32_t writesBefore = outputs.stats().channelWrites;
+  outputs.set(2, 1000);
+  outputs.set(5, 2000);
+  TEST_ASSERT_EQUAL_UINT32(1, transactionsOf([]() { outputs.flush(); }));
+  TEST_ASSERT_EQUAL_UINT32(4, outputs.stats().channelWrites - writesBefore);  // 2 to 5
+  assertCounts(ADDRESS, 2, 0, 1000);
+  assertCounts(ADDRESS, 5, 0, 2000);
+  assertFullOff(ADDRESS, 3);  // rewritten with the value it had
+  assertFullOff(ADDRESS, 4);
+  assertCounts(ADDRESS, 6, 0, 1);
+}
+
+void test_full_on_and_full_off_bits() {
+  outputs.set(5, 4095);
+  outputs.flush();
+  assertFullOn(ADDRESS, 5);
+
+  outputs.set(0, 60000);
+  outputs.flush();
+  TEST_ASSERT_EQUAL_UINT16(4095, outputs.get(0));
+  assertFullOn(ADDRESS, 0);
+
+  outputs.set(5, 0);
+  outputs.flush();
+  assertFullOff(ADDRESS, 5);
+}
+
+void test_sixteen_channels_fit_one_transaction() {
+  Chip wide(Wire, WIDE_ADDRESS);
+  OutputDriver<16, Chip> wideOutputs(wide);
+  wide.begin(FREQUENCY_HZ);
+  for (uint8_t channel = 0; channel < 16; ++channel) wideOutputs.set(channel, 256 * channel + 1);
+  TEST_ASSERT_EQUAL_UINT32(1, transactionsOf([&]() { wideOutputs.flush(); }));  // 65 bytes
+  for (uint8_t channel = 0; channel < 16; ++channel) assertCounts(WIDE_ADDRESS, channel, 0, 256 * channel + 1);
+}
+
+void test_failed_transfer_sets_the_chip_up_again() {
+  uint32_t errorsBefore = outputs.stats().errors;
+  host::setI2cPresent(ADDRESS, false);
+  outputs.set(7, 2000);
+  bool flushed = true;
+  TEST_ASSERT_EQUAL_UINT32(0, transactionsOf([&]() { flushed = outputs.flush(); }));
+  TEST_ASSERT_FALSE(flushed);
+  TEST_ASSERT_EQUAL_UINT32(errorsBefore + 1, outputs.stats().errors);
+  TEST_ASSERT_TRUE(outputs.dirty());
+
+  host::setI2cPresent(ADDRESS, true);
+  TEST_ASSERT_EQUAL_UINT32(SETUP_TRANSACTIONS + 1, transactionsOf([&]() { flushed = outputs.flush(); }));
+  TEST_ASSERT_TRUE(flushed);
+  TEST_ASSERT_EQUAL_HEX8(PCA9685_MODE1_AUTO_INCREMENT, host::i2cRegister(ADDRESS, PCA9685_MODE1));
+  assertCounts(ADDRESS, 7, 0, 2000);
+
+  outputs.set(7, 2001);
+  TEST_ASSERT_EQUAL_UINT32(1, transactionsOf([]() { outputs.flush(); }));
+}
+
+void test_verify_leaves_a_set_up_chip_alone() {
+  outputs.set(1, 1234);
+  outputs.flush();
+  bool verified = false;
+  TEST_ASSERT_EQUAL_UINT32(VERIFY_TRANSACTIONS, transactionsOf([&]() { verified = outputs.verify(); }));
+  TEST_ASSERT_TRUE(verified);
+  TEST_ASSERT_FALSE(outputs.dirty());
+
+  host::setI2cRegister(ADDRESS, PCA9685_MODE1, PCA9685_MODE1_AUTO_INCREMENT | 0x80);  // RESTART pending
+  TEST_ASSERT_TRUE(outputs.verify());
+}
+
+// Writes after a brownout are acknowledged but do nothing to the channels
+// that did not change; verify() finds it, sets the chip up and has every
+// channel written again
+void test_verify_restores_a_chip_that_reset_itself() {
+  outputs.set(2, 1000);
+  outputs.set(4, 4095);
+  outputs.flush();
+  powerOnReset(ADDRESS);
+  outputs.set(6, 3000);
+  TEST_ASSERT_TRUE(outputs.flush());
+  assertFullOff(ADDRESS, 2);
+
+  bool verified = true;
+  TEST_ASSERT_EQUAL_UINT32(VERIFY_TRANSACTIONS + SETUP_TRANSACTIONS,
+                           transactionsOf([&]() { verified = outputs.verify(); }));
+  TEST_ASSERT_FALSE(verified);
+  TEST_ASSERT_TRUE(outputs.dirty());
+  TEST_ASSERT_EQUAL_HEX8(PCA9685_MODE1_AUTO_INCREMENT, host::i2cRegister(ADDRESS, PCA9685_MODE1));
+  TEST_ASSERT_EQUAL_HEX8(pca9685Prescale(FREQUENCY_HZ), host::i2cRegister(ADDRESS, PCA9685_PRESCALE));
+  TEST_ASSERT_EQUAL_HEX8(PCA9685_MODE2_OUTDRV, host::i2cRegister(ADDRESS, PCA9685_MODE2));
+
+  TEST_ASSERT_EQUAL_UINT32(1, transactionsOf([]() { outputs.flush(); }));
+  assertCounts(ADDRESS, 2, 0, 1000);
+  assertFullOn(ADDRESS, 4);
+  assertCounts(ADDRESS, 6, 0, 3000);
+  assertFullOff(ADDRESS, 0);
+  assertFullOff(ADDRESS, 7);
+  TEST_ASSERT_TRUE(outputs.verify());
+}
+
+// A chip that does not answer the read is set up at the next write
+void test_verify_of_a_missing_chip() {
+  host::setI2cPresent(ADDRESS, false);
+  TEST_ASSERT_FALSE(outputs.verify());
+  TEST_ASSERT_TRUE(outputs.dirty());
+  TEST_ASSERT_FALSE(outputs.flush());
+
+  host::setI2cPresent(ADDRESS, true);
+  TEST_ASSERT_EQUAL_UINT32(SETUP_TRANSACTIONS + 1, transactionsOf([]() { outputs.flush(); }));
+  TEST_ASSERT_TRUE(outputs.verify());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_begin_sets_up_the_chip);
+  RUN_TEST(test_reset_sends_every_channel_in_one_burst);
+  RUN_TEST(test_unchanged_channels_stay_off_the_bus);
+  RUN_TEST(test_changes_go_in_one_burst_from_first_to_last);
+  RUN_TEST(test_full_on_and_full_off_bits);
+  RUN_TEST(test_sixteen_channels_fit_one_transaction);
+  RUN_TEST(test_failed_transfer_sets_the_chip_up_again);
+  RUN_TEST(test_verify_leaves_a_set_up_chip_alone);
+  RUN_TEST(test_verify_restores_a_chip_that_reset_itself);
+  RUN_TEST(test_verify_of_a_missing_chip);
+  return UNITY_END();
+}
@@ -0,0 +1,99 @@
+// evaluateSchedule() (src/main.cpp) against the float evaluation the
+// fixed-point curve replaced (include/daylight_curve.h), on the schedule the
+// firmware actually runs: every second of a day as the fade engine walks it,
+// and at scattered times as after a clock jump.
+//
+//   pio test -e native -f test_schedule
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include <stdlib.h>
+
+#include "daylight_curve.h"
+#include "dither.h"
+#include "host.h"
+
+// Firmware state and functions under test (src/main.cpp)
+void setup();
+PwmLevel evaluateSchedule(int32_t msOfDay);
+extern const SchedulePoint *schedulePoints;
+extern size_t schedulePointCount;
+
+namespace {
+
+constexpr uint16_t PWM_MAX_COUNT = 1023;  // PWM_MAX in src/main.cpp
+constexpr float FRACTION_ONE = 1 << DITHER_BITS;
+constexpr uint32_t WALK_STEP_MS = 1000;
+constexpr uint32_t SCATTERED_SAMPLES = 20000;
+
+// The float path at millisecond resolution, in PWM counts: straight lines
+// between the points' levels, the last segment wrapping past midnight
+float referenceLevel(const SchedulePoint *points, size_t count, uint32_t msOfDay, uint8_t channel) {
+  float minute = msOfDay / static_cast<float>(MS_PER_MINUTE);
+  size_t from = count - 1;
+  for (size_t i = 0; i < count && points[i].minutes <= minute; ++i) from = i;
+  const SchedulePoint &a = points[from];
+  const SchedulePoint &b = points[(from + 1) % count];
+
+  float duration = from + 1 < count ? b.minutes - a.minutes : (MINUTES_PER_DAY - a.minutes) + b.minutes;
+  float elapsed = minute - a.minutes;
+  if (elapsed < 0) elapsed += MINUTES_PER_DAY;
+  float start = a.level[channel] / static_cast<float>(SCHEDULE_LEVEL_MAX);
+  float end = b.level[channel] / static_cast<float>(SCHEDULE_LEVEL_MAX);
+  return (start + (end - start) * (elapsed / duration)) * PWM_MAX_COUNT;
+}
+
+// The fixed-point level carries DITHER_BITS of fraction and must be the
+// float level rounded to that, give or take one step for the Q16 slope
+void assertMatchesReference(uint32_t msOfDay) {
+  PwmLevel level = evaluateSchedule(msOfDay);
+  const uint16_t counts[3] = {level.red, level.green, level.blue};
+  for (uint8_t c = 0; c < 3; ++c) {
+    float expected = referenceLevel(schedulePoints, schedulePointCount, msOfDay, c) * FRACTION_ONE;
+    if (counts[c] < expected - 1 || counts[c] > expected + 1) {
+      char message[96];
+      snprintf(message, sizeof(message), "channel %u at %u ms: %u, float path %.2f", c, msOfDay, counts[c],
+               expected);
+      TEST_FAIL_MESSAGE(message);
+    }
+  }
+}
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_walk_through_a_day() {
+  for (uint32_t ms = 0; ms < MS_PER_DAY; ms += WALK_STEP_MS) assertMatchesReference(ms);
+  assertMatchesReference(MS_PER_DAY - 1);  // the last segment, just before it wraps
+  assertMatchesReference(0);
+}
+
+void test_scattered_times() {
+  srand(1);
+  for (uint32_t i = 0; i < SCATTERED_SAMPLES; ++i) {
+    assertMatchesReference((static_cast<uint32_t>(rand()) * 7919u) % MS_PER_DAY);
+  }
+}
+
+void test_segment_boundaries() {
+  for (size_t i = 0; i < schedulePointCount; ++i) {
+    uint32_t start = schedulePoints[i].minutes * MS_PER_MINUTE;
+    assertMatchesReference(start);
+    assertMatchesReference((start + MS_PER_DAY - 1) % MS_PER_DAY);
+  }
+}
+
+int main() {
+  setup();
+  host::advanceMicros(3600ull * 1000000);  // past any schedule crossfade from setup()
+
+  UNITY_BEGIN();
+  RUN_TEST(test_walk_through_a_day);
+  RUN_TEST(test_scattered_times);
+  RUN_TEST(test_segment_boundaries);
+  return UNITY_END();
+}
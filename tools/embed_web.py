@@ -0,0 +1,84 @@
+"""Gzip the web UI in web/ and embed it as PROGMEM arrays.
+
+Runs as a PlatformIO pre-build script (see extra_scripts in platformio.ini)
+and can also be run by hand: python tools/embed_web.py
+
+Writes include/web_assets.h with, per asset, the gzipped bytes, their
+length and a content-hash ETag. The header is only rewritten when its
+content changes, so unchanged assets do not trigger a rebuild.
+"""
+
+import gzip
+import hashlib
+import os
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+    PROJECT_DIR = env["PROJECT_DIR"]  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+WEB_DIR = os.path.join(PROJECT_DIR, "web")
+OUTPUT = os.path.join(PROJECT_DIR, "include", "web_assets.h")
+
+# (file in web/, C identifier prefix, content type)
+ASSETS = [
+    ("index.html", "INDEX_HTML", "text/html"),
+    ("update.html", "UPDATE_HTML", "text/html"),
+]
+
+
+def compress(data):
+    # mtime=0 keeps the output (and therefore the ETag) reproducible
+    return gzip.compress(data, compresslevel=9, mtime=0)
+
+
+def c_array(data):
+    lines = []
+    for offset in range(0, len(data), 16):
+        chunk = data[offset:offset + 16]
+        lines.append("  " + ", ".join("0x%02x" % b for b in chunk) + ",")
+    return "\n".join(lines)
+
+
+def render():
+    out = [
+        "#pragma once",
+        "",
+        "// Generated by tools/embed_web.py from web/ - do not edit.",
+        "",
+        "#include <Arduino.h>",
+        "",
+    ]
+    for filename, name, content_type in ASSETS:
+        with open(os.path.join(WEB_DIR, filename), "rb") as f:
+            raw = f.read()
+        packed = compress(raw)
+        etag = hashlib.sha1(packed).hexdigest()[:16]
+        out += [
+            "// %s: %d bytes, %d gzipped" % (filename, len(raw), len(packed)),
+            "const uint8_t %s_GZ[] PROGMEM = {" % name,
+            c_array(packed),
+            "};",
+            "constexpr size_t %s_GZ_LEN = %d;" % (name, len(packed)),
+            'constexpr char %s_ETAG[] = "\\"%s\\"";' % (name, etag),
+            'constexpr char %s_TYPE[] = "%s";' % (name, content_type),
+            "",
+        ]
+    return "\n".join(out)
+
+
+def main():
+    content = render()
+    try:
+        with open(OUTPUT, "r") as f:
+            if f.read() == content:
+                return
+    except OSError:
+        pass
+    with open(OUTPUT, "w") as f:
+        f.write(content)
+    print("embed_web: wrote %s" % os.path.relpath(OUTPUT, PROJECT_DIR))
+
+
+main()